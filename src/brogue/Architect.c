@@ -21,6 +21,8 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <time.h>
+
 #include "Rogue.h"
 #include "IncludeGlobals.h"
 
@@ -33,21 +35,23 @@ boolean cellHasTerrainFlag(short x, short y, unsigned long flagMask) {
 }
 #endif
 
-boolean checkLoopiness(short x, short y) {
+// IN_LOOP while the loops are being found, with a border of unloopy cells around the map so that neighbors never
+// need to be bounds-checked. Cell (x, y) of the map is loopMap[x + 1][y + 1].
+static char loopMap[DCOLS + 2][DROWS + 2];
+
+// Whether a loopy cell should lose its loopiness, for each arrangement of loopy neighbors (bit n set if the neighbor
+// in direction cDirs[n] is loopy). Filled in by fillLoopinessTable() the first time the loops are found.
+static boolean loopinessDrops[256];
+static boolean loopinessTableFilled = false;
+
+static boolean neighborsDropLoopiness(short neighbors) {
 	boolean inString;
-	short newX, newY, dir, sdir;
+	short dir, sdir;
 	short numStrings, maxStringLength, currentStringLength;
 	
-	if (!(pmap[x][y].flags & IN_LOOP)) {
-		return false;
-	}
-	
 	// find an unloopy neighbor to start on
 	for (sdir = 0; sdir < 8; sdir++) {
-		newX = x + cDirs[sdir][0];
-		newY = y + cDirs[sdir][1];
-		if (!coordinatesAreInMap(newX, newY)
-			|| !(pmap[newX][newY].flags & IN_LOOP)) {
+		if (!(neighbors & (1 << sdir))) {
 			break;
 		}
 	}
@@ -60,9 +64,7 @@ boolean checkLoopiness(short x, short y) {
 	numStrings = maxStringLength = currentStringLength = 0;
 	inString = false;
 	for (dir = sdir; dir < sdir + 8; dir++) {
-		newX = x + cDirs[dir % 8][0];
-		newY = y + cDirs[dir % 8][1];
-		if (coordinatesAreInMap(newX, newY) && (pmap[newX][newY].flags & IN_LOOP)) {
+		if (neighbors & (1 << (dir % 8))) {
 			currentStringLength++;
 			if (!inString) {
 				if (numStrings > 0) {
@@ -82,34 +84,64 @@ boolean checkLoopiness(short x, short y) {
 	if (inString && currentStringLength > maxStringLength) {
 		maxStringLength = currentStringLength;
 	}
-	if (numStrings == 1 && maxStringLength <= 4) {
-		pmap[x][y].flags &= ~IN_LOOP;
+	return (numStrings == 1 && maxStringLength <= 4);
+}
+
+static void fillLoopinessTable() {
+	short neighbors;
+	
+	for (neighbors = 0; neighbors < 256; neighbors++) {
+		loopinessDrops[neighbors] = neighborsDropLoopiness(neighbors);
+	}
+	loopinessTableFilled = true;
+}
+
+// Takes (x, y) in loopMap's coordinates. If the cell is loopy but its loopy neighbors form a single short string,
+// the cell is not part of a loop; unmark it and check its neighbors in turn.
+static void checkLoopiness(short x, short y) {
+	short dir, neighbors;
+	
+	if (!loopMap[x][y]) {
+		return;
+	}
+	
+	neighbors = 0;
+	for (dir = 0; dir < 8; dir++) {
+		if (loopMap[x + cDirs[dir][0]][y + cDirs[dir][1]]) {
+			neighbors |= (1 << dir);
+		}
+	}
+	if (loopinessDrops[neighbors]) {
+		loopMap[x][y] = false;
 		
 		for (dir = 0; dir < 8; dir++) {
-			newX = x + cDirs[dir][0];
-			newY = y + cDirs[dir][1];
-			if (coordinatesAreInMap(newX, newY)) {
-				checkLoopiness(newX, newY);
-			}
+			checkLoopiness(x + cDirs[dir][0], y + cDirs[dir][1]);
 		}
-		return true;
-	} else {
-		return false;
 	}
 }
 
-void auditLoop(short x, short y, char grid[DCOLS][DROWS]) {
-	short dir, newX, newY;
-	if (coordinatesAreInMap(x, y)
-		&& !grid[x][y]
-		&& !(pmap[x][y].flags & IN_LOOP)) {
-		
-		grid[x][y] = true;
+// Marks in auditMap every unloopy cell that is connected to (x, y) through unloopy cells. Takes (x, y) and
+// auditMap in loopMap's coordinates; auditMap's border should already be marked, to keep the search on the map.
+static void auditLoop(short x, short y, char auditMap[DCOLS + 2][DROWS + 2]) {
+	static short stack[DCOLS * DROWS];
+	short dir, newX, newY, stackSize;
+	
+	if (auditMap[x][y] || loopMap[x][y]) {
+		return;
+	}
+	auditMap[x][y] = true;
+	stack[0] = x * (DROWS + 2) + y;
+	stackSize = 1;
+	while (stackSize > 0) {
+		stackSize--;
+		x = stack[stackSize] / (DROWS + 2);
+		y = stack[stackSize] % (DROWS + 2);
 		for (dir = 0; dir < 8; dir++) {
 			newX = x + nbDirs[dir][0];
 			newY = y + nbDirs[dir][1];
-			if (coordinatesAreInMap(newX, newY)) {
-				auditLoop(newX, newY, grid);
+			if (!auditMap[newX][newY] && !loopMap[newX][newY]) {
+				auditMap[newX][newY] = true;
+				stack[stackSize++] = newX * (DROWS + 2) + newY;
 			}
 		}
 	}
@@ -170,58 +202,400 @@ short passableArcCount(short x, short y) {
 	return arcCount / 2; // Since we added one when we entered a wall and another when we left.
 }
 
+// The original way of filling in the chokeMap: one depth-first flood-fill per open point that is adjacent to a chokepoint.
+// Kept to check chokeMapByArticulationPoints() against; see D_VERIFY_CHOKE_MAP.
+static void chokeMapByFloodFills(char passMap[DCOLS][DROWS]) {
+	char grid[DCOLS][DROWS];
+	short i, j, i2, j2, dir, newX, newY, cellCount;
+	
+	// Scan through and find a chokepoint next to an open point.
+	for(i=0; i<DCOLS; i++) {
+		for(j=0; j<DROWS; j++) {
+			if (passMap[i][j] && (pmap[i][j].flags & IS_CHOKEPOINT)) {
+				for (dir=0; dir<4; dir++) {
+					newX = i + nbDirs[dir][0];
+					newY = j + nbDirs[dir][1];
+					if (coordinatesAreInMap(newX, newY)
+						&& passMap[newX][newY]
+						&& !(pmap[newX][newY].flags & IS_CHOKEPOINT)) {
+						// OK, (newX, newY) is an open point and (i, j) is a chokepoint.
+						// Pretend (i, j) is blocked by changing passMap, and run a flood-fill cell count starting on (newX, newY).
+						// Keep track of the flooded region in grid[][].
+						zeroOutGrid(grid);
+						passMap[i][j] = false;
+						cellCount = floodFillCount(grid, passMap, newX, newY);
+						passMap[i][j] = true;
+						
+						// CellCount is the size of the region that would be obstructed if the chokepoint were blocked.
+						// CellCounts less than 4 are not useful, so we skip those cases.
+						
+						if (cellCount >= 4) {
+							// Now, on the chokemap, all of those flooded cells should take the lesser of their current value or this resultant number.
+							for(i2=0; i2<DCOLS; i2++) {
+								for(j2=0; j2<DROWS; j2++) {
+									if (grid[i2][j2] && cellCount < chokeMap[i2][j2]) {
+										chokeMap[i2][j2] = cellCount;
+										pmap[i2][j2].flags &= ~IS_GATE_SITE;
+									}
+								}
+							}
+							
+							// The chokepoint itself should also take the lesser of its current value or the flood count.
+							if (cellCount < chokeMap[i][j]) {
+								chokeMap[i][j] = cellCount;
+								pmap[i][j].flags |= IS_GATE_SITE;
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+#define CHOKE_CELLS		(DCOLS * DROWS)
+#define MAX_CHOKE_EVENTS	(CHOKE_CELLS)
+
+// One flood-fill of chokeMapByFloodFills(): blocking "chokepoint" cuts off the region containing "entry".
+typedef struct chokeEvent {
+	short chokepoint;
+	short entry;
+	short count;
+} chokeEvent;
+
+static short chokeCellWeight(char passMap[DCOLS][DROWS], short x, short y) {
+	if (pmap[x][y].flags & IS_IN_AREA_MACHINE) {
+		return 10000;
+	}
+	return (passMap[x][y] == 2 ? 5000 : 1);
+}
+
+// Returns the first position (in search order) at or after "pos" that has not yet been marked.
+// "nextUnmarked" skips over runs of marked positions, and is shortened as it is walked.
+static short chokeNextUnmarked(short nextUnmarked[CHOKE_CELLS + 1], short pos) {
+	short root, next;
+	
+	for (root = pos; nextUnmarked[root] != root; root = nextUnmarked[root]);
+	while (nextUnmarked[pos] != root) {
+		next = nextUnmarked[pos];
+		nextUnmarked[pos] = root;
+		pos = next;
+	}
+	return root;
+}
+
+// Gives every unmarked cell from "start" to "end" (positions in search order) the count, and marks it.
+static void chokeMarkRange(short nextUnmarked[CHOKE_CELLS + 1], short cellAt[CHOKE_CELLS],
+						   short start, short end, short count) {
+	short pos, x, y;
+	
+	for (pos = chokeNextUnmarked(nextUnmarked, start); pos <= end; pos = chokeNextUnmarked(nextUnmarked, pos)) {
+		x = cellAt[pos] / DROWS;
+		y = cellAt[pos] % DROWS;
+		chokeMap[x][y] = count;
+		pmap[x][y].flags &= ~IS_GATE_SITE;
+		nextUnmarked[pos] = pos + 1;
+	}
+}
+
+// Produces the same chokeMap and gate sites as chokeMapByFloodFills(), with one depth-first search instead of a
+// flood-fill per chokepoint exit. The search numbers the passable cells in visiting order, so every subtree is a
+// contiguous run of numbers, and finds the articulation points the Hopcroft-Tarjan way: blocking a chokepoint cuts
+// off each child subtree that has no back edge above the chokepoint, and everything else in its component stays
+// together. Each flood-fill of the old loop is then a known region with a known weight. Painting the regions in
+// order of increasing count (earlier scan order first among equals) leaves every cell with the value and gate flag
+// that the last strictly smaller flood would have given it.
+static void chokeMapByArticulationPoints(char passMap[DCOLS][DROWS]) {
+	// Static rather than on the stack: together these run to about 100 KB.
+	static short tin[CHOKE_CELLS], tout[CHOKE_CELLS], low[CHOKE_CELLS], parent[CHOKE_CELLS], nextDir[CHOKE_CELLS];
+	static short cellAt[CHOKE_CELLS], componentOf[CHOKE_CELLS], nextUnmarked[CHOKE_CELLS + 1];
+	static short componentStart[CHOKE_CELLS], componentEnd[CHOKE_CELLS];
+	static long subtreeWeight[CHOKE_CELLS], componentWeight[CHOKE_CELLS];
+	static chokeEvent events[MAX_CHOKE_EVENTS];
+	static char grid[DCOLS][DROWS];
+	long weight;
+	chokeEvent swapEvent;
+	short i, j, dir, newX, newY, cell, neighbor, child, cutChild, component, componentCount, pos, eventCount;
+	short c, n, x, y, k;
+	
+	for (cell = 0; cell < CHOKE_CELLS; cell++) {
+		tin[cell] = -1;
+	}
+	
+	// Number the cells in depth-first order, one component at a time, without recursion.
+	pos = 0;
+	componentCount = 0;
+	for (i = 0; i < DCOLS; i++) {
+		for (j = 0; j < DROWS; j++) {
+			if (!passMap[i][j] || tin[i * DROWS + j] >= 0) {
+				continue;
+			}
+			component = componentCount++;
+			componentStart[component] = pos;
+			cell = i * DROWS + j;
+			parent[cell] = -1;
+			tin[cell] = low[cell] = pos;
+			cellAt[pos++] = cell;
+			nextDir[cell] = 0;
+			subtreeWeight[cell] = chokeCellWeight(passMap, i, j);
+			componentOf[cell] = component;
+			while (cell >= 0) {
+				x = cell / DROWS;
+				y = cell % DROWS;
+				if (nextDir[cell] < 4) {
+					dir = nextDir[cell]++;
+					newX = x + nbDirs[dir][0];
+					newY = y + nbDirs[dir][1];
+					if (!coordinatesAreInMap(newX, newY) || !passMap[newX][newY]) {
+						continue;
+					}
+					neighbor = newX * DROWS + newY;
+					if (tin[neighbor] >= 0) {
+						low[cell] = min(low[cell], tin[neighbor]);
+					} else {
+						parent[neighbor] = cell;
+						tin[neighbor] = low[neighbor] = pos;
+						cellAt[pos++] = neighbor;
+						nextDir[neighbor] = 0;
+						subtreeWeight[neighbor] = chokeCellWeight(passMap, newX, newY);
+						componentOf[neighbor] = component;
+						cell = neighbor;
+					}
+				} else {
+					tout[cell] = pos - 1;
+					if (parent[cell] >= 0) {
+						low[parent[cell]] = min(low[parent[cell]], low[cell]);
+						subtreeWeight[parent[cell]] += subtreeWeight[cell];
+					}
+					cell = parent[cell];
+				}
+			}
+			componentEnd[component] = pos - 1;
+			componentWeight[component] = subtreeWeight[i * DROWS + j];
+		}
+	}
+	
+	// Work out the region and weight of every flood-fill that the old loop would have run, in the same order.
+	eventCount = 0;
+	for (i = 0; i < DCOLS; i++) {
+		for (j = 0; j < DROWS; j++) {
+			if (!passMap[i][j] || !(pmap[i][j].flags & IS_CHOKEPOINT)) {
+				continue;
+			}
+			c = i * DROWS + j;
+			for (dir = 0; dir < 4; dir++) {
+				newX = i + nbDirs[dir][0];
+				newY = j + nbDirs[dir][1];
+				if (!coordinatesAreInMap(newX, newY)
+					|| !passMap[newX][newY]
+					|| (pmap[newX][newY].flags & IS_CHOKEPOINT)) {
+					continue;
+				}
+				n = newX * DROWS + newY;
+				
+				// Is the entry in a child subtree that gets cut off?
+				cutChild = -1;
+				if (tin[n] > tin[c] && tin[n] <= tout[c]) {
+					for (k = 0; k < 4; k++) {
+						x = i + nbDirs[k][0];
+						y = j + nbDirs[k][1];
+						if (coordinatesAreInMap(x, y) && passMap[x][y]) {
+							child = x * DROWS + y;
+							if (parent[child] == c && tin[child] <= tin[n] && tin[n] <= tout[child]
+								&& low[child] >= tin[c]) {
+								cutChild = child;
+							}
+						}
+					}
+				}
+				if (cutChild >= 0) {
+					weight = subtreeWeight[cutChild];
+				} else {
+					weight = componentWeight[componentOf[c]] - chokeCellWeight(passMap, i, j);
+					for (k = 0; k < 4; k++) {
+						x = i + nbDirs[k][0];
+						y = j + nbDirs[k][1];
+						if (coordinatesAreInMap(x, y) && passMap[x][y]) {
+							child = x * DROWS + y;
+							if (parent[child] == c && low[child] >= tin[c]) {
+								weight -= subtreeWeight[child];
+							}
+						}
+					}
+				}
+				
+				if (weight <= 32767) {
+					events[eventCount].count = min(weight, 10000);
+				} else {
+					// floodFillCount() caps its running total as it goes, and the total can wrap around when enough
+					// area machine cells are involved; let it give its own answer in that case.
+					zeroOutGrid(grid);
+					passMap[i][j] = false;
+					events[eventCount].count = floodFillCount(grid, passMap, newX, newY);
+					passMap[i][j] = true;
+				}
+				if (events[eventCount].count >= 4) {
+					events[eventCount].chokepoint = c;
+					events[eventCount].entry = (cutChild >= 0 ? cutChild : n);
+					eventCount++;
+				}
+			}
+		}
+	}
+	
+	// Stable sort by count; there are only ever a few dozen of these.
+	for (k = 1; k < eventCount; k++) {
+		swapEvent = events[k];
+		for (pos = k; pos > 0 && events[pos - 1].count > swapEvent.count; pos--) {
+			events[pos] = events[pos - 1];
+		}
+		events[pos] = swapEvent;
+	}
+	
+	for (pos = 0; pos <= CHOKE_CELLS; pos++) {
+		nextUnmarked[pos] = pos;
+	}
+	for (k = 0; k < eventCount; k++) {
+		c = events[k].chokepoint;
+		n = events[k].entry;
+		i = c / DROWS;
+		j = c % DROWS;
+		if (parent[n] == c && low[n] >= tin[c]) {
+			// The entry is the root of the cut-off subtree.
+			chokeMarkRange(nextUnmarked, cellAt, tin[n], tout[n], events[k].count);
+		} else {
+			// Everything in the component outside of the chokepoint's subtree, plus the chokepoint's children
+			// that stay connected to it.
+			component = componentOf[c];
+			chokeMarkRange(nextUnmarked, cellAt, componentStart[component], tin[c] - 1, events[k].count);
+			chokeMarkRange(nextUnmarked, cellAt, tout[c] + 1, componentEnd[component], events[k].count);
+			for (dir = 0; dir < 4; dir++) {
+				x = i + nbDirs[dir][0];
+				y = j + nbDirs[dir][1];
+				if (coordinatesAreInMap(x, y) && passMap[x][y]) {
+					child = x * DROWS + y;
+					if (parent[child] == c && low[child] < tin[c]) {
+						chokeMarkRange(nextUnmarked, cellAt, tin[child], tout[child], events[k].count);
+					}
+				}
+			}
+		}
+		// The chokepoint itself takes the count too, unless a smaller flood already reached it.
+		if (chokeNextUnmarked(nextUnmarked, tin[c]) == tin[c]) {
+			chokeMap[i][j] = events[k].count;
+			pmap[i][j].flags |= IS_GATE_SITE;
+			nextUnmarked[tin[c]] = tin[c] + 1;
+		}
+	}
+}
+
+// Runs both chokeMapByFloodFills() and chokeMapByArticulationPoints() and reports any cell where they disagree.
+// The flood-fill result is the one that is kept.
+static void verifyChokeMap(char passMap[DCOLS][DROWS]) {
+	short savedChokeMap[DCOLS][DROWS], fastChokeMap[DCOLS][DROWS];
+	boolean savedGateSite[DCOLS][DROWS], fastGateSite[DCOLS][DROWS];
+	short i, j, mismatches = 0;
+	
+	for (i = 0; i < DCOLS; i++) {
+		for (j = 0; j < DROWS; j++) {
+			savedChokeMap[i][j] = chokeMap[i][j];
+			savedGateSite[i][j] = (pmap[i][j].flags & IS_GATE_SITE) ? true : false;
+		}
+	}
+	chokeMapByArticulationPoints(passMap);
+	for (i = 0; i < DCOLS; i++) {
+		for (j = 0; j < DROWS; j++) {
+			fastChokeMap[i][j] = chokeMap[i][j];
+			fastGateSite[i][j] = (pmap[i][j].flags & IS_GATE_SITE) ? true : false;
+			chokeMap[i][j] = savedChokeMap[i][j];
+			if (savedGateSite[i][j]) {
+				pmap[i][j].flags |= IS_GATE_SITE;
+			} else {
+				pmap[i][j].flags &= ~IS_GATE_SITE;
+			}
+		}
+	}
+	chokeMapByFloodFills(passMap);
+	for (i = 0; i < DCOLS; i++) {
+		for (j = 0; j < DROWS; j++) {
+			if (fastChokeMap[i][j] != chokeMap[i][j]
+				|| fastGateSite[i][j] != ((pmap[i][j].flags & IS_GATE_SITE) ? true : false)) {
+				if (mismatches++ < 10) {
+					printf("\nchokeMap mismatch at (%i, %i): flood-fill %i%s, articulation points %i%s", i, j,
+						   chokeMap[i][j], (pmap[i][j].flags & IS_GATE_SITE) ? " (gate)" : "",
+						   fastChokeMap[i][j], fastGateSite[i][j] ? " (gate)" : "");
+				}
+			}
+		}
+	}
+	if (mismatches) {
+		printf("\n%i chokeMap mismatches on depth %i", mismatches, rogue.depthLevel);
+	}
+}
+
 // locates all loops and chokepoints
 void analyzeMap(boolean calculateChokeMap) {
-	short i, j, i2, j2, dir, newX, newY, oldX, oldY, passableArcCount, cellCount;
-	char grid[DCOLS][DROWS], passMap[DCOLS][DROWS];
+	short i, j, dir, newX, newY, oldX, oldY, passableArcCount;
+	char auditMap[DCOLS + 2][DROWS + 2], passMap[DCOLS][DROWS];
 	boolean designationSurvives;
 	
 	// first find all of the loops
 	rogue.staleLoopMap = false;
+	rogue.terrainEpoch++; // the safety maps read IN_LOOP
 	
 	for(i=0; i<DCOLS; i++) {
 		for(j=0; j<DROWS; j++) {
 			if (cellHasTerrainFlag(i, j, T_PATHING_BLOCKER)
 				&& !cellHasTMFlag(i, j, TM_IS_SECRET)) {
                 
-				pmap[i][j].flags &= ~IN_LOOP;
 				passMap[i][j] = false;
 			} else {
-				pmap[i][j].flags |= IN_LOOP;
 				passMap[i][j] = true;
 			}
+			loopMap[i + 1][j + 1] = passMap[i][j];
 		}
 	}
 	
+	if (!loopinessTableFilled) {
+		fillLoopinessTable();
+	}
 	for(i=0; i<DCOLS; i++) {
 		for(j=0; j<DROWS; j++) {
-			checkLoopiness(i, j);
+			checkLoopiness(i + 1, j + 1);
 		}
 	}
 	
 	// remove extraneous loop markings
-	zeroOutGrid(grid);
-	auditLoop(0, 0, grid);
+	for(i=0; i<DCOLS+2; i++) {
+		for(j=0; j<DROWS+2; j++) {
+			auditMap[i][j] = (i == 0 || j == 0 || i == DCOLS + 1 || j == DROWS + 1);
+		}
+	}
+	auditLoop(1, 1, auditMap);
 	
 	for(i=0; i<DCOLS; i++) {
 		for(j=0; j<DROWS; j++) {
-			if (pmap[i][j].flags & IN_LOOP) {
+			if (loopMap[i + 1][j + 1]) {
 				designationSurvives = false;
 				for (dir = 0; dir < 8; dir++) {
-					newX = i + nbDirs[dir][0];
-					newY = j + nbDirs[dir][1];
-					if (coordinatesAreInMap(newX, newY)
-						&& !grid[newX][newY]
-						&& !(pmap[newX][newY].flags & IN_LOOP)) {
+					newX = i + 1 + nbDirs[dir][0];
+					newY = j + 1 + nbDirs[dir][1];
+					if (!auditMap[newX][newY]
+						&& !loopMap[newX][newY]) {
 						designationSurvives = true;
 						break;
 					}
 				}
 				if (!designationSurvives) {
-					grid[i][j] = true;
-					pmap[i][j].flags &= ~IN_LOOP;
+					auditMap[i + 1][j + 1] = true;
+					loopMap[i + 1][j + 1] = false;
 				}
 			}
+			if (loopMap[i + 1][j + 1]) {
+				pmap[i][j].flags |= IN_LOOP;
+			} else {
+				pmap[i][j].flags &= ~IN_LOOP;
+			}
 		}
 	}
 	
@@ -259,7 +633,7 @@ void analyzeMap(boolean calculateChokeMap) {
 		// chokepoint were blocked. If the tile is not a chokepoint, then the number indicates
 		// the number of tiles that would be rendered unreachable if the nearest exit chokepoint
 		// were blocked.
-		// The cost of all of this is one depth-first flood-fill per open point that is adjacent to a chokepoint.
+		// The cost of all of this is a single depth-first search; see chokeMapByArticulationPoints().
 		
 		// Start by setting the chokepoint values really high, and roping off room machines.
 		for(i=0; i<DCOLS; i++) {
@@ -271,49 +645,10 @@ void analyzeMap(boolean calculateChokeMap) {
 			}
 		}
 		
-		// Scan through and find a chokepoint next to an open point.
-		
-		for(i=0; i<DCOLS; i++) {
-			for(j=0; j<DROWS; j++) {
-				if (passMap[i][j] && (pmap[i][j].flags & IS_CHOKEPOINT)) {
-					for (dir=0; dir<4; dir++) {
-						newX = i + nbDirs[dir][0];
-						newY = j + nbDirs[dir][1];
-						if (coordinatesAreInMap(newX, newY)
-							&& passMap[newX][newY]
-							&& !(pmap[newX][newY].flags & IS_CHOKEPOINT)) {
-							// OK, (newX, newY) is an open point and (i, j) is a chokepoint.
-							// Pretend (i, j) is blocked by changing passMap, and run a flood-fill cell count starting on (newX, newY).
-							// Keep track of the flooded region in grid[][].
-							zeroOutGrid(grid);
-							passMap[i][j] = false;
-							cellCount = floodFillCount(grid, passMap, newX, newY);
-							passMap[i][j] = true;
-							
-							// CellCount is the size of the region that would be obstructed if the chokepoint were blocked.
-							// CellCounts less than 4 are not useful, so we skip those cases.
-							
-							if (cellCount >= 4) {
-								// Now, on the chokemap, all of those flooded cells should take the lesser of their current value or this resultant number.
-								for(i2=0; i2<DCOLS; i2++) {
-									for(j2=0; j2<DROWS; j2++) {
-										if (grid[i2][j2] && cellCount < chokeMap[i2][j2]) {
-											chokeMap[i2][j2] = cellCount;
-											pmap[i2][j2].flags &= ~IS_GATE_SITE;
-										}
-									}
-								}
-								
-								// The chokepoint itself should also take the lesser of its current value or the flood count.
-								if (cellCount < chokeMap[i][j]) {
-									chokeMap[i][j] = cellCount;
-									pmap[i][j].flags |= IS_GATE_SITE;
-								}
-							}
-						}
-					}
-				}
-			}
+		if (D_VERIFY_CHOKE_MAP) {
+			verifyChokeMap(passMap);
+		} else {
+			chokeMapByArticulationPoints(passMap);
 		}
 	}
 }
@@ -377,6 +712,141 @@ boolean blueprintQualifies(short i, unsigned long requiredMachineFlags) {
 	return true;
 }
 
+// The blueprints whose depth range covers each depth, in catalog order.
+static short depthBlueprints[DEEPEST_LEVEL + 1][NUMBER_BLUEPRINTS];
+static short depthBlueprintCount[DEEPEST_LEVEL + 1];
+static boolean depthBlueprintsFilled = false;
+
+static void fillDepthBlueprints() {
+	short depth, i;
+	
+	for (depth = 0; depth <= DEEPEST_LEVEL; depth++) {
+		depthBlueprintCount[depth] = 0;
+		for (i=1; i<NUMBER_BLUEPRINTS; i++) {
+			if (blueprintCatalog[i].depthRange[0] <= depth
+				&& blueprintCatalog[i].depthRange[1] >= depth) {
+				
+				depthBlueprints[depth][depthBlueprintCount[depth]++] = i;
+			}
+		}
+	}
+	depthBlueprintsFilled = true;
+}
+
+// Fills list with the blueprints that qualify on the current depth, in catalog order, and returns how many there are.
+static short listQualifyingBlueprints(short list[NUMBER_BLUEPRINTS], unsigned long requiredMachineFlags) {
+	short i, count = 0;
+	
+	if (rogue.depthLevel < 0 || rogue.depthLevel > DEEPEST_LEVEL) {
+		for (i=1; i<NUMBER_BLUEPRINTS; i++) {
+			if (blueprintQualifies(i, requiredMachineFlags)) {
+				list[count++] = i;
+			}
+		}
+		return count;
+	}
+	if (!depthBlueprintsFilled) {
+		fillDepthBlueprints();
+	}
+	for (i=0; i<depthBlueprintCount[rogue.depthLevel]; i++) {
+		if (blueprintQualifies(depthBlueprints[rogue.depthLevel][i], requiredMachineFlags)) {
+			list[count++] = depthBlueprints[rogue.depthLevel][i];
+		}
+	}
+	return count;
+}
+
+// Machine-building telemetry: for each depth and blueprint, how each attempt to build it ended and how long
+// the attempts took. An attempt is one pass at a blueprint: picking a location and interior, and,
+// if those work out, placing the features. Failures with no blueprint are charged to blueprint 0.
+typedef struct machineBuildStats {
+	unsigned long outcomes[NUMBER_MACHINE_OUTCOMES];
+	clock_t time;
+} machineBuildStats;
+
+static machineBuildStats machineStats[DEEPEST_LEVEL + 1][NUMBER_BLUEPRINTS];
+static clock_t machineTimeCharged = 0; // the time charged to every attempt so far
+
+static const char machineOutcomeNames[NUMBER_MACHINE_OUTCOMES][16] = {
+	"built",
+	"no_blueprint",
+	"no_site",
+	"bad_interior",
+	"no_adoptive",
+	"feature_short",
+};
+
+// Attempts nest when a feature builds an adoptive machine. The clock is read net of the time already charged,
+// so that the time spent on a nested attempt is charged to its own blueprint and not again to the outer one.
+static clock_t machineAttemptStart() {
+	return clock() - machineTimeCharged;
+}
+
+static void noteMachineOutcome(short bp, enum machineBuildOutcomes outcome, clock_t attemptStart) {
+	short depth = clamp(rogue.depthLevel, 0, DEEPEST_LEVEL);
+	clock_t elapsed = machineAttemptStart() - attemptStart;
+	
+	machineStats[depth][bp].outcomes[outcome]++;
+	machineStats[depth][bp].time += elapsed;
+	machineTimeCharged += elapsed;
+}
+
+void resetMachineTelemetry() {
+	memset(machineStats, 0, sizeof(machineStats));
+}
+
+// Saves the telemetry in a form that addMachineTelemetry() can read back in the same build,
+// so that worker processes can hand theirs to the parent.
+boolean writeMachineTelemetry(FILE *stream) {
+	return (fwrite(machineStats, sizeof(machineStats), 1, stream) == 1);
+}
+
+boolean addMachineTelemetry(FILE *stream) {
+	static machineBuildStats addedStats[DEEPEST_LEVEL + 1][NUMBER_BLUEPRINTS];
+	short depth, bp, outcome;
+	
+	if (fread(addedStats, sizeof(addedStats), 1, stream) != 1) {
+		return false;
+	}
+	for (depth = 0; depth <= DEEPEST_LEVEL; depth++) {
+		for (bp = 0; bp < NUMBER_BLUEPRINTS; bp++) {
+			for (outcome = 0; outcome < NUMBER_MACHINE_OUTCOMES; outcome++) {
+				machineStats[depth][bp].outcomes[outcome] += addedStats[depth][bp].outcomes[outcome];
+			}
+			machineStats[depth][bp].time += addedStats[depth][bp].time;
+		}
+	}
+	return true;
+}
+
+// Writes one line per depth and blueprint that was attempted, with the outcome counts and the
+// milliseconds spent. Times leave out any adoptive machines that the blueprint built; those count for their own blueprints.
+void dumpMachineTelemetry(FILE *stream) {
+	short depth, bp, outcome;
+	unsigned long attempts;
+	
+	fprintf(stream, "depth\tblueprint\tattempts");
+	for (outcome = 0; outcome < NUMBER_MACHINE_OUTCOMES; outcome++) {
+		fprintf(stream, "\t%s", machineOutcomeNames[outcome]);
+	}
+	fprintf(stream, "\tms\n");
+	for (depth = 0; depth <= DEEPEST_LEVEL; depth++) {
+		for (bp = 0; bp < NUMBER_BLUEPRINTS; bp++) {
+			attempts = 0;
+			for (outcome = 0; outcome < NUMBER_MACHINE_OUTCOMES; outcome++) {
+				attempts += machineStats[depth][bp].outcomes[outcome];
+			}
+			if (attempts) {
+				fprintf(stream, "%i\t%i\t%lu", depth, bp, attempts);
+				for (outcome = 0; outcome < NUMBER_MACHINE_OUTCOMES; outcome++) {
+					fprintf(stream, "\t%lu", machineStats[depth][bp].outcomes[outcome]);
+				}
+				fprintf(stream, "\t%.1f\n", (double) machineStats[depth][bp].time * 1000 / CLOCKS_PER_SEC);
+			}
+		}
+	}
+}
+
 void abortItemsAndMonsters(item *spawnedItems[MACHINES_BUFFER_LENGTH], creature *spawnedMonsters[MACHINES_BUFFER_LENGTH]) {
 	short i, j;
 	
@@ -645,9 +1115,10 @@ boolean buildAMachine(enum machineTypes bp,
 	sRows[DROWS], sCols[DCOLS],
 	**distanceMap, distance25, distance75, distances[100], distanceBound[2],
 	personalSpace, failsafe, locationFailsafe,
-	machineNumber;
+	machineNumber, qualifyingBlueprints[NUMBER_BLUEPRINTS], qualifyingBlueprintCount;
 	const unsigned long alternativeFlags[2] = {MF_ALTERNATIVE, MF_ALTERNATIVE_2};
     boolean success;
+	clock_t attemptStart;
 	
 	// Our boolean grids:
 	//	Interior:		This is the master grid for the machine. All area inside the machine are set to true.
@@ -669,6 +1140,7 @@ boolean buildAMachine(enum machineTypes bp,
 	const machineFeature *feature;
 	
 	distanceMap = NULL;
+	rogue.terrainEpoch++;
 	
 	chooseBP = (((signed short) bp) <= 0 ? true : false);
 	
@@ -677,6 +1149,7 @@ boolean buildAMachine(enum machineTypes bp,
 	failsafe = 10;
 	do {
         tryAgain = false;
+		attemptStart = machineAttemptStart();
 		if (--failsafe <= 0) {
 			if (distanceMap) {
 				freeGrid(distanceMap);
@@ -697,17 +1170,17 @@ boolean buildAMachine(enum machineTypes bp,
 			
 			// First, choose the blueprint. We choose from among blueprints
 			// that have the required blueprint flags and that satisfy the depth requirements.
+			qualifyingBlueprintCount = listQualifyingBlueprints(qualifyingBlueprints, requiredMachineFlags);
 			totalFreq = 0;
-			for (i=1; i<NUMBER_BLUEPRINTS; i++) {
-				if (blueprintQualifies(i, requiredMachineFlags)) {
-					totalFreq += blueprintCatalog[i].frequency;
-				}
+			for (i=0; i<qualifyingBlueprintCount; i++) {
+				totalFreq += blueprintCatalog[qualifyingBlueprints[i]].frequency;
 			}
 			
 			if (!totalFreq) { // If no suitable blueprints are in the library, fail.
 				if (distanceMap) {
 					freeGrid(distanceMap);
 				}
+				noteMachineOutcome(0, MACHINE_NO_BLUEPRINT, attemptStart);
 				DEBUG printf("\nDepth %i: Failed to build a machine because no suitable blueprints were available.",
 							 rogue.depthLevel);
 				return false;
@@ -715,14 +1188,12 @@ boolean buildAMachine(enum machineTypes bp,
 			
 			// Pick from among the suitable blueprints.
 			randIndex = rand_range(1, totalFreq);
-			for (i=1; i<NUMBER_BLUEPRINTS; i++) {
-				if (blueprintQualifies(i, requiredMachineFlags)) {
-					if (randIndex <= blueprintCatalog[i].frequency) {
-						bp = i;
-						break;
-					} else {
-						randIndex -= blueprintCatalog[i].frequency;
-					}
+			for (i=0; i<qualifyingBlueprintCount; i++) {
+				if (randIndex <= blueprintCatalog[qualifyingBlueprints[i]].frequency) {
+					bp = qualifyingBlueprints[i];
+					break;
+				} else {
+					randIndex -= blueprintCatalog[qualifyingBlueprints[i]].frequency;
 				}
 			}
 			
@@ -765,6 +1236,7 @@ boolean buildAMachine(enum machineTypes bp,
 					if (distanceMap) {
 						freeGrid(distanceMap);
 					}
+					noteMachineOutcome(bp, MACHINE_NO_SITE, attemptStart);
 					DEBUG printf("\nDepth %i: Failed to build a machine; there was no eligible door candidate for the chosen room machine from blueprint %i.",
 								 rogue.depthLevel,
 								 bp);
@@ -783,6 +1255,7 @@ boolean buildAMachine(enum machineTypes bp,
                 if (distanceMap) {
                     freeGrid(distanceMap);
                 }
+                noteMachineOutcome(bp, MACHINE_NO_SITE, attemptStart);
                 DEBUG printf("\nDepth %i: ERROR: Attempted to build a door machine from blueprint %i without a location being provided.",
                              rogue.depthLevel,
                              bp);
@@ -792,6 +1265,7 @@ boolean buildAMachine(enum machineTypes bp,
                 if (distanceMap) {
                     freeGrid(distanceMap);
                 }
+                noteMachineOutcome(bp, MACHINE_NO_SITE, attemptStart);
                 DEBUG printf("\nDepth %i: Failed to build a door machine from blueprint %i; not enough room.",
                              rogue.depthLevel,
                              bp);
@@ -857,6 +1331,10 @@ boolean buildAMachine(enum machineTypes bp,
 			} while (chooseBP && tryAgain && --locationFailsafe);
 		}
 		
+		if (tryAgain) {
+			noteMachineOutcome(bp, MACHINE_BAD_INTERIOR, attemptStart);
+		}
+		
 		// If something went wrong, but we haven't been charged with choosing blueprint OR location,
 		// then there is nothing to try again, so just fail.
 		if (tryAgain && !chooseBP && !chooseLocation) {
@@ -1324,6 +1802,7 @@ boolean buildAMachine(enum machineTypes bp,
                             copyMap(levelBackup, pmap);
                             abortItemsAndMonsters(spawnedItems, spawnedMonsters);
                             freeGrid(distanceMap);
+                            noteMachineOutcome(bp, MACHINE_NO_ADOPTIVE, attemptStart);
                             return false;
                         }
                         theItem = NULL;
@@ -1427,6 +1906,7 @@ boolean buildAMachine(enum machineTypes bp,
 			copyMap(levelBackup, pmap);
 			abortItemsAndMonsters(spawnedItems, spawnedMonsters);
 			freeGrid(distanceMap);
+			noteMachineOutcome(bp, MACHINE_FEATURE_SHORTFALL, attemptStart);
 			return false;
 		}
 	}
@@ -1454,6 +1934,7 @@ boolean buildAMachine(enum machineTypes bp,
 	}
 	
 	freeGrid(distanceMap);
+	noteMachineOutcome(bp, MACHINE_BUILT, attemptStart);
 	DEBUG printf("\nDepth %i: Built a machine from blueprint %i with an origin at (%i, %i).", rogue.depthLevel, bp, originX, originY);
 	return true;
 }
@@ -1989,27 +2470,86 @@ void designRandomRoom(short **grid, boolean attachHallway, short doorSites[4][2]
     }
 }
 
-boolean roomFitsAt(short **dungeonMap, short **roomMap, short roomToDungeonX, short roomToDungeonY) {
-    short xRoom, yRoom, xDungeon, yDungeon, i, j;
-    
-    for (xRoom = 0; xRoom < DCOLS; xRoom++) {
-        for (yRoom = 0; yRoom < DROWS; yRoom++) {
-            if (roomMap[xRoom][yRoom]) {
-                xDungeon = xRoom + roomToDungeonX;
-                yDungeon = yRoom + roomToDungeonY;
-                
-                for (i = xDungeon - 1; i <= xDungeon + 1; i++) {
-                    for (j = yDungeon - 1; j <= yDungeon + 1; j++) {
-                        if (!coordinatesAreInMap(i, j)
-                            || dungeonMap[i][j]) {
-                            return false;
-                        }
-                    }
-                }
-            }
-        }
-    }
-    return true;
+// The cells of the dungeon grid (or of a room, grown by one cell in every direction) as one bit mask per column,
+// with bit y standing for row y. DROWS has to fit in an unsigned long for this to work.
+typedef struct roomFootprint {
+	short minX, minY;				// room coordinates of the top left corner of the grown room's bounding box
+	short width;					// how many columns the grown room spans, or 0 if the room is empty
+	short height;					// how many rows it spans
+	unsigned long columns[DCOLS + 2];	// columns[i] covers room column minX + i, with bit 0 standing for row minY
+} roomFootprint;
+
+static void fillOccupiedColumns(short **dungeonMap, unsigned long occupiedColumns[DCOLS]) {
+	short i, j;
+	
+	for (i = 0; i < DCOLS; i++) {
+		occupiedColumns[i] = 0;
+		for (j = 0; j < DROWS; j++) {
+			if (dungeonMap[i][j]) {
+				occupiedColumns[i] |= (1ul << j);
+			}
+		}
+	}
+}
+
+// Records every cell of roomMap's room, and every cell next to it, in the footprint.
+static void measureRoomFootprint(short **roomMap, roomFootprint *footprint) {
+	short i, j, minX = DCOLS, maxX = -1, minY = DROWS, maxY = -1;
+	
+	for (i = 0; i < DCOLS; i++) {
+		for (j = 0; j < DROWS; j++) {
+			if (roomMap[i][j]) {
+				minX = min(minX, i);
+				maxX = max(maxX, i);
+				minY = min(minY, j);
+				maxY = max(maxY, j);
+			}
+		}
+	}
+	if (maxX < 0) {
+		footprint->width = footprint->height = 0;
+		return;
+	}
+	footprint->minX = minX - 1;
+	footprint->minY = minY - 1;
+	footprint->width = maxX - minX + 3;
+	footprint->height = maxY - minY + 3;
+	for (i = 0; i < footprint->width; i++) {
+		footprint->columns[i] = 0;
+	}
+	for (i = minX; i <= maxX; i++) {
+		for (j = minY; j <= maxY; j++) {
+			if (roomMap[i][j]) {
+				// The cell's column and the columns on either side get the cell and the rows above and below it.
+				footprint->columns[i - footprint->minX - 1] |= (7ul << (j - footprint->minY - 1));
+				footprint->columns[i - footprint->minX] |= (7ul << (j - footprint->minY - 1));
+				footprint->columns[i - footprint->minX + 1] |= (7ul << (j - footprint->minY - 1));
+			}
+		}
+	}
+}
+
+// Whether the room can go at the given offset without touching anything already in the dungeon or the edge of the map.
+// Every side of the footprint's bounding box has a footprint cell on it, so the room is on the map exactly when
+// the bounding box is.
+static boolean roomFitsAt(unsigned long occupiedColumns[DCOLS], roomFootprint *footprint, short roomToDungeonX, short roomToDungeonY) {
+	short i, dungeonX, dungeonY;
+	
+	if (!footprint->width) {
+		return true;
+	}
+	dungeonX = footprint->minX + roomToDungeonX;
+	dungeonY = footprint->minY + roomToDungeonY;
+	if (dungeonX < 0 || dungeonX + footprint->width > DCOLS
+		|| dungeonY < 0 || dungeonY + footprint->height > DROWS) {
+		return false;
+	}
+	for (i = 0; i < footprint->width; i++) {
+		if ((occupiedColumns[dungeonX + i] >> dungeonY) & footprint->columns[i]) {
+			return false;
+		}
+	}
+	return true;
 }
 
 // Called by digDungeon().
@@ -2021,6 +2561,8 @@ void carveDungeon(short **grid) {
     short **roomMap;
     short doorSites[4][2];
     short i, x, y, sCoord[DCOLS*DROWS];
+    unsigned long occupiedColumns[DCOLS];
+    roomFootprint footprint;
     enum directions dir, oppDir;
     const short descentPercent = clamp(100 * (rogue.depthLevel - 1) / (AMULET_LEVEL - 1), 0, 100);
     
@@ -2059,6 +2601,7 @@ void carveDungeon(short **grid) {
     }
     
     roomMap = allocGrid();
+    fillOccupiedColumns(grid, occupiedColumns);
     for (roomsBuilt = roomsAttempted = 0; roomsBuilt < 35 && roomsAttempted < 35; roomsAttempted++) {
         // Build a room in hyperspace.
         fillGrid(roomMap, 0);
@@ -2073,6 +2616,7 @@ void carveDungeon(short **grid) {
             if (doorSites[3][0] != -1) plotCharWithColor('>', mapToWindowX(doorSites[3][0]), mapToWindowY(doorSites[3][1]), &black, &green);
             temporaryMessage("Generating this room:", true);
         }
+        measureRoomFootprint(roomMap, &footprint);
         
         // Slide hyperspace across real space, in a random but predetermined order, until the room matches up with a wall.
         for (i = 0; i < DCOLS*DROWS; i++) {
@@ -2083,7 +2627,7 @@ void carveDungeon(short **grid) {
             oppDir = oppositeDirection(dir);
             if (dir != NO_DIRECTION
                 && doorSites[oppDir][0] != -1
-                && roomFitsAt(grid, roomMap, x - doorSites[oppDir][0], y - doorSites[oppDir][1])) {
+                && roomFitsAt(occupiedColumns, &footprint, x - doorSites[oppDir][0], y - doorSites[oppDir][1])) {
                 
                 // Room fits here.
                 if (D_INSPECT_LEVELGEN) {
@@ -2093,6 +2637,7 @@ void carveDungeon(short **grid) {
                 }
                 insertRoomAt(grid, roomMap, x - doorSites[oppDir][0], y - doorSites[oppDir][1]);
                 grid[x][y] = 2; // Door site.
+                fillOccupiedColumns(grid, occupiedColumns);
                 if (D_INSPECT_LEVELGEN) {
                     hiliteGrid(grid, &green, 50);
                     temporaryMessage("Added room.", true);
@@ -2256,23 +2801,129 @@ void fillLake(short x, short y, short liquid, short scanWidth, char wreathMap[DC
 	}
 }
 
-void lakeFloodFill(short x, short y, short **floodMap, short **grid, short **lakeMap, short dungeonToGridX, short dungeonToGridY) {
-    short newX, newY;
-    enum directions dir;
+// Whether blocking the cells flagged in blockingMap would cut any of the cells that are open in openMap off
+// from each other. Each connected group of open, blocked cells is considered in turn. The open, unblocked
+// cells around it were connected through it, and it's enough to check that they can still reach each other
+// without it: search outward from one of them until the rest have been found. That's usually a short walk
+// around the blocked cells rather than a flood of the whole level, and only a real split costs a full flood.
+static boolean blockingSplitsOpenCells(char openMap[DCOLS][DROWS], char blockingMap[DCOLS][DROWS]) {
+	static short groupQueue[DCOLS * DROWS][2], frontier[DCOLS * DROWS][2], searchQueue[DCOLS * DROWS][2];
+	static short frontierStamp[DCOLS][DROWS], searchStamp[DCOLS][DROWS];
+	char grouped[DCOLS][DROWS];
+	short i, j, x, y, newX, newY, group = 0, groupLength, frontierCount, searchHead, searchLength, found;
+	enum directions dir;
+	
+	zeroOutGrid(grouped);
+	memset(frontierStamp, 0, sizeof(frontierStamp));
+	memset(searchStamp, 0, sizeof(searchStamp));
+	
+	for (i=0; i<DCOLS; i++) {
+		for (j=0; j<DROWS; j++) {
+			if (!blockingMap[i][j] || !openMap[i][j] || grouped[i][j]) {
+				continue;
+			}
+			
+			// Gather the group of blocked cells, and the open cells around it.
+			group++;
+			frontierCount = 0;
+			groupQueue[0][0] = i;
+			groupQueue[0][1] = j;
+			grouped[i][j] = true;
+			for (groupLength = 1; groupLength > 0;) {
+				groupLength--;
+				x = groupQueue[groupLength][0];
+				y = groupQueue[groupLength][1];
+				for (dir = 0; dir < 4; dir++) {
+					newX = x + nbDirs[dir][0];
+					newY = y + nbDirs[dir][1];
+					if (!coordinatesAreInMap(newX, newY) || !openMap[newX][newY]) {
+						continue;
+					}
+					if (blockingMap[newX][newY]) {
+						if (!grouped[newX][newY]) {
+							grouped[newX][newY] = true;
+							groupQueue[groupLength][0] = newX;
+							groupQueue[groupLength][1] = newY;
+							groupLength++;
+						}
+					} else if (frontierStamp[newX][newY] != group) {
+						frontierStamp[newX][newY] = group;
+						frontier[frontierCount][0] = newX;
+						frontier[frontierCount][1] = newY;
+						frontierCount++;
+					}
+				}
+			}
+			
+			if (frontierCount < 2) {
+				continue;
+			}
+			
+			// Search from the first of the open cells until all of them have been found.
+			searchStamp[frontier[0][0]][frontier[0][1]] = group;
+			searchQueue[0][0] = frontier[0][0];
+			searchQueue[0][1] = frontier[0][1];
+			searchHead = 0;
+			searchLength = 1;
+			found = 1;
+			while (searchHead < searchLength && found < frontierCount) {
+				x = searchQueue[searchHead][0];
+				y = searchQueue[searchHead][1];
+				searchHead++;
+				for (dir = 0; dir < 4; dir++) {
+					newX = x + nbDirs[dir][0];
+					newY = y + nbDirs[dir][1];
+					if (coordinatesAreInMap(newX, newY)
+						&& openMap[newX][newY]
+						&& !blockingMap[newX][newY]
+						&& searchStamp[newX][newY] != group) {
+						
+						searchStamp[newX][newY] = group;
+						searchQueue[searchLength][0] = newX;
+						searchQueue[searchLength][1] = newY;
+						searchLength++;
+						if (frontierStamp[newX][newY] == group) {
+							found++;
+						}
+					}
+				}
+			}
+			if (found < frontierCount) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+typedef struct lakeFlood {
+    short **floodMap, **grid, **lakeMap;
+    short dungeonToGridX, dungeonToGridY;
+} lakeFlood;
+
+static boolean lakeFloodStep(short fromX, short fromY, short newX, short newY, void *context) {
+    lakeFlood *flood = (lakeFlood *) context;
     
-    floodMap[x][y] = true;
-    for (dir=0; dir<4; dir++) {
-        newX = x + nbDirs[dir][0];
-        newY = y + nbDirs[dir][1];
-        if (coordinatesAreInMap(newX, newY)
-            && !floodMap[newX][newY]
+    return (!flood->floodMap[newX][newY]
             && !cellHasTerrainFlag(newX, newY, T_PATHING_BLOCKER)
-            && !lakeMap[newX][newY]
-            && (!coordinatesAreInMap(newX+dungeonToGridX, newY+dungeonToGridY) || !grid[newX+dungeonToGridX][newY+dungeonToGridY])) {
-            
-            lakeFloodFill(newX, newY, floodMap, grid, lakeMap, dungeonToGridX, dungeonToGridY);
-        }
-    }
+            && !flood->lakeMap[newX][newY]
+            && (!coordinatesAreInMap(newX+flood->dungeonToGridX, newY+flood->dungeonToGridY)
+                || !flood->grid[newX+flood->dungeonToGridX][newY+flood->dungeonToGridY]));
+}
+
+static void lakeFloodMark(short x, short y, void *context) {
+    ((lakeFlood *) context)->floodMap[x][y] = true;
+}
+
+void lakeFloodFill(short x, short y, short **floodMap, short **grid, short **lakeMap, short dungeonToGridX, short dungeonToGridY) {
+    lakeFlood flood;
+    
+    flood.floodMap = floodMap;
+    flood.grid = grid;
+    flood.lakeMap = lakeMap;
+    flood.dungeonToGridX = dungeonToGridX;
+    flood.dungeonToGridY = dungeonToGridY;
+    floodFillRegion(x, y, lakeFloodStep, lakeFloodMark, &flood);
 }
 
 boolean lakeDisruptsPassability(short **grid, short **lakeMap, short dungeonToGridX, short dungeonToGridY) {
@@ -2332,13 +2983,29 @@ void designLakes(short **lakeMap) {
     short x, y;
     short lakeMaxHeight, lakeMaxWidth;
     short lakeX, lakeY, lakeWidth, lakeHeight;
+    boolean lakeFits;
     
     short **grid; // Holds the current lake.
+    char dryMap[DCOLS][DROWS], proposedLake[DCOLS][DROWS];
+    boolean dryMapIsStale = true, dryMapIsConnected = false;
     
     grid = allocGrid();
     fillGrid(lakeMap, 0);
 	for (lakeMaxHeight = 15, lakeMaxWidth = 30; lakeMaxHeight >=10; lakeMaxHeight--, lakeMaxWidth -= 2) { // lake generations
 		
+        if (dryMapIsStale) {
+            // The dry land only changes when a lake is placed. While it is all one region, a proposed lake
+            // can be checked by looking around its own cells instead of flooding the level.
+            fillGrid(grid, 0);
+            dryMapIsConnected = !lakeDisruptsPassability(grid, lakeMap, 0, 0);
+            for (i=0; i<DCOLS; i++) {
+                for (j=0; j<DROWS; j++) {
+                    dryMap[i][j] = !cellHasTerrainFlag(i, j, T_PATHING_BLOCKER) && !lakeMap[i][j];
+                }
+            }
+            dryMapIsStale = false;
+        }
+		
         fillGrid(grid, 0);
         createBlobOnGrid(grid, &lakeX, &lakeY, &lakeWidth, &lakeHeight, 5, 4, 4, lakeMaxWidth, lakeMaxHeight, 55, "ffffftttt", "ffffttttt");
 		
@@ -2353,7 +3020,19 @@ void designLakes(short **lakeMap) {
 			x = rand_range(1 - lakeX, DCOLS - lakeWidth - lakeX - 2);
 			y = rand_range(1 - lakeY, DROWS - lakeHeight - lakeY - 2);
 			
-            if (!lakeDisruptsPassability(grid, lakeMap, -x, -y)) { // level with lake is completely connected
+            if (dryMapIsConnected) {
+                zeroOutGrid(proposedLake);
+                for (i = 0; i < lakeWidth; i++) {
+                    for (j = 0; j < lakeHeight; j++) {
+                        proposedLake[i + lakeX + x][j + lakeY + y] = grid[i + lakeX][j + lakeY];
+                    }
+                }
+                lakeFits = !blockingSplitsOpenCells(dryMap, proposedLake);
+            } else {
+                lakeFits = !lakeDisruptsPassability(grid, lakeMap, -x, -y);
+            }
+            
+            if (lakeFits) { // level with lake is completely connected
 				//printf("Placed a lake!");
 				
 				// copy in lake
@@ -2366,6 +3045,8 @@ void designLakes(short **lakeMap) {
 					}
 				}
 				
+				dryMapIsStale = true;
+				
 				if (D_INSPECT_LEVELGEN) {
 					dumpLevelToScreen();
 					hiliteGrid(lakeMap, &white, 50);
@@ -2664,7 +3345,11 @@ void updateMapToShore() {
 	short i, j;
 	short **costMap;
 	
-	rogue.updatedMapToShoreThisTurn = true;
+	rogue.derivedMaps[DM_SHORE].updatedThisTurn = true;
+	
+	if (derivedMapIsCurrent(DM_SHORE)) {
+		return;
+	}
 	
 	costMap = allocGrid();
 	
@@ -2788,28 +3473,35 @@ short oppositeDirection(short theDir) {
 	}
 }
 
+typedef struct zoneFill {
+	short zoneLabel;
+	char (*blockingMap)[DROWS];
+	char (*zoneMap)[DROWS];
+} zoneFill;
+
+static boolean connectCellStep(short fromX, short fromY, short newX, short newY, void *context) {
+	zoneFill *zone = (zoneFill *) context;
+	
+	return (zone->zoneMap[newX][newY] == 0
+			&& (!zone->blockingMap || !zone->blockingMap[newX][newY])
+			&& cellIsPassableOrDoor(newX, newY));
+}
+
+static void connectCellMark(short x, short y, void *context) {
+	zoneFill *zone = (zoneFill *) context;
+	
+	zone->zoneMap[x][y] = zone->zoneLabel;
+}
+
 // blockingMap is optional.
 // Returns the size of the connected zone, and marks visited[][] with the zoneLabel.
 short connectCell(short x, short y, short zoneLabel, char blockingMap[DCOLS][DROWS], char zoneMap[DCOLS][DROWS]) {
-	enum directions dir;
-	short newX, newY, size;
-	
-	zoneMap[x][y] = zoneLabel;
-	size = 1;
+	zoneFill zone;
 	
-	for (dir = 0; dir < 4; dir++) {
-		newX = x + nbDirs[dir][0];
-		newY = y + nbDirs[dir][1];
-		
-		if (coordinatesAreInMap(newX, newY)
-			&& zoneMap[newX][newY] == 0
-			&& (!blockingMap || !blockingMap[newX][newY])
-			&& cellIsPassableOrDoor(newX, newY)) {
-			
-			size += connectCell(newX, newY, zoneLabel, blockingMap, zoneMap);
-		}
-	}
-	return size;
+	zone.zoneLabel = zoneLabel;
+	zone.blockingMap = blockingMap;
+	zone.zoneMap = zoneMap;
+	return floodFillRegion(x, y, connectCellStep, connectCellMark, &zone);
 }
 
 // Make a zone map of connected passable regions that include at least one passable
@@ -2821,6 +3513,16 @@ short connectCell(short x, short y, short zoneLabel, char blockingMap[DCOLS][DRO
 short levelIsDisconnectedWithBlockingMap(char blockingMap[DCOLS][DROWS], boolean countRegionSize) {
 	char zoneMap[DCOLS][DROWS];
 	short i, j, dir, zoneSizes[200], zoneCount, smallestQualifyingZoneSize, borderingZone;
+	
+	if (!countRegionSize) {
+		// Only need a yes or no, which can be had without labeling every zone.
+		for (i=0; i<DCOLS; i++) {
+			for (j=0; j<DROWS; j++) {
+				zoneMap[i][j] = cellIsPassableOrDoor(i, j);
+			}
+		}
+		return blockingSplitsOpenCells(zoneMap, blockingMap);
+	}
 
 	zoneCount = 0;
 	smallestQualifyingZoneSize = 10000;
@@ -2927,6 +3629,7 @@ boolean fillSpawnMap(enum dungeonLayers layer,
 					rogue.staleLoopMap = true;
 				}
 				
+				noteTerrainChange(pmap[i][j].layers[layer], surfaceTileType);
 				pmap[i][j].layers[layer] = surfaceTileType; // Place the terrain!
 				accomplishedSomething = true;
 				
@@ -3056,6 +3759,7 @@ boolean spawnDungeonFeature(short x, short y, dungeonFeature *feat, boolean refr
 	if (feat->tile) {
 		if (feat->layer == GAS) {
 			pmap[x][y].volume += feat->startProbability;
+			noteTerrainChange(pmap[x][y].layers[GAS], feat->tile);
 			pmap[x][y].layers[GAS] = feat->tile;
             if (refreshCell) {
                 refreshDungeonCell(x, y);
@@ -3097,6 +3801,7 @@ boolean spawnDungeonFeature(short x, short y, dungeonFeature *feat, boolean refr
 				if (blockingMap[i][j]) {
 					for (layer = 0; layer < NUMBER_TERRAIN_LAYERS; layer++) {
 						if (layer != feat->layer && layer != GAS) {
+							noteTerrainChange(pmap[i][j].layers[layer], (layer == DUNGEON ? FLOOR : NOTHING));
 							pmap[i][j].layers[layer] = (layer == DUNGEON ? FLOOR : NOTHING);
 						}
 					}
@@ -3140,7 +3845,7 @@ boolean spawnDungeonFeature(short x, short y, dungeonFeature *feat, boolean refr
 		}
 	}
 	if (feat->tile && (tileCatalog[feat->tile].flags & (T_IS_DEEP_WATER | T_LAVA_INSTA_DEATH | T_AUTO_DESCENT))) {
-		rogue.updatedMapToShoreThisTurn = false;
+		rogue.deepTerrainEpoch++;
 	}
 	
 	// awaken dormant creatures?
@@ -3474,21 +4179,62 @@ void initializeLevel() {
 	freeGrid(mapToPit);
 }
 
+static boolean cellIsMatchingLocation(short x, short y, short dungeonType, short liquidType, short terrainType) {
+	return !((terrainType >= 0 && !cellHasTerrainType(x, y, terrainType))
+			 || (((dungeonType >= 0 && pmap[x][y].layers[DUNGEON] != dungeonType) || (liquidType >= 0 && pmap[x][y].layers[LIQUID] != liquidType)) && terrainType < 0)
+			 || (pmap[x][y].flags & (HAS_PLAYER | HAS_MONSTER | HAS_DOWN_STAIRS | HAS_UP_STAIRS | HAS_ITEM | IS_IN_MACHINE))
+			 || (terrainType < 0 && !(tileCatalog[dungeonType].flags & T_OBSTRUCTS_ITEMS)
+				 && cellHasTerrainFlag(x, y, T_OBSTRUCTS_ITEMS)));
+}
+
+#define QUICK_MATCHING_LOCATION_TRIES	20
+
+// Tries a few random cells first, which is enough whenever matches are common, and only then
+// lists every matching cell and picks one with a single draw. Unlike plain rejection sampling,
+// this gives up after one scan of the map when nothing matches.
+static boolean randomIndexedMatchingLocation(short *x, short *y, short dungeonType, short liquidType, short terrainType) {
+	static short candidates[DCOLS * DROWS];
+	short i, j, candidateCount = 0;
+	
+	for (i = 0; i < QUICK_MATCHING_LOCATION_TRIES; i++) {
+		*x = rand_range(0, DCOLS - 1);
+		*y = rand_range(0, DROWS - 1);
+		if (cellIsMatchingLocation(*x, *y, dungeonType, liquidType, terrainType)) {
+			return true;
+		}
+	}
+	for (i=0; i<DCOLS; i++) {
+		for (j=0; j<DROWS; j++) {
+			if (cellIsMatchingLocation(i, j, dungeonType, liquidType, terrainType)) {
+				candidates[candidateCount++] = i * DROWS + j;
+			}
+		}
+	}
+	if (candidateCount == 0) {
+		return false;
+	}
+	i = candidates[rand_range(0, candidateCount - 1)];
+	*x = i / DROWS;
+	*y = i % DROWS;
+	return true;
+}
+
 // fills (*x, *y) with the coordinates of a random cell with
 // no creatures, items or stairs and with either a matching liquid and dungeon type
 // or at least one layer of type terrainType.
 // A dungeon, liquid type of -1 will match anything.
 boolean randomMatchingLocation(short *x, short *y, short dungeonType, short liquidType, short terrainType) {
 	short failsafeCount = 0;
+	
+	if (rogue.generatorVersion >= GENERATOR_INDEXED_LOCATIONS) {
+		return randomIndexedMatchingLocation(x, y, dungeonType, liquidType, terrainType);
+	}
+	
 	do {
 		failsafeCount++;
 		*x = rand_range(0, DCOLS - 1);
 		*y = rand_range(0, DROWS - 1);
-	} while (failsafeCount < 500 && ((terrainType >= 0 && !cellHasTerrainType(*x, *y, terrainType))
-									 || (((dungeonType >= 0 && pmap[*x][*y].layers[DUNGEON] != dungeonType) || (liquidType >= 0 && pmap[*x][*y].layers[LIQUID] != liquidType)) && terrainType < 0)
-									 || (pmap[*x][*y].flags & (HAS_PLAYER | HAS_MONSTER | HAS_DOWN_STAIRS | HAS_UP_STAIRS | HAS_ITEM | IS_IN_MACHINE))
-									 || (terrainType < 0 && !(tileCatalog[dungeonType].flags & T_OBSTRUCTS_ITEMS)
-										 && cellHasTerrainFlag(*x, *y, T_OBSTRUCTS_ITEMS))));
+	} while (failsafeCount < 500 && !cellIsMatchingLocation(*x, *y, dungeonType, liquidType, terrainType));
 	if (failsafeCount >= 500) {
 		return false;
 	}
@@ -224,22 +224,32 @@ void shootWeb(creature *breather, short targetLoc[2], short kindOfWeb) {
 	}
 }
 
-void addMonsterToContiguousMonsterGrid(short x, short y, creature *monst, char grid[DCOLS][DROWS]) {
-	short dir, newX, newY;
+typedef struct contiguousMonsterFill {
+	creature *monst;
+	char (*grid)[DROWS];
+} contiguousMonsterFill;
+
+static boolean contiguousMonsterStep(short fromX, short fromY, short newX, short newY, void *context) {
+	contiguousMonsterFill *group = (contiguousMonsterFill *) context;
 	creature *tempMonst;
 	
-	grid[x][y] = true;
-	for (dir=0; dir<4; dir++) {
-		newX = x + nbDirs[dir][0];
-		newY = y + nbDirs[dir][1];
-		
-		if (coordinatesAreInMap(newX, newY) && !grid[newX][newY]) {
-			tempMonst = monsterAtLoc(newX, newY);
-			if (tempMonst && monstersAreTeammates(monst, tempMonst)) {
-				addMonsterToContiguousMonsterGrid(newX, newY, monst, grid);
-			}
-		}
+	if (group->grid[newX][newY]) {
+		return false;
 	}
+	tempMonst = monsterAtLoc(newX, newY);
+	return (tempMonst && monstersAreTeammates(group->monst, tempMonst));
+}
+
+static void contiguousMonsterMark(short x, short y, void *context) {
+	((contiguousMonsterFill *) context)->grid[x][y] = true;
+}
+
+void addMonsterToContiguousMonsterGrid(short x, short y, creature *monst, char grid[DCOLS][DROWS]) {
+	contiguousMonsterFill group;
+	
+	group.monst = monst;
+	group.grid = grid;
+	floodFillRegion(x, y, contiguousMonsterStep, contiguousMonsterMark, &group);
 }
 
 // Splits a monster in half.
@@ -30,6 +30,8 @@ cellDisplayBuffer displayBuffer[COLS][ROWS];	// used to optimize plotCharWithCol
 short terrainRandomValues[DCOLS][DROWS][8];
 short **safetyMap;								// used to help monsters flee
 short **allySafetyMap;							// used to help allies flee
+short **allyEnemyMap;							// used to help blinking allies close on their enemies
+short **allyEnemyCostMap;						// the costs that allyEnemyMap was scanned with
 short **chokeMap;								// used to assess the importance of the map's various chokepoints
 short **playerPathingMap;						// used to calculate routes for mouse movement
 const short nbDirs[8][2] = {{0,-1}, {0,1}, {-1,0}, {1,0}, {-1,-1}, {-1,1}, {1,-1}, {1,1}};
@@ -68,6 +70,10 @@ unsigned long recordingLocation;
 unsigned long maxLevelChanges;
 char annotationPathname[BROGUE_FILENAME_MAX];	// pathname of annotation file
 unsigned long previousGameSeed;
+short newGameGeneratorVersion = GENERATOR_CLASSIC;	// generator version for games that are not recordings
+unsigned long keyframeInterval = 500;				// turns between playback keyframes
+unsigned long keyframeMemoryLimit = 100000000;		// bytes of keyframes to keep; 0 for none
+unsigned long digestInterval = 100;					// turns between the game digests kept with a recording; 0 for none
 
 #pragma mark Colors
 //									Red		Green	Blue	RedRand	GreenRand	BlueRand	Rand	Dances?
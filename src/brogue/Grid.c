@@ -406,27 +406,113 @@ void cellularAutomataRound(short **grid, char birthParameters[9], char survivalP
     freeGrid(buffer2);
 }
 
-// Marks a cell as being a member of blobNumber, then recursively iterates through the rest of the blob
-short fillContiguousRegion(short **grid, short x, short y, short fillValue) {
-    enum directions dir;
-	short newX, newY, numberOfCells = 1;
+// Fills (x, y), and then every cell that can be reached from it by orthogonal steps that canFlood allows,
+// calling fill on each one exactly once. Returns the number of cells filled.
+// canFlood must refuse to step into a cell that has already been filled, and otherwise give the same answer
+// no matter when it is asked. Steps may be one-way, so the filled cells are exactly those that a recursive
+// depth-first fill would reach, though they are filled in a different order.
+// This is a scanline fill: each cell taken off the stack is widened into a horizontal span, and the rows above
+// and below are seeded only where a run of enterable cells starts, instead of recursing once per cell.
+// Each call has a stack of its own, so it can run beside another fill; the stack starts out small, on the C
+// stack, and moves to the heap only for the rare fill that outgrows it.
+#define FLOOD_FILL_LOCAL_STACK	256
+
+short floodFillRegion(short x, short y, floodStepPredicate canFlood, floodCellAction fill, void *context) {
+	short localStack[FLOOD_FILL_LOCAL_STACK][2];
+	short (*stack)[2] = localStack;
+	short stackSize, numberOfCells, left, right, i, newY, side;
+	boolean previousEntered;
 	
-	grid[x][y] = fillValue;
+	fill(x, y, context);
+	numberOfCells = 1;
+	stack[0][0] = x;
+	stack[0][1] = y;
+	stackSize = 1;
 	
-	// Iterate through the four cardinal neighbors.
-	for (dir=0; dir<4; dir++) {
-		newX = x + nbDirs[dir][0];
-		newY = y + nbDirs[dir][1];
-		if (!coordinatesAreInMap(newX, newY)) {
-			break;
+	while (stackSize > 0) {
+		stackSize--;
+		x = stack[stackSize][0];
+		y = stack[stackSize][1];
+		
+		// Widen the cell into the longest span that can be walked to along its row.
+		for (left = x; left > 0 && canFlood(left, y, left - 1, y, context); left--) {
+			fill(left - 1, y, context);
+			numberOfCells++;
 		}
-		if (grid[newX][newY] == 1) { // If the neighbor is an unmarked region cell,
-			numberOfCells += fillContiguousRegion(grid, newX, newY, fillValue); // then recurse.
+		for (right = x; right < DCOLS - 1 && canFlood(right, y, right + 1, y, context); right++) {
+			fill(right + 1, y, context);
+			numberOfCells++;
+		}
+		
+		// Step up and down out of the span. A cell that its left neighbor was just entered from and can walk
+		// into is left for that neighbor's span to pick up; the rest start spans of their own.
+		for (side = -1; side <= 1; side += 2) {
+			newY = y + side;
+			if (newY < 0 || newY >= DROWS) {
+				continue;
+			}
+			previousEntered = false;
+			for (i = left; i <= right; i++) {
+				if (canFlood(i, y, i, newY, context)) {
+					if (!previousEntered || !canFlood(i - 1, newY, i, newY, context)) {
+						fill(i, newY, context);
+						numberOfCells++;
+						if (stack == localStack && stackSize == FLOOD_FILL_LOCAL_STACK) {
+							// every cell is pushed at most once, when it is filled
+							stack = malloc(DCOLS * DROWS * sizeof(short[2]));
+							memcpy(stack, localStack, sizeof(localStack));
+						}
+						stack[stackSize][0] = i;
+						stack[stackSize][1] = newY;
+						stackSize++;
+					}
+					previousEntered = true;
+				} else {
+					previousEntered = false;
+				}
+			}
 		}
 	}
+	
+	if (stack != localStack) {
+		free(stack);
+	}
 	return numberOfCells;
 }
 
+typedef struct contiguousRegionFill {
+	short **grid;
+	short fillValue;
+} contiguousRegionFill;
+
+static boolean contiguousRegionStep(short fromX, short fromY, short toX, short toY, void *context) {
+	enum directions dir;
+	
+	// The region fill has always stopped looking at a cell's neighbors at the first one that is off the map,
+	// so a step is allowed only if every neighbor before it in nbDirs order is on the map.
+	for (dir = 0; nbDirs[dir][0] != toX - fromX || nbDirs[dir][1] != toY - fromY; dir++) {
+		if (!coordinatesAreInMap(fromX + nbDirs[dir][0], fromY + nbDirs[dir][1])) {
+			return false;
+		}
+	}
+	return ((contiguousRegionFill *) context)->grid[toX][toY] == 1; // an unmarked region cell
+}
+
+static void contiguousRegionMark(short x, short y, void *context) {
+	contiguousRegionFill *region = (contiguousRegionFill *) context;
+	
+	region->grid[x][y] = region->fillValue;
+}
+
+// Marks a cell as being a member of blobNumber, then iterates through the rest of the blob
+short fillContiguousRegion(short **grid, short x, short y, short fillValue) {
+	contiguousRegionFill region;
+	
+	region.grid = grid;
+	region.fillValue = fillValue;
+	return floodFillRegion(x, y, contiguousRegionStep, contiguousRegionMark, &region);
+}
+
 // Loads up **grid with the results of a cellular automata simulation.
 void createBlobOnGrid(short **grid,
                       short *retMinX, short *retMinY, short *retWidth, short *retHeight,
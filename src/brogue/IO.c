@@ -1999,6 +1999,78 @@ boolean pauseBrogue(short milliseconds) {
 	return interrupted;
 }
 
+// At a set playback rate, playback runs in frames: the turns due in a frame are played with
+// nothing drawn, for no longer than PLAYBACK_FRAME_LENGTH, and then the screen is drawn once and input
+// is waited for until the next turn is due. A machine that can't keep up still gets its frames, with
+// the turns it owes forgotten rather than rushed.
+
+static unsigned long playbackTurnsPerSecond = 0;	// if nonzero, playback skips frames to play this many turns a second
+static boolean skippingPlaybackFrames = false;	// drawing is off until the frame ends
+static unsigned long playbackScheduleStart, playbackScheduleTurn; // turns are due at the rate from this time and turn
+static unsigned long playbackFrameStart;
+static unsigned long playbackRateStart, playbackRateTurn; // for measuring the rate achieved over each second
+static unsigned long achievedPlaybackRate = 0;
+
+// The playback rate in turns a second, or 0 if playback draws every turn and paces itself by rogue.playbackDelayPerTurn.
+unsigned long playbackRate() {
+	return playbackTurnsPerSecond;
+}
+
+void setPlaybackRate(unsigned long turnsPerSecond) {
+	playbackTurnsPerSecond = turnsPerSecond;
+}
+
+static void beginPlaybackFrame(boolean restartSchedule) {
+	unsigned long now = wallClockMilliseconds();
+	
+	if (restartSchedule) {
+		playbackScheduleStart = playbackRateStart = now;
+		playbackScheduleTurn = playbackRateTurn = rogue.playerTurnNumber;
+		achievedPlaybackRate = 0;
+	}
+	playbackFrameStart = now;
+	skippingPlaybackFrames = true;
+	rogue.playbackFastForward = true;
+}
+
+// If the turns due in the frame have been played or its time is up, draws the screen and returns
+// how long to wait for input before the next frame; otherwise returns 0.
+static short endPlaybackFrame() {
+	unsigned long now = wallClockMilliseconds(), turnsPlayed, turnsDue, nextTurnDue;
+	
+	turnsPlayed = rogue.playerTurnNumber - playbackScheduleTurn;
+	turnsDue = (now - playbackScheduleStart) * playbackTurnsPerSecond / 1000;
+	if (turnsPlayed < turnsDue && now - playbackFrameStart < PLAYBACK_FRAME_LENGTH) {
+		return 0;
+	}
+	
+	if (now - playbackRateStart >= 1000) {
+		achievedPlaybackRate = (rogue.playerTurnNumber - playbackRateTurn) * 1000 / (now - playbackRateStart);
+		playbackRateStart = now;
+		playbackRateTurn = rogue.playerTurnNumber;
+	}
+	stopSkippingPlaybackFrames();
+	
+	if (turnsPlayed < turnsDue) {
+		playbackScheduleStart = now;
+		playbackScheduleTurn = rogue.playerTurnNumber;
+		return 1;
+	}
+	nextTurnDue = playbackScheduleStart + (turnsPlayed + 1) * 1000 / playbackTurnsPerSecond;
+	return (short) max(1, min(PLAYBACK_FRAME_LENGTH, (long) (nextTurnDue - now)));
+}
+
+// Turns drawing back on and draws the screen, if playback is between frames.
+void stopSkippingPlaybackFrames() {
+	if (skippingPlaybackFrames) {
+		skippingPlaybackFrames = false;
+		rogue.playbackFastForward = false;
+		displayLevel();
+		updateMessageDisplay();
+		refreshSideBar(-1, -1, false);
+	}
+}
+
 void nextBrogueEvent(rogueEvent *returnEvent, boolean textInput, boolean colorsDance, boolean realInputEvenInPlayback) {
 	rogueEvent recordingInput;
 	boolean repeatAgain;
@@ -2009,7 +2081,26 @@ void nextBrogueEvent(rogueEvent *returnEvent, boolean textInput, boolean colorsD
 	if (rogue.playbackMode && !realInputEvenInPlayback) {
 		do {
 			repeatAgain = false;
-			if ((!rogue.playbackFastForward && rogue.playbackBetweenTurns)
+			if (skippingPlaybackFrames
+				&& (!playbackTurnsPerSecond || rogue.playbackPaused || rogue.playbackOOS)) {
+				stopSkippingPlaybackFrames();
+			}
+			if (playbackTurnsPerSecond && rogue.playbackBetweenTurns
+				&& !rogue.playbackPaused && !rogue.playbackOOS
+				&& (!rogue.playbackFastForward || skippingPlaybackFrames)) {
+				
+				if (!skippingPlaybackFrames) {
+					beginPlaybackFrame(true);
+				} else if ((pauseDuration = endPlaybackFrame())) {
+					if (pauseBrogue(pauseDuration)) {
+						nextBrogueEvent(&recordingInput, false, false, true);
+						executePlaybackInput(&recordingInput);
+						repeatAgain = true;
+					} else {
+						beginPlaybackFrame(false);
+					}
+				}
+			} else if ((!rogue.playbackFastForward && rogue.playbackBetweenTurns)
 				|| rogue.playbackOOS) {
 				
 				pauseDuration = (rogue.playbackPaused ? DEFAULT_PLAYBACK_DELAY : rogue.playbackDelayThisTurn);
@@ -2990,6 +3081,15 @@ void refreshSideBar(short focusX, short focusY, boolean focusedEntityMustGoFirst
 			sprintf(buf, "Turn %li/%li", rogue.playerTurnNumber, rogue.howManyTurns);
 			printProgressBar(0, printY++, buf, rogue.playerTurnNumber, rogue.howManyTurns, &darkPurple, false);
 		}
+		if (playbackTurnsPerSecond && !rogue.playbackPaused && !rogue.playbackOOS) {
+			if (achievedPlaybackRate) {
+				sprintf(buf, "%lu/%lu turns/s", achievedPlaybackRate, playbackTurnsPerSecond);
+			} else {
+				sprintf(buf, "%lu turns/s", playbackTurnsPerSecond);
+			}
+			printString("                    ", 0, printY, &white, &black, 0);
+			printString(buf, (20 - strlen(buf)) / 2, printY++, &gray, &black, 0);
+		}
 		if (rogue.playbackOOS) {
 			printString("    [OUT OF SYNC]   ", 0, printY++, &badMessageColor, &black, 0);
 		} else if (rogue.playbackPaused) {
@@ -3605,7 +3705,7 @@ void displayGrid(short **map) {
 	bottomRange = 30000;
 	tempColor = black;
 	
-	if (map == safetyMap && !rogue.updatedSafetyMapThisTurn) {
+	if (map == safetyMap && !rogue.derivedMaps[DM_SAFETY].updatedThisTurn) {
 		updateSafetyMap();
 	}
 	
@@ -28,6 +28,8 @@ extern cellDisplayBuffer displayBuffer[COLS][ROWS];
 extern short terrainRandomValues[DCOLS][DROWS][8];
 extern short **safetyMap;										// used to help monsters flee
 extern short **allySafetyMap;
+extern short **allyEnemyMap;
+extern short **allyEnemyCostMap;
 extern short **chokeMap;
 extern short **playerPathingMap;
 
@@ -68,6 +70,10 @@ extern unsigned long recordingLocation;
 extern unsigned long maxLevelChanges;
 extern char annotationPathname[BROGUE_FILENAME_MAX];	// pathname of annotation file
 extern unsigned long previousGameSeed;
+extern short newGameGeneratorVersion;
+extern unsigned long keyframeInterval;
+extern unsigned long keyframeMemoryLimit;
+extern unsigned long digestInterval;
 
 // basic colors
 extern color white;
@@ -66,33 +66,42 @@ item *generateItem(unsigned short theCategory, short theKind) {
 	return theItem;
 }
 
+#define ITEM_CATEGORY_CACHE_SIZE	8
+
 unsigned long pickItemCategory(unsigned long theCategory) {
-	short i, sum, randIndex;
+	short i;
 	short probabilities[13] =						{50,	42,		52,		3,		3,		10,		8,		2,		3,      2,        0,		0,		0};
 	unsigned short correspondingCategories[13] =	{GOLD,	SCROLL,	POTION,	STAFF,	WAND,	WEAPON,	ARMOR,	FOOD,	RING,   CHARM,    AMULET,	GEM,	KEY};
 	
-	sum = 0;
+	// Running totals of the probabilities above, restricted to the categories requested by each of the last
+	// few distinct values of theCategory.
+	static unsigned long cachedCategory[ITEM_CATEGORY_CACHE_SIZE];
+	static short cumulativeProbability[ITEM_CATEGORY_CACHE_SIZE][13];
+	static short cachedCount = 0, nextSlot = 0;
+	short slot, sum;
+	
+	for (slot = 0; slot < cachedCount && cachedCategory[slot] != theCategory; slot++);
 	
-	for (i=0; i<13; i++) {
-		if (theCategory <= 0 || theCategory & correspondingCategories[i]) {
-			sum += probabilities[i];
+	if (slot == cachedCount) {
+		slot = nextSlot;
+		nextSlot = (nextSlot + 1) % ITEM_CATEGORY_CACHE_SIZE;
+		cachedCount = min(cachedCount + 1, ITEM_CATEGORY_CACHE_SIZE);
+		
+		cachedCategory[slot] = theCategory;
+		sum = 0;
+		for (i=0; i<13; i++) {
+			if (theCategory <= 0 || theCategory & correspondingCategories[i]) {
+				sum += probabilities[i];
+			}
+			cumulativeProbability[slot][i] = sum;
 		}
 	}
 	
-	if (sum == 0) {
+	if (cumulativeProbability[slot][12] == 0) {
 		return theCategory; // e.g. when you pass in AMULET or GEM, since they have no frequency
 	}
 	
-	randIndex = rand_range(1, sum);
-	
-	for (i=0; ; i++) {
-		if (theCategory <= 0 || theCategory & correspondingCategories[i]) {
-			if (randIndex <= probabilities[i]) {
-				return correspondingCategories[i];
-			}
-			randIndex -= probabilities[i];
-		}
-	}
+	return correspondingCategories[pickCumulativeFrequency(cumulativeProbability[slot], 13)];
 }
 
 // Sets an item to the given type and category (or chooses randomly if -1) with all other stats
@@ -311,16 +320,62 @@ item *makeItemInto(item *theItem, unsigned long itemCategory, short itemKind) {
 	return theItem;
 }
 
-short chooseKind(itemTable *theTable, short numKinds) {
-	short i, totalFrequencies = 0, randomFrequency;
-	for (i=0; i<numKinds; i++) {
-		totalFrequencies += max(0, theTable[i].frequency);
+#define KIND_TABLE_CACHE_SIZE	12
+#define MAX_KINDS_PER_TABLE		32
+
+// Running totals of the kind frequencies of each item table that chooseKind() has drawn from.
+// A table's totals are dropped whenever setKindFrequency() changes one of its frequencies.
+static struct {
+	itemTable *theTable; // NULL if the slot is free
+	short numKinds;
+	short cumulativeFrequency[MAX_KINDS_PER_TABLE];
+} kindTableCache[KIND_TABLE_CACHE_SIZE];
+static short nextKindTableSlot = 0;
+
+static void forgetKindFrequencies(itemTable *theTable) {
+	short i;
+	
+	for (i=0; i<KIND_TABLE_CACHE_SIZE; i++) {
+		if (kindTableCache[i].theTable == theTable) {
+			kindTableCache[i].theTable = NULL;
+		}
 	}
-	randomFrequency = rand_range(1, totalFrequencies);
-	for (i=0; randomFrequency > theTable[i].frequency; i++) {
-		randomFrequency -= max(0, theTable[i].frequency);
+}
+
+// Use this rather than writing to an item table's frequencies directly, so that chooseKind() notices.
+void setKindFrequency(itemTable *theTable, short theKind, short frequency) {
+	if (theTable[theKind].frequency != frequency) {
+		theTable[theKind].frequency = frequency;
+		forgetKindFrequencies(theTable);
 	}
-	return i;
+}
+
+short chooseKind(itemTable *theTable, short numKinds) {
+	short i, slot, totalFrequencies = 0;
+	
+#ifdef BROGUE_ASSERTS
+	assert(numKinds <= MAX_KINDS_PER_TABLE);
+#endif
+	
+	for (slot = 0;
+		 slot < KIND_TABLE_CACHE_SIZE && (kindTableCache[slot].theTable != theTable || kindTableCache[slot].numKinds != numKinds);
+		 slot++);
+	
+	if (slot == KIND_TABLE_CACHE_SIZE) {
+		for (slot = 0; slot < KIND_TABLE_CACHE_SIZE && kindTableCache[slot].theTable; slot++);
+		if (slot == KIND_TABLE_CACHE_SIZE) {
+			slot = nextKindTableSlot;
+			nextKindTableSlot = (nextKindTableSlot + 1) % KIND_TABLE_CACHE_SIZE;
+		}
+		kindTableCache[slot].theTable = theTable;
+		kindTableCache[slot].numKinds = numKinds;
+		for (i=0; i<numKinds; i++) {
+			totalFrequencies += max(0, theTable[i].frequency);
+			kindTableCache[slot].cumulativeFrequency[i] = totalFrequencies;
+		}
+	}
+	
+	return pickCumulativeFrequency(kindTableCache[slot].cumulativeFrequency, numKinds);
 }
 
 // Places an item at (x,y) if provided or else a random location if they're 0. Inserts item into the floor list.
@@ -368,36 +423,104 @@ item *placeItem(item *theItem, short x, short y) {
 	return theItem;
 }
 
-void fillItemSpawnHeatMap(unsigned short heatMap[DCOLS][DROWS], unsigned short heatLevel, short x, short y) {
-	enum directions dir;
-	short newX, newY;
-	
+static unsigned short itemSpawnDoorHeat(short x, short y) {
 	if (pmap[x][y].layers[DUNGEON] == DOOR) {
-		heatLevel += 10;
+		return 10;
 	} else if (pmap[x][y].layers[DUNGEON] == SECRET_DOOR) {
-		heatLevel += 3000;
+		return 3000;
+	} else {
+		return 0;
 	}
+}
+
+// Lowers each cell's heat to the cheapest way of walking there from (x, y): heatLevel, plus 10 for every
+// door and 3000 for every secret door along the way, counting both ends. Cells are relaxed from a queue
+// until nothing changes, which settles on the same values that a depth-first recursion would.
+void fillItemSpawnHeatMap(unsigned short heatMap[DCOLS][DROWS], unsigned short heatLevel, short x, short y) {
+	static short queue[DCOLS * DROWS][2];
+	char queued[DCOLS][DROWS];
+	enum directions dir;
+	short head = 0, queueLength = 0, newX, newY;
+	long newHeat;
+	
+	zeroOutGrid(queued);
+	
+	heatLevel += itemSpawnDoorHeat(x, y);
 	if (heatMap[x][y] > heatLevel) {
 		heatMap[x][y] = heatLevel;
 	}
-	for (dir = 0; dir < 4; dir++) {
-		newX = x + nbDirs[dir][0];
-		newY = y + nbDirs[dir][1];
-		if (coordinatesAreInMap(newX, newY)
-			&& (!cellHasTerrainFlag(newX, newY, T_OBSTRUCTS_PASSABILITY | T_IS_DEEP_WATER | T_LAVA_INSTA_DEATH | T_AUTO_DESCENT)
-				|| cellHasTMFlag(newX, newY, TM_IS_SECRET))
-			&& heatLevel < heatMap[newX][newY]) {
-			fillItemSpawnHeatMap(heatMap, heatLevel, newX, newY);
+	queue[0][0] = x;
+	queue[0][1] = y;
+	queued[x][y] = true;
+	queueLength = 1;
+	
+	while (queueLength > 0) {
+		x = queue[head][0];
+		y = queue[head][1];
+		queued[x][y] = false;
+		head = (head + 1) % (DCOLS * DROWS);
+		queueLength--;
+		
+		for (dir = 0; dir < 4; dir++) {
+			newX = x + nbDirs[dir][0];
+			newY = y + nbDirs[dir][1];
+			if (coordinatesAreInMap(newX, newY)
+				&& heatMap[x][y] < heatMap[newX][newY]
+				&& (!cellHasTerrainFlag(newX, newY, T_OBSTRUCTS_PASSABILITY | T_IS_DEEP_WATER | T_LAVA_INSTA_DEATH | T_AUTO_DESCENT)
+					|| cellHasTMFlag(newX, newY, TM_IS_SECRET))) {
+				
+				newHeat = heatMap[x][y] + itemSpawnDoorHeat(newX, newY);
+				if (newHeat < heatMap[newX][newY]) {
+					heatMap[newX][newY] = newHeat;
+					if (!queued[newX][newY]) {
+						queue[(head + queueLength) % (DCOLS * DROWS)][0] = newX;
+						queue[(head + queueLength) % (DCOLS * DROWS)][1] = newY;
+						queued[newX][newY] = true;
+						queueLength++;
+					}
+				}
+			}
+		}
+	}
+}
+
+// Items are placed in proportion to the heat of each cell, as though picking from a scan down each
+// column in turn. heatTree is a Fenwick tree over the cells in that order, so that picking a cell
+// and cooling one both take logarithmic time rather than a pass over the whole map.
+#define HEAT_TREE_SIZE	(DCOLS * DROWS)
+
+static void adjustHeatTree(unsigned long heatTree[HEAT_TREE_SIZE + 1], short x, short y, long heatChange) {
+	short n;
+	
+	for (n = x * DROWS + y + 1; n <= HEAT_TREE_SIZE; n += (n & -n)) {
+		heatTree[n] += heatChange;
+	}
+}
+
+static void fillHeatTree(unsigned long heatTree[HEAT_TREE_SIZE + 1], unsigned short heatMap[DCOLS][DROWS]) {
+	short i, j, n;
+	
+	heatTree[0] = 0;
+	for (i=0; i<DCOLS; i++) {
+		for (j=0; j<DROWS; j++) {
+			heatTree[i * DROWS + j + 1] = heatMap[i][j];
+		}
+	}
+	for (n = 1; n <= HEAT_TREE_SIZE; n++) {
+		if (n + (n & -n) <= HEAT_TREE_SIZE) {
+			heatTree[n + (n & -n)] += heatTree[n];
 		}
 	}
 }
 
-void coolHeatMapAt(unsigned short heatMap[DCOLS][DROWS], short x, short y, unsigned long *totalHeat) {
+void coolHeatMapAt(unsigned short heatMap[DCOLS][DROWS], unsigned long heatTree[HEAT_TREE_SIZE + 1],
+				   short x, short y, unsigned long *totalHeat) {
 	short k, l;
 	unsigned short currentHeat;
 	
 	currentHeat = heatMap[x][y];
 	*totalHeat -= heatMap[x][y];
+	adjustHeatTree(heatTree, x, y, -((long) heatMap[x][y]));
 	heatMap[x][y] = 0;
 	
 	// lower the heat near the chosen location
@@ -406,6 +529,7 @@ void coolHeatMapAt(unsigned short heatMap[DCOLS][DROWS], short x, short y, unsig
 			if (coordinatesAreInMap(x+k, y+l) && heatMap[x+k][y+l] == currentHeat) {
 				heatMap[x+k][y+l] = max(1, heatMap[x+k][y+l]/10);
 				*totalHeat -= (currentHeat - heatMap[x+k][y+l]);
+				adjustHeatTree(heatTree, x+k, y+l, -((long) (currentHeat - heatMap[x+k][y+l])));
 			}
 		}
 	}
@@ -413,10 +537,9 @@ void coolHeatMapAt(unsigned short heatMap[DCOLS][DROWS], short x, short y, unsig
 
 // Returns false if no place could be found.
 // That should happen only if the total heat is zero.
-boolean getItemSpawnLoc(unsigned short heatMap[DCOLS][DROWS], short *x, short *y, unsigned long *totalHeat) {
+boolean getItemSpawnLoc(unsigned long heatTree[HEAT_TREE_SIZE + 1], short *x, short *y, unsigned long *totalHeat) {
 	unsigned long randIndex;
-	unsigned short currentHeat;
-	short i, j;
+	short n, step;
 	
 	if (*totalHeat <= 0) {
 		return false;
@@ -426,17 +549,19 @@ boolean getItemSpawnLoc(unsigned short heatMap[DCOLS][DROWS], short *x, short *y
 	
 	//printf("\nrandIndex: %i", randIndex);
 	
-	for (i=0; i<DCOLS; i++) {
-		for (j=0; j<DROWS; j++) {
-			currentHeat = heatMap[i][j];
-			if (randIndex <= currentHeat) { // this is the spot!
-				*x = i;
-				*y = j;
-				return true;
-			}
-			randIndex -= currentHeat;
+	// Find the last cell at which the running total is still short of randIndex; the spot is the next one.
+	for (step = 1; step * 2 <= HEAT_TREE_SIZE; step *= 2);
+	for (n = 0; step > 0; step /= 2) {
+		if (n + step <= HEAT_TREE_SIZE && heatTree[n + step] < randIndex) {
+			n += step;
+			randIndex -= heatTree[n];
 		}
 	}
+	if (n < HEAT_TREE_SIZE) { // this is the spot!
+		*x = n / DROWS;
+		*y = n % DROWS;
+		return true;
+	}
 #ifdef BROGUE_ASSERTS
 	assert(0); // should never get here!
 #endif
@@ -453,6 +578,7 @@ void populateItems(short upstairsX, short upstairsY) {
 	}
 	item *theItem;
 	unsigned short itemSpawnHeatMap[DCOLS][DROWS];
+	unsigned long itemSpawnHeatTree[HEAT_TREE_SIZE + 1];
 	short i, j, numberOfItems, numberOfGoldPiles, goldBonusProbability, x = 0, y = 0;
 	unsigned long totalHeat;
 	short theCategory, theKind;
@@ -547,6 +673,8 @@ void populateItems(short upstairsX, short upstairsY) {
 		}
 	}
 
+	fillHeatTree(itemSpawnHeatTree, itemSpawnHeatMap);
+
 	if (D_INSPECT_LEVELGEN) {
 		short **map = allocGrid();
 		for (i=0; i<DCOLS; i++) {
@@ -564,9 +692,9 @@ void populateItems(short upstairsX, short upstairsY) {
         theCategory = ALL_ITEMS & (~GOLD) & (~FOOD); // gold and food are placed separately, below, so it's not a punishment
         theKind = -1;
 
-        scrollTable[SCROLL_ENCHANTING].frequency = rogue.enchantScrollFrequency;
-        potionTable[POTION_STRENGTH].frequency = rogue.strengthPotionFrequency;
-        potionTable[POTION_LIFE].frequency = rogue.lifePotionFrequency;
+        setKindFrequency(scrollTable, SCROLL_ENCHANTING, rogue.enchantScrollFrequency);
+        setKindFrequency(potionTable, POTION_STRENGTH, rogue.strengthPotionFrequency);
+        setKindFrequency(potionTable, POTION_LIFE, rogue.lifePotionFrequency);
 
         // Adjust the desired item category if necessary.
         // if ((rogue.foodSpawned + foodTable[RATION].strengthRequired / 2) * 4
@@ -601,14 +729,14 @@ void populateItems(short upstairsX, short upstairsY) {
 			if ((theItem->category & FOOD) || ((theItem->category & POTION) && theItem->kind == POTION_STRENGTH)) {
 				randomMatchingLocation(&x, &y, FLOOR, NOTHING, -1); // food and gain strength don't follow the heat map
 			} else {
-				getItemSpawnLoc(itemSpawnHeatMap, &x, &y, &totalHeat);
+				getItemSpawnLoc(itemSpawnHeatTree, &x, &y, &totalHeat);
 			}
 		} while (passableArcCount(x, y) > 1);
 #ifdef BROGUE_ASSERTS
 		assert(coordinatesAreInMap(x, y));
 #endif
 		// Cool off the item spawning heat map at the chosen location:
-		coolHeatMapAt(itemSpawnHeatMap, x, y, &totalHeat);
+		coolHeatMapAt(itemSpawnHeatMap, itemSpawnHeatTree, x, y, &totalHeat);
 		
 		// Regulate the frequency of enchantment scrolls and strength/life potions.
 		if (theItem->category & SCROLL && theItem->kind == SCROLL_ENCHANTING) {
@@ -645,8 +773,8 @@ void populateItems(short upstairsX, short upstairsY) {
 	// Now generate gold.
 	for (i=0; i<numberOfGoldPiles; i++) {
 		theItem = generateItem(GOLD, -1);
-		getItemSpawnLoc(itemSpawnHeatMap, &x, &y, &totalHeat);
-		coolHeatMapAt(itemSpawnHeatMap, x, y, &totalHeat);
+		getItemSpawnLoc(itemSpawnHeatTree, &x, &y, &totalHeat);
+		coolHeatMapAt(itemSpawnHeatMap, itemSpawnHeatTree, x, y, &totalHeat);
 		placeItem(theItem, x, y);
 		rogue.goldGenerated += theItem->quantity;
 	}
@@ -656,9 +784,9 @@ void populateItems(short upstairsX, short upstairsY) {
 		temporaryMessage("Added gold.", true);
 	}
 	
-	scrollTable[SCROLL_ENCHANTING].frequency	= 0;	// No enchant scrolls or strength/life potions can spawn except via initial
-	potionTable[POTION_STRENGTH].frequency      = 0;	// item population or blueprints that create them specifically.
-    potionTable[POTION_LIFE].frequency          = 0;
+	setKindFrequency(scrollTable, SCROLL_ENCHANTING, 0);	// No enchant scrolls or strength/life potions can spawn except via initial
+	setKindFrequency(potionTable, POTION_STRENGTH, 0);		// item population or blueprints that create them specifically.
+    setKindFrequency(potionTable, POTION_LIFE, 0);
 	
 	//DEBUG printf("\nD:%i: %lu gold generated so far.", rogue.depthLevel, rogue.goldGenerated);
 }
@@ -3114,6 +3242,7 @@ boolean tunnelize(short x, short y) {
 	
 	freeCaptivesEmbeddedAt(x, y);
 	
+    rogue.terrainEpoch++;
     if (x == 0 || x == DCOLS - 1 || y == 0 || y == DROWS - 1) {
         pmap[x][y].layers[DUNGEON] = CRYSTAL_WALL; // don't dissolve the boundary walls
         didSomething = true;
@@ -3488,6 +3617,7 @@ void crystalize(short radius) {
 			if ((player.xLoc - i) * (player.xLoc - i) + (player.yLoc - j) * (player.yLoc - j) <= radius * radius
 				&& !(pmap[i][j].flags & IMPREGNABLE)) {
 				
+				rogue.terrainEpoch++;
 				if (i == 0 || i == DCOLS - 1 || j == 0 || j == DROWS - 1) {
 					pmap[i][j].layers[DUNGEON] = CRYSTAL_WALL; // don't dissolve the boundary walls
 				} else if (tileCatalog[pmap[i][j].layers[DUNGEON]].flags & (T_OBSTRUCTS_PASSABILITY | T_OBSTRUCTS_VISION)) {
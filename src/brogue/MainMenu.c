@@ -26,6 +26,7 @@
 #include <math.h>
 #include <time.h>
 #include <limits.h>
+#include <ctype.h>
 
 #define MENU_FLAME_PRECISION_FACTOR		10
 #define MENU_FLAME_RISE_SPEED			50
@@ -566,28 +567,152 @@ boolean dialogChooseFile(char *path, const char *suffix, const char *prompt) {
 	}
 }
 
-void scum(unsigned long startingSeed, short numberOfSeedsToScan, short scanThroughDepth) {
+void writeSeedCatalogHeader(FILE *stream, unsigned long firstSeed, unsigned long lastSeed, short scanThroughDepth) {
+    fprintf(stream, "Brogue seed catalog, seeds %li to %li, through depth %i.\n\n\
+To play one of these seeds, press control-N from the title screen \
+and enter the seed number. Knowing which items will appear on \
+the first %i depths will, of course, make the game significantly easier.",
+            firstSeed, lastSeed, scanThroughDepth, scanThroughDepth);
+}
+
+// Binary seed catalogs hold the same items as the text seed catalog, as fixed-size records that can be
+// queried without generating anything. Numbers are big-endian.
+// The header is 40 bytes: "BRSC", the 16-byte version field of a recording (including the generator
+// version in its last byte), the format version, the catalog depth, two reserved bytes, then the first
+// seed (4), the last seed (4), the record count (4) and the offset of the index (4, zero until indexed).
+// The item records follow in seed order, then depth order, then floor item order, 28 bytes each:
+//	seed (4), depth (1), category (2), kind (1), x (1), y (1), enchant1 (2), enchant2 (2), quantity (2),
+//	charges (2), armor (2), strength required (1), vorpal enemy (1), key depth (1), machine number (1), flags (4).
+// The index holds, for each seed from the first to the last, the number of its first record (4),
+// and then the record count again; then the number of item kinds present (2), followed by one entry per kind,
+// in order of category and kind: category (2), kind (1), a reserved byte, the position of its first
+// posting (4) and its posting count (4); then the postings, which are record numbers (4) in record order.
+#define SEED_CATALOG_FORMAT_VERSION		1
+#define SEED_CATALOG_HEADER_SIZE		40
+#define SEED_CATALOG_RECORD_SIZE		28
+#define SEED_CATALOG_KEY_SIZE			12
+#define SEED_CATALOG_CATEGORIES			16 // item categories are bits of a two-byte field
+
+typedef struct seedCatalogInfo {
+	unsigned long firstSeed;
+	unsigned long lastSeed;
+	short depth;
+	unsigned long recordCount;
+	unsigned long indexOffset;
+} seedCatalogInfo;
+
+void writeBinarySeedCatalogHeader(FILE *stream, unsigned long firstSeed, unsigned long lastSeed, short scanThroughDepth) {
+	unsigned char c[SEED_CATALOG_HEADER_SIZE];
+	short i;
+	
+	memset(c, 0, sizeof(c));
+	memcpy(c, "BRSC", 4);
+	for (i = 0; BROGUE_VERSION_STRING[i] != '\0'; i++) {
+		c[4 + i] = BROGUE_VERSION_STRING[i];
+	}
+	c[4 + 15] = newGameGeneratorVersion;
+	c[20] = SEED_CATALOG_FORMAT_VERSION;
+	c[21] = scanThroughDepth;
+	numberToString(firstSeed, 4, &c[24]);
+	numberToString(lastSeed, 4, &c[28]);
+	fwrite(c, 1, sizeof(c), stream);
+}
+
+static void writeSeedCatalogRecord(item *theItem, FILE *stream) {
+	unsigned char c[SEED_CATALOG_RECORD_SIZE];
+	
+	numberToString(rogue.seed, 4, c);
+	c[4] = rogue.depthLevel;
+	numberToString(theItem->category, 2, &c[5]);
+	c[7] = theItem->kind;
+	c[8] = theItem->xLoc;
+	c[9] = theItem->yLoc;
+	numberToString((unsigned short) theItem->enchant1, 2, &c[10]);
+	numberToString((unsigned short) theItem->enchant2, 2, &c[12]);
+	numberToString(theItem->quantity, 2, &c[14]);
+	numberToString((unsigned short) theItem->charges, 2, &c[16]);
+	numberToString((unsigned short) theItem->armor, 2, &c[18]);
+	c[20] = theItem->strengthRequired;
+	c[21] = theItem->vorpalEnemy;
+	c[22] = theItem->keyZ;
+	c[23] = pmap[theItem->xLoc][theItem->yLoc].machineNumber;
+	numberToString(theItem->flags, 4, &c[24]);
+	fwrite(c, 1, sizeof(c), stream);
+}
+
+static unsigned long catalogNumber(const unsigned char *c, short numberOfBytes) {
+	unsigned long n = 0;
+	short i;
+	
+	for (i = 0; i < numberOfBytes; i++) {
+		n = n * 256 + c[i];
+	}
+	return n;
+}
+
+// Reads the header of a binary seed catalog; returns false if it isn't one, or if its records don't fit in length.
+static boolean readSeedCatalogHeader(const unsigned char *catalog, unsigned long length, seedCatalogInfo *info) {
+	if (length < SEED_CATALOG_HEADER_SIZE
+		|| memcmp(catalog, "BRSC", 4)
+		|| catalog[20] != SEED_CATALOG_FORMAT_VERSION) {
+		return false;
+	}
+	info->depth = catalog[21];
+	info->firstSeed = catalogNumber(&catalog[24], 4);
+	info->lastSeed = catalogNumber(&catalog[28], 4);
+	info->recordCount = catalogNumber(&catalog[32], 4);
+	info->indexOffset = catalogNumber(&catalog[36], 4);
+	return (info->firstSeed <= info->lastSeed
+			&& info->recordCount <= (length - SEED_CATALOG_HEADER_SIZE) / SEED_CATALOG_RECORD_SIZE);
+}
+
+// Rebuilds an item from a seed catalog record, just as it lay on the floor.
+static void catalogRecordToItem(const unsigned char *record, item *theItem, short *depth, short *machineNumber) {
+	memset(theItem, 0, sizeof(item));
+	*depth = record[4];
+	theItem->category = catalogNumber(&record[5], 2);
+	theItem->kind = record[7];
+	theItem->xLoc = record[8];
+	theItem->yLoc = record[9];
+	theItem->enchant1 = (short) catalogNumber(&record[10], 2);
+	theItem->enchant2 = (short) catalogNumber(&record[12], 2);
+	theItem->quantity = catalogNumber(&record[14], 2);
+	theItem->charges = (short) catalogNumber(&record[16], 2);
+	theItem->armor = (short) catalogNumber(&record[18], 2);
+	theItem->strengthRequired = record[20];
+	theItem->vorpalEnemy = record[21];
+	theItem->keyZ = record[22];
+	theItem->flags = catalogNumber(&record[24], 4);
+	*machineNumber = record[23];
+}
+
+// Names a catalog item the way the text seed catalog does. This is identify() without the
+// side effects on the player, which don't exist outside of a game.
+static void catalogItemName(item *theItem, short depth, char *buf) {
+	theItem->flags |= ITEM_IDENTIFIED;
+	theItem->flags &= ~ITEM_CAN_BE_IDENTIFIED;
+	if (theItem->flags & ITEM_RUNIC) {
+		theItem->flags |= (ITEM_RUNIC_IDENTIFIED | ITEM_RUNIC_HINTED);
+	}
+	identifyItemKind(theItem);
+	rogue.depthLevel = depth; // keys mention their depth only when it differs from the current one
+	itemName(theItem, buf, true, true, NULL);
+	upperCase(buf);
+}
+
+// Writes the seed catalog entries of the seeds from firstSeed to lastSeed: the items on each depth through scanThroughDepth,
+// either as text or, if binary is set, as binary seed catalog records. The throwaway recording of each game goes to scratchPath.
+void catalogSeeds(unsigned long firstSeed, unsigned long lastSeed, short scanThroughDepth, boolean binary,
+				  char *scratchPath, FILE *stream) {
     unsigned long theSeed;
-    char path[BROGUE_FILENAME_MAX];
     item *theItem, spareItem;
     char buf[200];
-    FILE *logFile;
     
-    logFile = fopen("Brogue seed scumming log file.txt", "w");
     rogue.nextGame = NG_NOTHING;
-    
-    getAvailableFilePath(path, LAST_GAME_NAME, GAME_SUFFIX);
-    strcat(path, GAME_SUFFIX);
-    
-    fprintf(logFile, "Brogue seed catalog, seeds %li to %li, through depth %i.\n\n\
-To play one of these seeds, press control-N from the title screen \
-and enter the seed number. Knowing which items will appear on \
-the first %i depths will, of course, make the game significantly easier.",
-            startingSeed, startingSeed + numberOfSeedsToScan - 1, scanThroughDepth, scanThroughDepth);
-    
-    for (theSeed = startingSeed; theSeed < startingSeed + numberOfSeedsToScan; theSeed++) {
-        fprintf(logFile, "\n\nSeed %li:", theSeed);
-        printf("\nScanned seed %li.", theSeed);
+    for (theSeed = firstSeed; theSeed <= lastSeed; theSeed++) {
+        if (!binary) {
+            fprintf(stream, "\n\nSeed %li:", theSeed);
+        }
         rogue.nextGamePath[0] = '\0';
         randomNumbersGenerated = 0;
         
@@ -595,28 +720,639 @@ the first %i depths will, of course, make the game significantly easier.",
         rogue.playbackFastForward = false;
         rogue.playbackBetweenTurns = false;
         
-        strcpy(currentFilePath, path);
+        strcpy(currentFilePath, scratchPath);
         initializeRogue(theSeed);
         for (rogue.depthLevel = 1; rogue.depthLevel <= scanThroughDepth; rogue.depthLevel++) {
             startLevel(rogue.depthLevel == 1 ? 1 : rogue.depthLevel - 1, 1); // descending into level n
-            fprintf(logFile, "\n    Depth %i:", rogue.depthLevel);
+            if (binary) {
+                for (theItem = floorItems->nextItem; theItem != NULL; theItem = theItem->nextItem) {
+                    writeSeedCatalogRecord(theItem, stream);
+                }
+                continue;
+            }
+            fprintf(stream, "\n    Depth %i:", rogue.depthLevel);
             for (theItem = floorItems->nextItem; theItem != NULL; theItem = theItem->nextItem) {
                 spareItem = *theItem;
                 identify(&spareItem);
                 itemName(&spareItem, buf, true, true, NULL);
                 upperCase(buf);
-                fprintf(logFile, "\n        %s", buf);
+                fprintf(stream, "\n        %s", buf);
                 if (pmap[theItem->xLoc][theItem->yLoc].machineNumber > 0) {
-                    fprintf(logFile, " (vault %i)", pmap[theItem->xLoc][theItem->yLoc].machineNumber);
+                    fprintf(stream, " (vault %i)", pmap[theItem->xLoc][theItem->yLoc].machineNumber);
                 }
             }
         }
         freeEverything();
         remove(currentFilePath); // Don't add a spurious LastGame file to the brogue folder.
     }
+}
+
+void scum(unsigned long startingSeed, short numberOfSeedsToScan, short scanThroughDepth) {
+    char path[BROGUE_FILENAME_MAX];
+    FILE *logFile;
+    
+    logFile = fopen("Brogue seed scumming log file.txt", "w");
+    
+    getAvailableFilePath(path, LAST_GAME_NAME, GAME_SUFFIX);
+    strcat(path, GAME_SUFFIX);
+    
+    writeSeedCatalogHeader(logFile, startingSeed, startingSeed + numberOfSeedsToScan - 1, scanThroughDepth);
+    catalogSeeds(startingSeed, startingSeed + numberOfSeedsToScan - 1, scanThroughDepth, false, path, logFile);
     fclose(logFile);
 }
 
+static const struct {
+	const char *name;
+	unsigned long category;
+	short kindCount;
+} seedPredicateCategories[] = {
+	{"food",	FOOD,	NUMBER_FOOD_KINDS},
+	{"weapon",	WEAPON,	NUMBER_WEAPON_KINDS},
+	{"armor",	ARMOR,	NUMBER_ARMOR_KINDS},
+	{"potion",	POTION,	NUMBER_POTION_KINDS},
+	{"scroll",	SCROLL,	NUMBER_SCROLL_KINDS},
+	{"staff",	STAFF,	NUMBER_STAFF_KINDS},
+	{"wand",	WAND,	NUMBER_WAND_KINDS},
+	{"ring",	RING,	NUMBER_RING_KINDS},
+	{"charm",	CHARM,	NUMBER_CHARM_KINDS},
+	{"gold",	GOLD,	0},
+	{"amulet",	AMULET,	0},
+	{"gem",		GEM,	0},
+	{"key",		KEY,	0},
+};
+
+// Case-insensitive comparison of a kind name against the first length characters of text,
+// in which underscores stand for spaces.
+static boolean kindNameMatches(const char *name, const char *text, short length) {
+	short i;
+	
+	for (i = 0; i < length; i++) {
+		if (name[i] == '\0'
+			|| (text[i] == '_' ? ' ' : tolower((unsigned char) text[i])) != tolower((unsigned char) name[i])) {
+			return false;
+		}
+	}
+	return (name[length] == '\0');
+}
+
+// Parses a predicate such as "wand:domination@3" or "armor+3@4,vault@4": clauses separated by commas, each
+// either category[:kind][+enchant][@depth] or vault[@depth]. The depth defaults to the amulet level.
+// Returns false if the text doesn't parse.
+boolean parseSeedPredicate(const char *text, seedPredicate *predicate) {
+	seedPredicateClause *clause;
+	itemTable *table;
+	const char *end;
+	char *numberEnd;
+	short i, category, length;
+	
+	predicate->clauseCount = 0;
+	predicate->maximumDepth = 0;
+	for (;;) {
+		if (predicate->clauseCount >= MAX_SEED_PREDICATE_CLAUSES) {
+			return false;
+		}
+		clause = &(predicate->clauses[predicate->clauseCount++]);
+		clause->category = 0;
+		clause->kind = -1;
+		clause->checkEnchant = false;
+		clause->minimumEnchant = 0;
+		clause->maximumDepth = AMULET_LEVEL;
+		
+		// The category, or "vault".
+		for (end = text; isalpha((unsigned char) *end); end++);
+		length = end - text;
+		category = -1;
+		for (i = 0; i < (short) (sizeof(seedPredicateCategories) / sizeof(seedPredicateCategories[0])); i++) {
+			if (length == (short) strlen(seedPredicateCategories[i].name)
+				&& !strncmp(text, seedPredicateCategories[i].name, length)) {
+				
+				category = i;
+				clause->category = seedPredicateCategories[i].category;
+				break;
+			}
+		}
+		if (category == -1 && !(length == 5 && !strncmp(text, "vault", 5))) {
+			return false;
+		}
+		text = end;
+		
+		if (category != -1) {
+			// The kind, by name.
+			if (*text == ':') {
+				text++;
+				for (end = text; isalpha((unsigned char) *end) || *end == '_'; end++);
+				table = tableForItemCategory(clause->category);
+				for (i = 0; table && i < seedPredicateCategories[category].kindCount; i++) {
+					if (kindNameMatches(table[i].name, text, end - text)) {
+						clause->kind = i;
+						break;
+					}
+				}
+				if (clause->kind == -1) {
+					return false;
+				}
+				text = end;
+			}
+			// The minimum enchantment.
+			if (*text == '+' || *text == '-') {
+				clause->minimumEnchant = strtol(text, &numberEnd, 10);
+				if (numberEnd == text + 1) {
+					return false;
+				}
+				clause->checkEnchant = true;
+				text = numberEnd;
+			}
+		}
+		
+		// The depth.
+		if (*text == '@') {
+			text++;
+			clause->maximumDepth = strtol(text, &numberEnd, 10);
+			if (numberEnd == text || clause->maximumDepth < 1 || clause->maximumDepth > DEEPEST_LEVEL) {
+				return false;
+			}
+			text = numberEnd;
+		}
+		predicate->maximumDepth = max(predicate->maximumDepth, clause->maximumDepth);
+		
+		if (*text == '\0') {
+			return true;
+		} else if (*text != ',') {
+			return false;
+		}
+		text++;
+	}
+}
+
+static boolean itemSatisfiesClause(item *theItem, seedPredicateClause *clause) {
+	return ((theItem->category & clause->category)
+			&& (clause->kind == -1 || theItem->kind == clause->kind)
+			&& (!clause->checkEnchant || theItem->enchant1 >= clause->minimumEnchant));
+}
+
+// Generates the seed one depth at a time, just as a new game would, until the predicate is decided:
+// either every clause has been satisfied, or a clause has gone past its depth without being satisfied.
+// Items are compared by category, kind and enchantment, without being named.
+boolean seedMatchesPredicate(unsigned long seed, seedPredicate *predicate, char *scratchPath) {
+	boolean satisfied[MAX_SEED_PREDICATE_CLAUSES] = {false};
+	boolean decided = false, matched = false;
+	seedPredicateClause *clause;
+	item *theItem;
+	short i;
+	
+	rogue.nextGame = NG_NOTHING;
+	rogue.nextGamePath[0] = '\0';
+	randomNumbersGenerated = 0;
+	
+	rogue.playbackMode = false;
+	rogue.playbackFastForward = false;
+	rogue.playbackBetweenTurns = false;
+	
+	strcpy(currentFilePath, scratchPath);
+	initializeRogue(seed);
+	for (rogue.depthLevel = 1; !decided && rogue.depthLevel <= predicate->maximumDepth; rogue.depthLevel++) {
+		startLevel(rogue.depthLevel == 1 ? 1 : rogue.depthLevel - 1, 1); // descending into level n
+		
+		matched = true;
+		for (i = 0; i < predicate->clauseCount; i++) {
+			clause = &(predicate->clauses[i]);
+			if (!satisfied[i] && rogue.depthLevel <= clause->maximumDepth) {
+				if (!clause->category) {
+					satisfied[i] = (rogue.rewardRoomsGenerated > 0);
+				} else {
+					for (theItem = floorItems->nextItem; theItem != NULL && !satisfied[i]; theItem = theItem->nextItem) {
+						satisfied[i] = itemSatisfiesClause(theItem, clause);
+					}
+				}
+			}
+			if (!satisfied[i]) {
+				matched = false;
+				if (rogue.depthLevel >= clause->maximumDepth) {
+					decided = true; // this clause can no longer be satisfied
+				}
+			}
+		}
+		if (matched) {
+			decided = true;
+		}
+	}
+	freeEverything();
+	remove(currentFilePath); // Don't leave the recording lying around.
+	return matched;
+}
+
+static short categoryBit(unsigned long category) {
+	short bit;
+	
+	for (bit = 0; bit < SEED_CATALOG_CATEGORIES - 1 && !(category & Fl(bit)); bit++);
+	return bit;
+}
+
+// Builds the index of a binary seed catalog whose records have all been written, in two passes over
+// the records, and fills in the header. The stream must be open for reading and writing.
+// Returns false if the catalog is malformed.
+boolean indexSeedCatalog(FILE *stream) {
+	unsigned char header[SEED_CATALOG_HEADER_SIZE], record[SEED_CATALOG_RECORD_SIZE], c[SEED_CATALOG_KEY_SIZE];
+	unsigned long (*keyCounts)[256], *seedStarts, *postings;
+	unsigned long recordCount, seedCount, seed, previousSeed, r, position, keyCount;
+	long end;
+	seedCatalogInfo info;
+	short bit, kind;
+	boolean succeeded = true;
+	
+	if (fseek(stream, 0, SEEK_END) || (end = ftell(stream)) < SEED_CATALOG_HEADER_SIZE
+		|| fseek(stream, 0, SEEK_SET) || fread(header, 1, SEED_CATALOG_HEADER_SIZE, stream) != SEED_CATALOG_HEADER_SIZE
+		|| !readSeedCatalogHeader(header, end, &info)) {
+		return false;
+	}
+	if (info.indexOffset) {
+		end = info.indexOffset; // reindexing
+	}
+	if ((end - SEED_CATALOG_HEADER_SIZE) % SEED_CATALOG_RECORD_SIZE) {
+		return false;
+	}
+	recordCount = (end - SEED_CATALOG_HEADER_SIZE) / SEED_CATALOG_RECORD_SIZE;
+	seedCount = info.lastSeed - info.firstSeed + 1;
+	
+	keyCounts = calloc(SEED_CATALOG_CATEGORIES, sizeof(*keyCounts));
+	seedStarts = malloc((seedCount + 1) * sizeof(unsigned long));
+	postings = malloc(max(recordCount, 1) * sizeof(unsigned long));
+	
+	// First pass: the first record of each seed, and the number of records of each kind.
+	previousSeed = info.firstSeed;
+	seedStarts[0] = 0;
+	for (r = 0; r < recordCount && succeeded; r++) {
+		if (fread(record, 1, SEED_CATALOG_RECORD_SIZE, stream) != SEED_CATALOG_RECORD_SIZE) {
+			succeeded = false;
+			break;
+		}
+		seed = catalogNumber(record, 4);
+		if (seed < previousSeed || seed > info.lastSeed) {
+			succeeded = false; // out of order
+			break;
+		}
+		for (; previousSeed < seed; previousSeed++) {
+			seedStarts[previousSeed + 1 - info.firstSeed] = r;
+		}
+		keyCounts[categoryBit(catalogNumber(&record[5], 2))][record[7]]++;
+	}
+	for (; previousSeed <= info.lastSeed && succeeded; previousSeed++) {
+		seedStarts[previousSeed + 1 - info.firstSeed] = recordCount;
+	}
+	
+	// Turn the counts into the positions of each kind's first posting, and write the index.
+	position = keyCount = 0;
+	for (bit = 0; bit < SEED_CATALOG_CATEGORIES; bit++) {
+		for (kind = 0; kind < 256; kind++) {
+			if (keyCounts[bit][kind]) {
+				r = keyCounts[bit][kind];
+				keyCounts[bit][kind] = position;
+				position += r;
+				keyCount++;
+			} else {
+				keyCounts[bit][kind] = ULONG_MAX;
+			}
+		}
+	}
+	
+	// Second pass: the postings.
+	if (succeeded && fseek(stream, SEED_CATALOG_HEADER_SIZE, SEEK_SET) == 0) {
+		for (r = 0; r < recordCount; r++) {
+			if (fread(record, 1, SEED_CATALOG_RECORD_SIZE, stream) != SEED_CATALOG_RECORD_SIZE) {
+				succeeded = false;
+				break;
+			}
+			postings[keyCounts[categoryBit(catalogNumber(&record[5], 2))][record[7]]++] = r;
+		}
+	} else {
+		succeeded = false;
+	}
+	
+	if (succeeded && fseek(stream, end, SEEK_SET) == 0) {
+		for (r = 0; r <= seedCount; r++) {
+			numberToString(seedStarts[r], 4, c);
+			fwrite(c, 1, 4, stream);
+		}
+		numberToString(keyCount, 2, c);
+		fwrite(c, 1, 2, stream);
+		position = 0;
+		for (bit = 0; bit < SEED_CATALOG_CATEGORIES; bit++) {
+			for (kind = 0; kind < 256; kind++) {
+				if (keyCounts[bit][kind] != ULONG_MAX) {
+					// The second pass left each position at the start of the next kind's postings.
+					numberToString(Fl(bit), 2, c);
+					c[2] = kind;
+					c[3] = 0;
+					numberToString(position, 4, &c[4]);
+					numberToString(keyCounts[bit][kind] - position, 4, &c[8]);
+					fwrite(c, 1, SEED_CATALOG_KEY_SIZE, stream);
+					position = keyCounts[bit][kind];
+				}
+			}
+		}
+		for (r = 0; r < recordCount; r++) {
+			numberToString(postings[r], 4, c);
+			fwrite(c, 1, 4, stream);
+		}
+		
+		numberToString(recordCount, 4, &header[32]);
+		numberToString(end, 4, &header[36]);
+		fseek(stream, 0, SEEK_SET);
+		fwrite(header, 1, SEED_CATALOG_HEADER_SIZE, stream);
+		succeeded = (fflush(stream) == 0);
+	} else {
+		succeeded = false;
+	}
+	
+	free(keyCounts);
+	free(seedStarts);
+	free(postings);
+	return succeeded;
+}
+
+// Checks that an indexed binary seed catalog is whole, and finds its seed table, key directory and postings.
+static boolean readSeedCatalogIndex(const unsigned char *catalog, unsigned long length, seedCatalogInfo *info,
+									const unsigned char **seedStarts, const unsigned char **keys, unsigned long *keyCount,
+									const unsigned char **postings) {
+	unsigned long seedTableSize;
+	
+	if (!readSeedCatalogHeader(catalog, length, info)
+		|| info->indexOffset != SEED_CATALOG_HEADER_SIZE + info->recordCount * SEED_CATALOG_RECORD_SIZE) {
+		return false;
+	}
+	seedTableSize = (info->lastSeed - info->firstSeed + 2) * 4;
+	if (length < info->indexOffset + seedTableSize + 2) {
+		return false;
+	}
+	*seedStarts = catalog + info->indexOffset;
+	*keyCount = catalogNumber(*seedStarts + seedTableSize, 2);
+	*keys = *seedStarts + seedTableSize + 2;
+	*postings = *keys + *keyCount * SEED_CATALOG_KEY_SIZE;
+	return (length >= (unsigned long) (*postings - catalog) + info->recordCount * 4);
+}
+
+// Converts an indexed binary seed catalog back to the text seed catalog. Returns false if the catalog is malformed.
+boolean writeSeedCatalogText(const unsigned char *catalog, unsigned long length, FILE *stream) {
+	const unsigned char *seedStarts, *keys, *postings, *record;
+	unsigned long seed, r, lastRecord, keyCount;
+	seedCatalogInfo info;
+	short depth, itemDepth, machineNumber;
+	item theItem;
+	char buf[200];
+	
+	if (!readSeedCatalogIndex(catalog, length, &info, &seedStarts, &keys, &keyCount, &postings)) {
+		return false;
+	}
+	writeSeedCatalogHeader(stream, info.firstSeed, info.lastSeed, info.depth);
+	for (seed = info.firstSeed; seed <= info.lastSeed; seed++) {
+		fprintf(stream, "\n\nSeed %li:", seed);
+		r = catalogNumber(seedStarts + (seed - info.firstSeed) * 4, 4);
+		lastRecord = catalogNumber(seedStarts + (seed - info.firstSeed + 1) * 4, 4);
+		for (depth = 1; depth <= info.depth; depth++) {
+			fprintf(stream, "\n    Depth %i:", depth);
+			for (; r < lastRecord; r++) {
+				record = catalog + SEED_CATALOG_HEADER_SIZE + r * SEED_CATALOG_RECORD_SIZE;
+				catalogRecordToItem(record, &theItem, &itemDepth, &machineNumber);
+				if (itemDepth != depth) {
+					break;
+				}
+				catalogItemName(&theItem, itemDepth, buf);
+				fprintf(stream, "\n        %s", buf);
+				if (machineNumber > 0) {
+					fprintf(stream, " (vault %i)", machineNumber);
+				}
+			}
+		}
+	}
+	return true;
+}
+
+static boolean recordSatisfiesClause(const unsigned char *record, seedPredicateClause *clause) {
+	item theItem;
+	short depth, machineNumber;
+	
+	catalogRecordToItem(record, &theItem, &depth, &machineNumber);
+	if (depth > clause->maximumDepth) {
+		return false;
+	} else if (clause->category == 0) {
+		return (machineNumber > 0); // a vault clause: in the catalog, any item that is listed as being in a vault
+	} else {
+		return itemSatisfiesClause(&theItem, clause);
+	}
+}
+
+static void noteSatisfiedClause(unsigned short *satisfied, seedCatalogInfo *info, const unsigned char *record, short clause) {
+	unsigned long seed = catalogNumber(record, 4);
+	
+	if (seed >= info->firstSeed && seed <= info->lastSeed) {
+		satisfied[seed - info->firstSeed] |= (1 << clause);
+	}
+}
+
+// Lists the seeds of an indexed binary seed catalog that match the predicate, with the items that
+// satisfy its clauses. Item clauses are answered from the index, without reading any other records.
+// Returns the number of matching seeds, or -1 if the catalog is malformed.
+long querySeedCatalog(const unsigned char *catalog, unsigned long length, seedPredicate *predicate, FILE *stream) {
+	const unsigned char *seedStarts, *keys, *postings, *record;
+	unsigned long seed, r, lastRecord, keyCount, k, p, first, count;
+	unsigned short *satisfied, allSatisfied;
+	seedCatalogInfo info;
+	short i, depth, machineNumber;
+	long matchCount = 0;
+	item theItem;
+	char buf[200];
+	
+	if (!readSeedCatalogIndex(catalog, length, &info, &seedStarts, &keys, &keyCount, &postings)) {
+		return -1;
+	}
+	satisfied = calloc(info.lastSeed - info.firstSeed + 1, sizeof(unsigned short));
+	allSatisfied = (1 << predicate->clauseCount) - 1;
+	
+	for (i = 0; i < predicate->clauseCount; i++) {
+		if (predicate->clauses[i].category == 0) {
+			for (r = 0; r < info.recordCount; r++) {
+				record = catalog + SEED_CATALOG_HEADER_SIZE + r * SEED_CATALOG_RECORD_SIZE;
+				if (recordSatisfiesClause(record, &(predicate->clauses[i]))) {
+					noteSatisfiedClause(satisfied, &info, record, i);
+				}
+			}
+			continue;
+		}
+		for (k = 0; k < keyCount; k++) {
+			if ((catalogNumber(&keys[k * SEED_CATALOG_KEY_SIZE], 2) & predicate->clauses[i].category)
+				&& (predicate->clauses[i].kind == -1 || keys[k * SEED_CATALOG_KEY_SIZE + 2] == predicate->clauses[i].kind)) {
+				
+				first = catalogNumber(&keys[k * SEED_CATALOG_KEY_SIZE + 4], 4);
+				count = catalogNumber(&keys[k * SEED_CATALOG_KEY_SIZE + 8], 4);
+				for (p = first; p < first + count && p < info.recordCount; p++) {
+					r = catalogNumber(&postings[p * 4], 4);
+					if (r >= info.recordCount) {
+						continue;
+					}
+					record = catalog + SEED_CATALOG_HEADER_SIZE + r * SEED_CATALOG_RECORD_SIZE;
+					if (recordSatisfiesClause(record, &(predicate->clauses[i]))) {
+						noteSatisfiedClause(satisfied, &info, record, i);
+					}
+				}
+			}
+		}
+	}
+	
+	for (seed = info.firstSeed; seed <= info.lastSeed; seed++) {
+		if (satisfied[seed - info.firstSeed] != allSatisfied) {
+			continue;
+		}
+		matchCount++;
+		fprintf(stream, "Seed %li:\n", seed);
+		lastRecord = catalogNumber(seedStarts + (seed - info.firstSeed + 1) * 4, 4);
+		for (r = catalogNumber(seedStarts + (seed - info.firstSeed) * 4, 4); r < lastRecord && r < info.recordCount; r++) {
+			record = catalog + SEED_CATALOG_HEADER_SIZE + r * SEED_CATALOG_RECORD_SIZE;
+			for (i = 0; i < predicate->clauseCount; i++) {
+				if (recordSatisfiesClause(record, &(predicate->clauses[i]))) {
+					catalogRecordToItem(record, &theItem, &depth, &machineNumber);
+					catalogItemName(&theItem, depth, buf);
+					fprintf(stream, "    Depth %i: %s", depth, buf);
+					if (machineNumber > 0) {
+						fprintf(stream, " (vault %i)", machineNumber);
+					}
+					fprintf(stream, "\n");
+					break;
+				}
+			}
+		}
+	}
+	free(satisfied);
+	return matchCount;
+}
+
+// Level catalogs are binary files of generated levels for offline analysis. Numbers are big-endian.
+// The header is 24 bytes: "BRLV", the 16-byte version field of a recording (including the generator
+// version in its last byte), the format version, DCOLS, DROWS and NUMBER_TERRAIN_LAYERS.
+// Each level follows as:
+//	seed (4), depth (1), up stairs x and y (1 each), down stairs x and y (1 each);
+//	for each cell, column by column: one byte per terrain layer, then the machine number (1);
+//	the item count (2), then per item: category (2), kind (1), x (1), y (1), enchant1 (1, signed),
+//	quantity (2) and flags (4);
+//	the monster count (2), then per monster: monster ID (1), x (1), y (1), creature state (1) and
+//	bookkeeping flags (4); then the dormant monsters, the same way.
+#define LEVEL_CATALOG_FORMAT_VERSION	1
+
+void writeLevelCatalogHeader(FILE *stream) {
+	unsigned char c[24];
+	short i;
+	
+	memset(c, 0, sizeof(c));
+	memcpy(c, "BRLV", 4);
+	for (i = 0; BROGUE_VERSION_STRING[i] != '\0'; i++) {
+		c[4 + i] = BROGUE_VERSION_STRING[i];
+	}
+	c[4 + 15] = newGameGeneratorVersion;
+	c[20] = LEVEL_CATALOG_FORMAT_VERSION;
+	c[21] = DCOLS;
+	c[22] = DROWS;
+	c[23] = NUMBER_TERRAIN_LAYERS;
+	fwrite(c, 1, sizeof(c), stream);
+}
+
+static void writeCatalogMonsters(creature *chain, FILE *stream) {
+	unsigned char c[8];
+	creature *monst;
+	unsigned long count = 0;
+	
+	for (monst = chain; monst != NULL; monst = monst->nextCreature) {
+		count++;
+	}
+	numberToString(count, 2, c);
+	fwrite(c, 1, 2, stream);
+	for (monst = chain; monst != NULL; monst = monst->nextCreature) {
+		c[0] = monst->info.monsterID;
+		c[1] = monst->xLoc;
+		c[2] = monst->yLoc;
+		c[3] = monst->creatureState;
+		numberToString(monst->bookkeepingFlags, 4, &c[4]);
+		fwrite(c, 1, 8, stream);
+	}
+}
+
+// Writes the current level as one level catalog record.
+static void writeLevelCatalogRecord(FILE *stream) {
+	unsigned char c[DROWS * (NUMBER_TERRAIN_LAYERS + 1)];
+	item *theItem;
+	unsigned long count;
+	short i, j, layer, n;
+	
+	numberToString(rogue.seed, 4, c);
+	c[4] = rogue.depthLevel;
+	c[5] = rogue.upLoc[0];
+	c[6] = rogue.upLoc[1];
+	c[7] = rogue.downLoc[0];
+	c[8] = rogue.downLoc[1];
+	fwrite(c, 1, 9, stream);
+	
+	for (i=0; i<DCOLS; i++) {
+		n = 0;
+		for (j=0; j<DROWS; j++) {
+			for (layer = 0; layer < NUMBER_TERRAIN_LAYERS; layer++) {
+				c[n++] = pmap[i][j].layers[layer];
+			}
+			c[n++] = pmap[i][j].machineNumber;
+		}
+		fwrite(c, 1, n, stream);
+	}
+	
+	count = 0;
+	for (theItem = floorItems->nextItem; theItem != NULL; theItem = theItem->nextItem) {
+		count++;
+	}
+	numberToString(count, 2, c);
+	fwrite(c, 1, 2, stream);
+	for (theItem = floorItems->nextItem; theItem != NULL; theItem = theItem->nextItem) {
+		numberToString(theItem->category, 2, c);
+		c[2] = theItem->kind;
+		c[3] = theItem->xLoc;
+		c[4] = theItem->yLoc;
+		c[5] = (unsigned char) theItem->enchant1;
+		numberToString(theItem->quantity, 2, &c[6]);
+		numberToString(theItem->flags, 4, &c[8]);
+		fwrite(c, 1, 12, stream);
+	}
+	
+	writeCatalogMonsters(monsters->nextCreature, stream);
+	writeCatalogMonsters(dormantMonsters->nextCreature, stream);
+}
+
+// Generates depths 1 through lastDepth of every seed from firstSeed to lastSeed, just as a new game would,
+// and writes depths firstDepth through lastDepth to stream as level catalog records.
+// The throwaway recording of each game goes to scratchPath. Returns the number of levels written.
+unsigned long generateLevelCatalog(unsigned long firstSeed, unsigned long lastSeed,
+								   short firstDepth, short lastDepth,
+								   char *scratchPath, FILE *stream) {
+	unsigned long theSeed, levelCount = 0;
+	
+	rogue.nextGame = NG_NOTHING;
+	for (theSeed = firstSeed; theSeed <= lastSeed; theSeed++) {
+		rogue.nextGamePath[0] = '\0';
+		randomNumbersGenerated = 0;
+		
+		rogue.playbackMode = false;
+		rogue.playbackFastForward = false;
+		rogue.playbackBetweenTurns = false;
+		
+		strcpy(currentFilePath, scratchPath);
+		initializeRogue(theSeed);
+		for (rogue.depthLevel = 1; rogue.depthLevel <= lastDepth; rogue.depthLevel++) {
+			startLevel(rogue.depthLevel == 1 ? 1 : rogue.depthLevel - 1, 1); // descending into level n
+			if (rogue.depthLevel >= firstDepth) {
+				writeLevelCatalogRecord(stream);
+				levelCount++;
+			}
+		}
+		freeEverything();
+		remove(currentFilePath); // Don't leave the recording lying around.
+	}
+	return levelCount;
+}
+
 // This is the basic program loop.
 // When the program launches, or when a game ends, you end up here.
 // If the player has already said what he wants to do next
@@ -765,6 +1501,7 @@ void mainBrogueJunction() {
 					}
 					
 					while(!rogue.gameHasEnded && rogue.playbackMode) {
+						notePlaybackKeyframe();
 						rogue.RNG = RNG_COSMETIC; // dancing terrain colors can't influence recordings
 						rogue.playbackBetweenTurns = true;
 						nextBrogueEvent(&theEvent, false, true, false);
@@ -773,6 +1510,7 @@ void mainBrogueJunction() {
 						executeEvent(&theEvent);
 					}
 					
+					freePlaybackKeyframes();
 					freeEverything();
 				} else {
 					// announce file not found
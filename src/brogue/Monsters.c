@@ -340,40 +340,77 @@ void resolvePronounEscapes(char *text, creature *monst) {
 }
 
 // Pass 0 for summonerType for an ordinary selection.
-short pickHordeType(short depth, enum monsterTypes summonerType, unsigned long forbiddenFlags, unsigned long requiredFlags) {
-	short i, index, possCount = 0;
+#define HORDE_TABLE_CACHE_SIZE	32
+
+// The hordes that qualify for one combination of pickHordeType() arguments, with the running total of
+// their frequencies. The horde catalog never changes, so a table is good for the rest of the session.
+struct hordeFrequencyTable {
+	short depth;
+	enum monsterTypes summonerType;
+	unsigned long forbiddenFlags;
+	unsigned long requiredFlags;
+	short hordeCount;
+	short hordeID[NUMBER_HORDES];
+	short cumulativeFrequency[NUMBER_HORDES];
+};
+
+static struct hordeFrequencyTable hordeTableCache[HORDE_TABLE_CACHE_SIZE];
+static short hordeTablesCached = 0, nextHordeTableSlot = 0;
+
+static struct hordeFrequencyTable *hordeFrequencyTable(short depth, enum monsterTypes summonerType,
+                                                       unsigned long forbiddenFlags, unsigned long requiredFlags) {
+	struct hordeFrequencyTable *table;
+	short i, possCount = 0;
 	
-	if (depth <= 0) {
-		depth = rogue.depthLevel;
+	for (i=0; i<hordeTablesCached; i++) {
+		table = &hordeTableCache[i];
+		if (table->depth == depth
+			&& table->summonerType == summonerType
+			&& table->forbiddenFlags == forbiddenFlags
+			&& table->requiredFlags == requiredFlags) {
+			
+			return table;
+		}
 	}
 	
+	// Not seen yet; build it over the oldest table.
+	table = &hordeTableCache[nextHordeTableSlot];
+	nextHordeTableSlot = (nextHordeTableSlot + 1) % HORDE_TABLE_CACHE_SIZE;
+	hordeTablesCached = min(hordeTablesCached + 1, HORDE_TABLE_CACHE_SIZE);
+	
+	table->depth = depth;
+	table->summonerType = summonerType;
+	table->forbiddenFlags = forbiddenFlags;
+	table->requiredFlags = requiredFlags;
+	table->hordeCount = 0;
 	for (i=0; i<NUMBER_HORDES; i++) {
 		if (!(hordeCatalog[i].flags & forbiddenFlags)
 			&& !(~(hordeCatalog[i].flags) & requiredFlags)
 			&& ((!summonerType && hordeCatalog[i].minLevel <= depth && hordeCatalog[i].maxLevel >= depth)
 				|| (summonerType && (hordeCatalog[i].flags & HORDE_IS_SUMMONED) && hordeCatalog[i].leaderType == summonerType))) {
 				possCount += hordeCatalog[i].frequency;
+				table->hordeID[table->hordeCount] = i;
+				table->cumulativeFrequency[table->hordeCount] = possCount;
+				table->hordeCount++;
 			}
 	}
+	return table;
+}
+
+short pickHordeType(short depth, enum monsterTypes summonerType, unsigned long forbiddenFlags, unsigned long requiredFlags) {
+	struct hordeFrequencyTable *table;
 	
-	if (possCount == 0) {
-		return -1;
+	if (depth <= 0) {
+		depth = rogue.depthLevel;
 	}
 	
-	index = rand_range(1, possCount);
+	table = hordeFrequencyTable(depth, summonerType, forbiddenFlags, requiredFlags);
 	
-	for (i=0; i<NUMBER_HORDES; i++) {
-		if (!(hordeCatalog[i].flags & forbiddenFlags)
-			&& !(~(hordeCatalog[i].flags) & requiredFlags)
-			&& ((!summonerType && hordeCatalog[i].minLevel <= depth && hordeCatalog[i].maxLevel >= depth)
-				|| (summonerType && (hordeCatalog[i].flags & HORDE_IS_SUMMONED) && hordeCatalog[i].leaderType == summonerType))) {
-				if (index <= hordeCatalog[i].frequency) {
-					return i;
-				}
-				index -= hordeCatalog[i].frequency;
-			}
+	if (table->hordeCount == 0 || table->cumulativeFrequency[table->hordeCount - 1] == 0) {
+		return -1;
 	}
-	return 0; // should never happen
+	
+	return table->hordeID[pickCumulativeFrequency(table->cumulativeFrequency, table->hordeCount)];
 }
 
 // If placeClone is false, the clone won't get a location
@@ -562,6 +599,7 @@ boolean drawManacle(short x, short y, enum directions dir) {
 		&& pmap[newX][newY].layers[DUNGEON] == FLOOR
 		&& pmap[newX][newY].layers[LIQUID] == NOTHING) {
 		
+		noteTerrainChange(pmap[x + nbDirs[dir][0]][y + nbDirs[dir][1]].layers[SURFACE], manacles[dir]);
 		pmap[x + nbDirs[dir][0]][y + nbDirs[dir][1]].layers[SURFACE] = manacles[dir];
 		return true;
 	}
@@ -1294,6 +1332,31 @@ void wakeUp(creature *monst) {
 	}
 }
 
+// A monster's turn asks whether it has an open path to the same creatures more than once: updateMonsterState()
+// for the enemies it keeps its distance from (and awarenessDistance() for any creature but the player), and
+// monstUseMagic() once for every kind of spell that it knows. Nothing moves from the start of
+// updateMonsterState() until the monster acts, as a move or spell that fails changes nothing and the turn ends
+// as soon as one succeeds, so each answer is remembered until updateMonsterState() starts again. Paths aren't
+// symmetric, so an answer is kept for its pair of cells and not reused for the reverse.
+static unsigned long monsterPathEpoch = 0;
+static struct monsterPathAnswer {
+	unsigned long epoch;
+	short fromX, fromY;
+	boolean open;
+} monsterPathAnswers[DCOLS][DROWS];
+
+static boolean monsterHasOpenPathTo(creature *monst, creature *target) {
+	struct monsterPathAnswer *answer = &monsterPathAnswers[target->xLoc][target->yLoc];
+	
+	if (answer->epoch != monsterPathEpoch || answer->fromX != monst->xLoc || answer->fromY != monst->yLoc) {
+		answer->epoch = monsterPathEpoch;
+		answer->fromX = monst->xLoc;
+		answer->fromY = monst->yLoc;
+		answer->open = openPathBetween(monst->xLoc, monst->yLoc, target->xLoc, target->yLoc);
+	}
+	return answer->open;
+}
+
 // Assumes that observer is not the player.
 short awarenessDistance(creature *observer, creature *target) {
 	long perceivedDistance, bonus = 0;
@@ -1303,7 +1366,7 @@ short awarenessDistance(creature *observer, creature *target) {
 	if ((observer->status[STATUS_LEVITATING] || (observer->info.flags & MONST_RESTRICTED_TO_LIQUID) || (observer->bookkeepingFlags & MONST_SUBMERGED)
 		 || ((observer->info.flags & MONST_IMMUNE_TO_WEBS) && (observer->info.abilityFlags & MA_SHOOTS_WEBS)))
 		&& ((target == &player && (pmap[observer->xLoc][observer->yLoc].flags & IN_FIELD_OF_VIEW)) ||
-			(target != &player && openPathBetween(observer->xLoc, observer->yLoc, target->xLoc, target->yLoc)))) {
+			(target != &player && monsterHasOpenPathTo(observer, target)))) {
 			// if monster flies or is waterbound or is underwater or can cross pits with webs:
 			perceivedDistance = distanceBetween(observer->xLoc, observer->yLoc, target->xLoc, target->yLoc) * 3;
 		} else {
@@ -1391,6 +1454,8 @@ void updateMonsterState(creature *monst) {
 	//char buf[DCOLS*3], monstName[DCOLS];
     creature *monst2;
 	
+	monsterPathEpoch++; // the monster's turn starts here, so the paths remembered from before may have closed
+	
 	if ((monst->info.flags & MONST_ALWAYS_HUNTING)
         && monst->creatureState != MONSTER_ALLY) {
         
@@ -1436,7 +1501,7 @@ void updateMonsterState(creature *monst) {
             if (monstersAreEnemies(monst, monst2)
                 && distanceBetween(x, y, monst2->xLoc, monst2->yLoc) < shortestDistanceToEnemy
                 && traversiblePathBetween(monst2, x, y)
-                && openPathBetween(x, y, monst2->xLoc, monst2->yLoc)) {
+                && monsterHasOpenPathTo(monst, monst2)) {
                 
                 shortestDistanceToEnemy = distanceBetween(x, y, monst2->xLoc, monst2->yLoc);
             }
@@ -1587,6 +1652,7 @@ void decrementMonsterStatus(creature *monst) {
                 if (monst->status[i]) {
                     if (!--monst->status[i]) {
                         if (tileCatalog[pmap[monst->xLoc][monst->yLoc].layers[SURFACE]].flags & T_ENTANGLES) {
+                            noteTerrainChange(pmap[monst->xLoc][monst->yLoc].layers[SURFACE], NOTHING);
                             pmap[monst->xLoc][monst->yLoc].layers[SURFACE] = NOTHING;
                         }
                     }
@@ -2000,7 +2066,7 @@ boolean monsterBlinkToSafety(creature *monst) {
 	short **blinkSafetyMap;
 	
 	if (monst->creatureState == MONSTER_ALLY) {
-		if (!rogue.updatedAllySafetyMapThisTurn) {
+		if (!rogue.derivedMaps[DM_ALLY_SAFETY].updatedThisTurn) {
 			updateAllySafetyMap();
 		}
 		blinkSafetyMap = allySafetyMap;
@@ -2009,13 +2075,13 @@ boolean monsterBlinkToSafety(creature *monst) {
 			freeGrid(monst->safetyMap);
 			monst->safetyMap = NULL;
 		}
-		if (!rogue.updatedSafetyMapThisTurn) {
+		if (!rogue.derivedMaps[DM_SAFETY].updatedThisTurn) {
 			updateSafetyMap();
 		}
 		blinkSafetyMap = safetyMap;
 	} else {
 		if (!monst->safetyMap) {
-			if (!rogue.updatedSafetyMapThisTurn) {
+			if (!rogue.derivedMaps[DM_SAFETY].updatedThisTurn) {
 				updateSafetyMap();
 			}
 			monst->safetyMap = allocGrid();
@@ -2090,7 +2156,7 @@ boolean monstUseMagic(creature *monst) {
 				&& !((monst->bookkeepingFlags | target->bookkeepingFlags) & MONST_SUBMERGED) // neither is submerged
 				&& !target->status[STATUS_INVISIBLE]
                 && (monst->creatureState != MONSTER_ALLY || !(target->info.flags & MONST_REFLECT_4))
-				&& openPathBetween(monst->xLoc, monst->yLoc, target->xLoc, target->yLoc)) {
+				&& monsterHasOpenPathTo(monst, target)) {
                 
 				targetLoc[0] = target->xLoc;
 				targetLoc[1] = target->yLoc;
@@ -2229,7 +2295,7 @@ boolean monstUseMagic(creature *monst) {
 				&& !(target->bookkeepingFlags & MONST_SUBMERGED)
 				&& !(target->info.flags & MONST_DIES_IF_NEGATED)
                 && (monst->creatureState != MONSTER_ALLY || !(target->info.flags & MONST_REFLECT_4))
-				&& openPathBetween(monst->xLoc, monst->yLoc, target->xLoc, target->yLoc)) {
+				&& monsterHasOpenPathTo(monst, target)) {
 				
 				if (canDirectlySeeMonster(monst)) {
 					monsterName(monstName, monst, true);
@@ -2274,7 +2340,7 @@ boolean monstUseMagic(creature *monst) {
 				&& !monstersAreEnemies(monst, target)
 				&& !(target->bookkeepingFlags & MONST_SUBMERGED)
 				&& !(target->info.flags & MONST_INANIMATE)
-				&& openPathBetween(monst->xLoc, monst->yLoc, target->xLoc, target->yLoc)) {
+				&& monsterHasOpenPathTo(monst, target)) {
 				
 				if (canDirectlySeeMonster(monst)) {
 					monsterName(monstName, monst, true);
@@ -2320,7 +2386,7 @@ boolean monstUseMagic(creature *monst) {
 				&& !monstersAreEnemies(monst, target)
 				&& !(target->bookkeepingFlags & MONST_SUBMERGED)
 				&& !(target->info.flags & MONST_INANIMATE)
-				&& openPathBetween(monst->xLoc, monst->yLoc, target->xLoc, target->yLoc)) {
+				&& monsterHasOpenPathTo(monst, target)) {
 				
 				if (canDirectlySeeMonster(monst)) {
 					monsterName(monstName, monst, true);
@@ -2349,7 +2415,7 @@ boolean monstUseMagic(creature *monst) {
 				&& (100 * target->currentHP / target->info.maxHP < weakestAllyHealthFraction)
 				&& monstersAreTeammates(monst, target)
 				&& !monstersAreEnemies(monst, target)
-				&& openPathBetween(monst->xLoc, monst->yLoc, target->xLoc, target->yLoc)) {
+				&& monsterHasOpenPathTo(monst, target)) {
 				weakestAllyHealthFraction = 100 * target->currentHP / target->info.maxHP;
 				weakestAlly = target;
 			}
@@ -2380,7 +2446,7 @@ boolean monstUseMagic(creature *monst) {
 				&& !target->status[STATUS_INVISIBLE]
                 && !target->status[STATUS_ENTRANCED]
                 && (monst->creatureState != MONSTER_ALLY || !(target->info.flags & MONST_REFLECT_4))
-				&& openPathBetween(monst->xLoc, monst->yLoc, target->xLoc, target->yLoc)) {
+				&& monsterHasOpenPathTo(monst, target)) {
                 
                 targetLoc[0] = target->xLoc;
                 targetLoc[1] = target->yLoc;
@@ -2547,10 +2613,61 @@ boolean allyFlees(creature *ally, creature *closestEnemy) {
     return false;
 }
 
+// Scans allyEnemyMap toward those of the ally's enemies that are closer than shortestDistance and
+// blinks along it. The map and its costs live for the whole game, so no grids are allocated here.
+// The costs are only laid out once an enemy qualifies: with no enemy to scan from, every open cell
+// would be left at the same value and there would be nowhere better to blink to.
+static boolean allyBlinksTowardEnemies(creature *monst, short shortestDistance) {
+	creature *target;
+	short i, j;
+	const short x = monst->xLoc;
+	const short y = monst->yLoc;
+	boolean foundEnemy = false;
+	
+	for (target = monsters->nextCreature; target != NULL; target = target->nextCreature) {
+		if (target != monst
+			&& (!(target->bookkeepingFlags & MONST_SUBMERGED) || (monst->bookkeepingFlags & MONST_SUBMERGED))
+			&& monstersAreEnemies(target, monst)
+			&& !(target->bookkeepingFlags & MONST_CAPTIVE)
+			&& distanceBetween(x, y, target->xLoc, target->yLoc) < shortestDistance
+			&& traversiblePathBetween(monst, target->xLoc, target->yLoc)
+			&& (!monsterAvoids(monst, target->xLoc, target->yLoc) || (target->info.flags & MONST_ATTACKABLE_THRU_WALLS))
+			&& (!target->status[STATUS_INVISIBLE] || ((monst->info.flags & MONST_ALWAYS_USE_ABILITY) || rand_percent(33)))) {
+			
+			if (!foundEnemy) {
+				for (i=0; i<DCOLS; i++) {
+					for (j=0; j<DROWS; j++) {
+						if (cellHasTerrainFlag(i, j, T_OBSTRUCTS_PASSABILITY)) {
+							allyEnemyCostMap[i][j] = cellHasTerrainFlag(i, j, T_OBSTRUCTS_DIAGONAL_MOVEMENT) ? PDS_OBSTRUCTION : PDS_FORBIDDEN;
+							allyEnemyMap[i][j] = 0; // safeguard against OOS
+						} else if (monsterAvoids(monst, i, j)) {
+							allyEnemyCostMap[i][j] = PDS_FORBIDDEN;
+							allyEnemyMap[i][j] = 0; // safeguard against OOS
+						} else {
+							allyEnemyCostMap[i][j] = 1;
+							allyEnemyMap[i][j] = 10000;
+						}
+					}
+				}
+				foundEnemy = true;
+			}
+			allyEnemyMap[target->xLoc][target->yLoc] = 0;
+			allyEnemyCostMap[target->xLoc][target->yLoc] = 1;
+		}
+	}
+	
+	if (!foundEnemy) {
+		rogue.allyEnemyScansSkipped++;
+		return false;
+	}
+	rogue.allyEnemyScans++;
+	dijkstraScan(allyEnemyMap, allyEnemyCostMap, true);
+	return monsterBlinkToPreferenceMap(monst, allyEnemyMap, false);
+}
+
 void moveAlly(creature *monst) {
 	creature *target, *closestMonster = NULL;
-	short i, j, x, y, dir, shortestDistance, targetLoc[2], leashLength;
-	short **enemyMap, **costMap;
+	short x, y, dir, shortestDistance, targetLoc[2], leashLength;
 	char buf[DCOLS], monstName[DCOLS];
 	
 	x = monst->xLoc;
@@ -2563,7 +2680,7 @@ void moveAlly(creature *monst) {
 		|| (cellHasTerrainFlag(x, y, T_IS_FIRE) && !monst->status[STATUS_IMMUNE_TO_FIRE])
 		|| (cellHasTerrainFlag(x, y, T_CAUSES_DAMAGE | T_CAUSES_PARALYSIS | T_CAUSES_CONFUSION) && !(monst->info.flags & MONST_INANIMATE))) {
         
-		if (!rogue.updatedMapToSafeTerrainThisTurn) {
+		if (!rogue.derivedMaps[DM_SAFE_TERRAIN].updatedThisTurn) {
 			updateSafeTerrainMap();
 		}
 		
@@ -2610,7 +2727,7 @@ void moveAlly(creature *monst) {
 			&& monsterBlinkToSafety(monst)) {
 			return;
 		}
-		if (!rogue.updatedAllySafetyMapThisTurn) {
+		if (!rogue.derivedMaps[DM_ALLY_SAFETY].updatedThisTurn) {
 			updateAllySafetyMap();
 		}
 		dir = nextStep(allySafetyMap, monst->xLoc, monst->yLoc, monst, true);
@@ -2649,48 +2766,10 @@ void moveAlly(creature *monst) {
 		if ((monst->info.abilityFlags & MA_CAST_BLINK)
 			&& ((monst->info.flags & MONST_ALWAYS_USE_ABILITY) || rand_percent(30))) {
 			
-			enemyMap = allocGrid();
-			costMap = allocGrid();
-			
-			for (i=0; i<DCOLS; i++) {
-				for (j=0; j<DROWS; j++) {
-					if (cellHasTerrainFlag(i, j, T_OBSTRUCTS_PASSABILITY)) {
-						costMap[i][j] = cellHasTerrainFlag(i, j, T_OBSTRUCTS_DIAGONAL_MOVEMENT) ? PDS_OBSTRUCTION : PDS_FORBIDDEN;
-						enemyMap[i][j] = 0; // safeguard against OOS
-					} else if (monsterAvoids(monst, i, j)) {
-						costMap[i][j] = PDS_FORBIDDEN;
-						enemyMap[i][j] = 0; // safeguard against OOS
-					} else {
-						costMap[i][j] = 1;
-						enemyMap[i][j] = 10000;
-					}
-				}
-			}
-			
-			for (target = monsters->nextCreature; target != NULL; target = target->nextCreature) {
-				if (target != monst
-					&& (!(target->bookkeepingFlags & MONST_SUBMERGED) || (monst->bookkeepingFlags & MONST_SUBMERGED))
-					&& monstersAreEnemies(target, monst)
-					&& !(target->bookkeepingFlags & MONST_CAPTIVE)
-					&& distanceBetween(x, y, target->xLoc, target->yLoc) < shortestDistance
-					&& traversiblePathBetween(monst, target->xLoc, target->yLoc)
-					&& (!monsterAvoids(monst, target->xLoc, target->yLoc) || (target->info.flags & MONST_ATTACKABLE_THRU_WALLS))
-					&& (!target->status[STATUS_INVISIBLE] || ((monst->info.flags & MONST_ALWAYS_USE_ABILITY) || rand_percent(33)))) {
-					
-					enemyMap[target->xLoc][target->yLoc] = 0;
-					costMap[target->xLoc][target->yLoc] = 1;
-				}
-			}
-			
-			dijkstraScan(enemyMap, costMap, true);
-			freeGrid(costMap);
-			
-			if (monsterBlinkToPreferenceMap(monst, enemyMap, false)) { // if he actually cast a spell
+			if (allyBlinksTowardEnemies(monst, shortestDistance)) { // if he actually cast a spell
 				monst->ticksUntilTurn = monst->attackSpeed * (monst->info.flags & MONST_CAST_SPELLS_SLOWLY ? 2 : 1);
-				freeGrid(enemyMap);
 				return;
 			}
-			freeGrid(enemyMap);
 		}
 		
 		targetLoc[0] = closestMonster->xLoc;
@@ -2960,7 +3039,7 @@ void monstersTurn(creature *monst) {
 				freeGrid(monst->safetyMap);
 				monst->safetyMap = NULL;
 			}
-			if (!rogue.updatedSafetyMapThisTurn) {
+			if (!rogue.derivedMaps[DM_SAFETY].updatedThisTurn) {
 				updateSafetyMap();
 			}
 			dir = nextStep(safetyMap, monst->xLoc, monst->yLoc, NULL, true);
@@ -2995,7 +3074,7 @@ void monstersTurn(creature *monst) {
 		// if we're standing in harmful terrain and there is a way to escape it, spend this turn escaping it.
 		if (cellHasTerrainFlag(x, y, (T_HARMFUL_TERRAIN & ~T_IS_FIRE))
 			|| (cellHasTerrainFlag(x, y, T_IS_FIRE) && !monst->status[STATUS_IMMUNE_TO_FIRE])) {
-			if (!rogue.updatedMapToSafeTerrainThisTurn) {
+			if (!rogue.derivedMaps[DM_SAFE_TERRAIN].updatedThisTurn) {
 				updateSafeTerrainMap();
 			}
 			
@@ -3204,6 +3283,7 @@ boolean moveMonster(creature *monst, short dx, short dy) {
 			monst->ticksUntilTurn = monst->movementSpeed;
 			return true;
 		} else if (tileCatalog[pmap[x][y].layers[SURFACE]].flags & T_ENTANGLES) {
+			noteTerrainChange(pmap[x][y].layers[SURFACE], NOTHING);
 			pmap[x][y].layers[SURFACE] = NOTHING;
 		}
 	}
@@ -1183,6 +1183,7 @@ boolean playerMoves(short direction) {
                 return true;
             }
             if (tileCatalog[pmap[x][y].layers[SURFACE]].flags & T_ENTANGLES) {
+                noteTerrainChange(pmap[x][y].layers[SURFACE], NOTHING);
                 pmap[x][y].layers[SURFACE] = NOTHING;
             }
         }
@@ -2563,6 +2564,7 @@ void promoteTile(short x, short y, enum dungeonLayers layer, boolean useFireDF)
 		if (tileCatalog[pmap[x][y].layers[layer]].flags & T_PATHING_BLOCKER) {
 			rogue.staleLoopMap = true;
 		}
+		noteTerrainChange(pmap[x][y].layers[layer], (layer == DUNGEON ? FLOOR : NOTHING));
 		pmap[x][y].layers[layer] = (layer == DUNGEON ? FLOOR : NOTHING); // even the dungeon layer implicitly has floor underneath it
 		if (layer == GAS) {
 			pmap[x][y].volume = 0;
@@ -2701,8 +2703,10 @@ void updateVolumetricMedia() {
 					if (pmap[i][j].layers[GAS] != NOTHING) {
 						newGasVolume[i][j] = min(3, newGasVolume[i][j]); // otherwise interactions between gases are crazy
 					}
+					noteTerrainChange(pmap[i][j].layers[GAS], gasType);
 					pmap[i][j].layers[GAS] = gasType;
 				} else if (pmap[i][j].layers[GAS] && newGasVolume[i][j] < 1) {
+					noteTerrainChange(pmap[i][j].layers[GAS], NOTHING);
 					pmap[i][j].layers[GAS] = NOTHING;
 					refreshDungeonCell(i, j);
 				}
@@ -2734,12 +2738,14 @@ void updateVolumetricMedia() {
 							
 							newGasVolume[newX][newY] += (pmap[i][j].volume / numSpaces);
 							if (pmap[i][j].volume / numSpaces) {
+								noteTerrainChange(pmap[newX][newY].layers[GAS], pmap[i][j].layers[GAS]);
 								pmap[newX][newY].layers[GAS] = pmap[i][j].layers[GAS];
 							}
 						}
 					}
 				}
 				newGasVolume[i][j] = 0;
+				noteTerrainChange(pmap[i][j].layers[GAS], NOTHING);
 				pmap[i][j].layers[GAS] = NOTHING;
 			}
 		}
@@ -2901,11 +2907,140 @@ void updateEnvironment() {
     updateFloorItems();
 }
 
+// Whether the given derived map treats the creature's cell differently from an empty cell.
+static boolean derivedMapNoticesOccupant(enum derivedMapTypes theMap, creature *monst) {
+	switch (theMap) {
+		case DM_SAFETY:
+			return ((monst->creatureState == MONSTER_SLEEPING
+					 || monst->turnsSpentStationary > 2
+					 || monst->creatureState == MONSTER_ALLY)
+					&& monst->creatureState != MONSTER_FLEEING);
+		case DM_ALLY_SAFETY:
+			return monstersAreEnemies(&player, monst);
+		case DM_SAFE_TERRAIN:
+			return (monst->turnsSpentStationary > 1);
+		default:
+			return false;
+	}
+}
+
+// Fills in everything the given derived map depends on, as of right now.
+static void derivedMapInputs(enum derivedMapTypes theMap, derivedMapState *inputs) {
+	creature *monst;
+	unsigned long occupantFlags;
+	
+	inputs->depthLevel = rogue.depthLevel;
+	inputs->terrainEpoch = (theMap == DM_SHORE ? rogue.deepTerrainEpoch : rogue.terrainEpoch);
+	inputs->playerLoc[0] = inputs->playerLoc[1] = -1;
+	inputs->playerStatus = 0;
+	zeroOutGrid(inputs->occupancy);
+	
+	if (theMap == DM_SHORE) {
+		return; // depends only on terrain
+	}
+	if (theMap != DM_SAFE_TERRAIN) {
+		inputs->playerLoc[0] = player.xLoc;
+		inputs->playerLoc[1] = player.yLoc;
+	}
+	if (theMap == DM_SAFETY) {
+		inputs->playerStatus = (player.status[STATUS_LEVITATING] ? 1 : 0) | (player.status[STATUS_IMMUNE_TO_FIRE] ? 2 : 0);
+	}
+	
+	// Mirror monsterAtLoc(): the player takes precedence, then the first monster in the chain.
+	// 1 marks a cell whose occupant the map ignores, 2 one that it notices.
+	occupantFlags = (theMap == DM_SAFE_TERRAIN ? (HAS_MONSTER | HAS_PLAYER) : HAS_MONSTER);
+	if (pmap[player.xLoc][player.yLoc].flags & occupantFlags) {
+		inputs->occupancy[player.xLoc][player.yLoc] = (derivedMapNoticesOccupant(theMap, &player) ? 2 : 1);
+	}
+	for (monst = monsters->nextCreature; monst != NULL; monst = monst->nextCreature) {
+		if (!inputs->occupancy[monst->xLoc][monst->yLoc]
+			&& (pmap[monst->xLoc][monst->yLoc].flags & occupantFlags)) {
+			
+			inputs->occupancy[monst->xLoc][monst->yLoc] = (derivedMapNoticesOccupant(theMap, monst) ? 2 : 1);
+		}
+	}
+	// An ignored occupant is as good as none, so moving it around shouldn't invalidate the map.
+	for (monst = monsters->nextCreature; monst != NULL; monst = monst->nextCreature) {
+		if (inputs->occupancy[monst->xLoc][monst->yLoc] == 1) {
+			inputs->occupancy[monst->xLoc][monst->yLoc] = 0;
+		}
+	}
+	if (inputs->occupancy[player.xLoc][player.yLoc] == 1) {
+		inputs->occupancy[player.xLoc][player.yLoc] = 0;
+	}
+}
+
+// Call this before replacing oldTile with newTile anywhere on the map during play. Bumps the terrain
+// epoch, and thereby invalidates the derived maps, only if the change is one that they could notice.
+void noteTerrainChange(enum tileType oldTile, enum tileType newTile) {
+	if (oldTile != newTile
+		&& ((tileCatalog[oldTile].flags ^ tileCatalog[newTile].flags) & T_DERIVED_MAP_INPUTS
+			|| (tileCatalog[oldTile].mechFlags | tileCatalog[newTile].mechFlags) & TM_IS_SECRET
+			|| oldTile == DOOR || newTile == DOOR)) {
+		
+		rogue.terrainEpoch++;
+	}
+}
+
+// Called at the top of each derived map's update function. Returns true if nothing that the map
+// depends on has changed since it was last calculated, in which case the map can be left as is.
+// Otherwise records the new inputs and returns false so that the caller recalculates the map.
+boolean derivedMapIsCurrent(enum derivedMapTypes theMap) {
+	derivedMapState *state = &(rogue.derivedMaps[theMap]);
+	derivedMapState current;
+	
+	derivedMapInputs(theMap, &current);
+	
+	if (state->valid
+		&& state->terrainEpoch == current.terrainEpoch
+		&& state->depthLevel == current.depthLevel
+		&& state->playerLoc[0] == current.playerLoc[0]
+		&& state->playerLoc[1] == current.playerLoc[1]
+		&& state->playerStatus == current.playerStatus
+		&& !memcmp(state->occupancy, current.occupancy, sizeof(current.occupancy))) {
+		
+		state->hits++;
+		return true;
+	}
+	
+	state->valid = true;
+	state->terrainEpoch = current.terrainEpoch;
+	state->depthLevel = current.depthLevel;
+	state->playerLoc[0] = current.playerLoc[0];
+	state->playerLoc[1] = current.playerLoc[1];
+	state->playerStatus = current.playerStatus;
+	memcpy(state->occupancy, current.occupancy, sizeof(current.occupancy));
+	state->recalculations++;
+	return false;
+}
+
+// Forgets everything about the derived maps, e.g. at the start of a new game.
+void resetDerivedMaps() {
+	enum derivedMapTypes theMap;
+	
+	DEBUG {
+		for (theMap = 0; theMap < NUMBER_DERIVED_MAPS; theMap++) {
+			printf("\nDerived map %i: %lu hits, %lu recalculations.",
+				   theMap, rogue.derivedMaps[theMap].hits, rogue.derivedMaps[theMap].recalculations);
+		}
+		printf("\nAlly enemy map: %lu scans, %lu skipped, over %lu turns.",
+			   rogue.allyEnemyScans, rogue.allyEnemyScansSkipped, rogue.absoluteTurnNumber);
+	}
+	memset(rogue.derivedMaps, 0, sizeof(rogue.derivedMaps));
+	rogue.allyEnemyScans = rogue.allyEnemyScansSkipped = 0;
+	rogue.terrainEpoch = 0;
+	rogue.deepTerrainEpoch = 0;
+}
+
 void updateAllySafetyMap() {
 	short i, j;
 	short **playerCostMap, **monsterCostMap;
 	
-	rogue.updatedAllySafetyMapThisTurn = true;
+	rogue.derivedMaps[DM_ALLY_SAFETY].updatedThisTurn = true;
+	
+	if (derivedMapIsCurrent(DM_ALLY_SAFETY)) {
+		return;
+	}
 	
 	playerCostMap = allocGrid();
 	monsterCostMap = allocGrid();
@@ -2965,7 +3100,11 @@ void updateSafetyMap() {
 	short **playerCostMap, **monsterCostMap;
 	creature *monst;
 	
-	rogue.updatedSafetyMapThisTurn = true;
+	rogue.derivedMaps[DM_SAFETY].updatedThisTurn = true;
+	
+	if (derivedMapIsCurrent(DM_SAFETY)) {
+		return;
+	}
 	
 	playerCostMap = allocGrid();
 	monsterCostMap = allocGrid();
@@ -3077,7 +3216,12 @@ void updateSafeTerrainMap() {
 	creature *monst;
 	item *theItem;
 	
-	rogue.updatedMapToSafeTerrainThisTurn = true;
+	rogue.derivedMaps[DM_SAFE_TERRAIN].updatedThisTurn = true;
+	
+	if (derivedMapIsCurrent(DM_SAFE_TERRAIN)) {
+		return;
+	}
+	
 	costMap = allocGrid();
 	
 	for (i=0; i<DCOLS; i++) {
@@ -3813,9 +3957,10 @@ void playerTurnEnded() {
 		}
 		
 		updateScent();
-		rogue.updatedSafetyMapThisTurn			= false;
-		rogue.updatedAllySafetyMapThisTurn		= false;
-		rogue.updatedMapToSafeTerrainThisTurn	= false;
+		rogue.derivedMaps[DM_SAFETY].updatedThisTurn			= false;
+		rogue.derivedMaps[DM_ALLY_SAFETY].updatedThisTurn		= false;
+		rogue.derivedMaps[DM_SAFE_TERRAIN].updatedThisTurn		= false;
+		rogue.derivedMaps[DM_SHORE].updatedThisTurn			= false;
 		
 		for (monst = monsters->nextCreature; monst != NULL; monst = monst->nextCreature) {
 			if (D_SAFETY_VISION || monst->creatureState == MONSTER_FLEEING && pmap[monst->xLoc][monst->yLoc].flags & IN_FIELD_OF_VIEW) {	
@@ -4024,7 +4169,7 @@ void playerTurnEnded() {
 	rogue.justRested = false;
 	updateFlavorText();
 	
-	if (!rogue.updatedMapToShoreThisTurn) {
+	if (!rogue.derivedMaps[DM_SHORE].updatedThisTurn) {
 		updateMapToShore();
 	}
 	
@@ -4106,6 +4251,7 @@ void discover(short x, short y) {
 		for (layer = 0; layer < NUMBER_TERRAIN_LAYERS; layer++) {
 			if (tileCatalog[pmap[x][y].layers[layer]].mechFlags & TM_IS_SECRET) {
 				feat = &dungeonFeatureCatalog[tileCatalog[pmap[x][y].layers[layer]].discoverType];
+				noteTerrainChange(pmap[x][y].layers[layer], (layer == DUNGEON ? FLOOR : NOTHING));
 				pmap[x][y].layers[layer] = (layer == DUNGEON ? FLOOR : NOTHING);
 				spawnDungeonFeature(x, y, feat, true, false);
 			}
@@ -70,6 +70,24 @@ short poisson(short percent) {
     return i;
 }
 
+// Picks an index into a list of frequencies, given their running totals, with one draw of
+// rand_range(1, total). Returns the same index as the usual linear scan that subtracts each
+// frequency from the draw in turn, so it can take the place of one without disturbing the RNG.
+short pickCumulativeFrequency(const short *cumulativeFrequencies, short listLength) {
+	short low = 0, high = listLength - 1, mid;
+	const short randIndex = rand_range(1, cumulativeFrequencies[listLength - 1]);
+	
+	while (low < high) {
+		mid = (low + high) / 2;
+		if (cumulativeFrequencies[mid] < randIndex) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
 void shuffleList(short *list, short listLength) {
 	short i, r, buf;
 	for (i=0; i<listLength; i++) {
@@ -186,3 +204,16 @@ unsigned long seedRandomGenerator(unsigned long seed) {
 	return seed;
 }
 
+
+// The state of all of the RNGs, for saving and restoring a game in progress.
+unsigned long randomGeneratorStateSize() {
+	return sizeof(RNGState);
+}
+
+void getRandomGeneratorState(void *state) {
+	memcpy(state, RNGState, sizeof(RNGState));
+}
+
+void setRandomGeneratorState(const void *state) {
+	memcpy(RNGState, state, sizeof(RNGState));
+}
@@ -27,6 +27,7 @@
 #include "IncludeGlobals.h"
 
 #define RECORDING_HEADER_LENGTH		32	// bytes at the start of the recording file to store global data
+#define RECORDING_FORMAT_BYTE		14	// the byte of the header's version field that notes the recording format
 
 #pragma mark Recording functions
 
@@ -159,20 +160,402 @@ void recordMouseClick(short x, short y, boolean controlKey, boolean shiftKey) {
 	recordEvent(&theEvent);
 }
 
+// Compact recordings code the events in blocks, one per flush of the input buffer, each of which decodes
+// without the others so that playback can start reading anywhere. A block is the number of event bytes
+// it holds and the number of coded bytes, both as varints, then the coded bytes. Within a block,
+// each token below codes a common run of events; anything else is copied as a literal.
+enum recordingFormats {
+	RECORDING_FORMAT_CLASSIC,	// the event bytes as they were recorded
+	RECORDING_FORMAT_COMPACT,	// coded blocks
+	NUMBER_RECORDING_FORMATS,
+};
+
+enum recordingTokens {
+	TOKEN_LITERAL,					// count (varint), then that many event bytes
+	TOKEN_TURN,						// an RNG check and a keystroke without modifiers: key, RNG value
+	TOKEN_REPEATED_TURNS,			// count (varint), then an RNG value for each turn that repeats the previous key
+	TOKEN_RNG_CHECK,				// RNG value
+	TOKEN_RNG_CHECKS,				// count (varint), then that many RNG values
+	TOKEN_KEYSTROKE,				// key
+	TOKEN_KEYSTROKE_WITH_MODIFIERS,	// key, modifiers
+	TOKEN_MOUSE,					// plus 4 * (event type - MOUSE_UP) + modifiers / 2: x, y
+};
+
+#define TURN_LENGTH					5	// bytes of an RNG check and a keystroke
+#define MAXIMUM_CODED_BLOCK_LENGTH	(2 * INPUT_RECORD_BUFFER + 16)
+
+// Where each block of a compact recording sits, in the recording and in the file.
+typedef struct recordingBlock {
+	unsigned long recordingLocation;
+	unsigned long length;
+	unsigned long fileLocation;
+	unsigned long codedLocation;	// in the file, after the block's lengths
+	unsigned long codedLength;
+} recordingBlock;
+
+// The recording is written and read through one open handle, so that bursts of events (autoexplore,
+// travel, fast-forwarded playback) don't open and close the file on every buffer.
+// It's reopened whenever currentFilePath names a different file or the direction changes,
+// and must be closed with closeRecordingFile() before the file is renamed, removed or recreated.
+static FILE *recordingFile = NULL;
+static char recordingFilePath[BROGUE_FILENAME_MAX];
+static boolean recordingFileWritable;
+static enum recordingFormats recordingFormat;
+static unsigned long recordingFileEnd;			// where the next block goes
+
+static recordingBlock *recordingBlocks = NULL;	// indexed when the file is opened
+static long recordingBlockCount = 0, recordingBlockCapacity = 0;
+static long decodedBlockNumber = -1;
+static unsigned char decodedBlock[INPUT_RECORD_BUFFER];
+
+static short putVarint(unsigned long n, unsigned char *to) {
+	short i = 0;
+	
+	while (n >= 128) {
+		to[i++] = (unsigned char) (n % 128 + 128);
+		n /= 128;
+	}
+	to[i++] = (unsigned char) n;
+	return i;
+}
+
+static boolean getVarint(const unsigned char *from, unsigned long length, unsigned long *i, unsigned long *n) {
+	short shift;
+	
+	*n = 0;
+	for (shift = 0; *i < length && shift < 32; shift += 7) {
+		*n += (unsigned long) (from[*i] & 127) << shift;
+		if (!(from[(*i)++] & 128)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static boolean readVarint(FILE *file, unsigned long *n) {
+	unsigned char c[5];
+	unsigned long i, length;
+	int ch;
+	
+	for (length = 0; length < 5 && (ch = getc(file)) != EOF; ) {
+		c[length++] = (unsigned char) ch;
+		if (!(ch & 128)) {
+			break;
+		}
+	}
+	i = 0;
+	return getVarint(c, length, &i, n);
+}
+
+static boolean isTurnAt(const unsigned char *events, unsigned long length, unsigned long i) {
+	return (i + TURN_LENGTH <= length
+			&& events[i] == RNG_CHECK
+			&& events[i + 2] == KEYSTROKE
+			&& events[i + 4] == 0);
+}
+
+static unsigned long codeLiteral(const unsigned char *events, unsigned long length, unsigned char *coded) {
+	unsigned long c = 0;
+	
+	if (length > 0) {
+		coded[c++] = TOKEN_LITERAL;
+		c += putVarint(length, &coded[c]);
+		memcpy(&coded[c], events, length);
+		c += length;
+	}
+	return c;
+}
+
+// Codes length bytes of events into coded, which must hold MAXIMUM_CODED_BLOCK_LENGTH bytes. Returns the coded length.
+static unsigned long encodeRecordingBlock(const unsigned char *events, unsigned long length, unsigned char *coded) {
+	unsigned long i = 0, literalStart = 0, n, j, c = 0;
+	short previousKey = -1;
+	
+	while (i < length) {
+		if (isTurnAt(events, length, i) && events[i + 3] == previousKey) {
+			for (n = 1; isTurnAt(events, length, i + n * TURN_LENGTH) && events[i + n * TURN_LENGTH + 3] == previousKey; n++);
+			c += codeLiteral(&events[literalStart], i - literalStart, &coded[c]);
+			coded[c++] = TOKEN_REPEATED_TURNS;
+			c += putVarint(n, &coded[c]);
+			for (j = 0; j < n; j++) {
+				coded[c++] = events[i + j * TURN_LENGTH + 1];
+			}
+			i += n * TURN_LENGTH;
+		} else if (isTurnAt(events, length, i)) {
+			c += codeLiteral(&events[literalStart], i - literalStart, &coded[c]);
+			coded[c++] = TOKEN_TURN;
+			coded[c++] = events[i + 3];
+			coded[c++] = events[i + 1];
+			previousKey = events[i + 3];
+			i += TURN_LENGTH;
+		} else if (events[i] == RNG_CHECK && i + 2 <= length) {
+			for (n = 1; i + 2 * n + 2 <= length && events[i + 2 * n] == RNG_CHECK && !isTurnAt(events, length, i + 2 * n); n++);
+			c += codeLiteral(&events[literalStart], i - literalStart, &coded[c]);
+			if (n == 1) {
+				coded[c++] = TOKEN_RNG_CHECK;
+			} else {
+				coded[c++] = TOKEN_RNG_CHECKS;
+				c += putVarint(n, &coded[c]);
+			}
+			for (j = 0; j < n; j++) {
+				coded[c++] = events[i + 2 * j + 1];
+			}
+			i += 2 * n;
+		} else if (events[i] == KEYSTROKE && i + 3 <= length) {
+			c += codeLiteral(&events[literalStart], i - literalStart, &coded[c]);
+			if (events[i + 2] == 0) {
+				coded[c++] = TOKEN_KEYSTROKE;
+				coded[c++] = events[i + 1];
+			} else {
+				coded[c++] = TOKEN_KEYSTROKE_WITH_MODIFIERS;
+				coded[c++] = events[i + 1];
+				coded[c++] = events[i + 2];
+			}
+			previousKey = events[i + 1];
+			i += 3;
+		} else if (events[i] >= MOUSE_UP && events[i] <= MOUSE_ENTERED_CELL && i + 4 <= length
+				   && !(events[i + 3] & ~(Fl(1) | Fl(2)))) {
+			c += codeLiteral(&events[literalStart], i - literalStart, &coded[c]);
+			coded[c++] = TOKEN_MOUSE + 4 * (events[i] - MOUSE_UP) + events[i + 3] / 2;
+			coded[c++] = events[i + 1];
+			coded[c++] = events[i + 2];
+			i += 4;
+		} else {
+			i++; // part of a literal
+			continue;
+		}
+		literalStart = i;
+	}
+	c += codeLiteral(&events[literalStart], i - literalStart, &coded[c]);
+	return c;
+}
+
+// Decodes a block of exactly length event bytes into events. Returns false if the block is malformed.
+static boolean decodeRecordingBlock(const unsigned char *coded, unsigned long codedLength, unsigned char *events, unsigned long length) {
+	unsigned long c = 0, i = 0, n, j;
+	unsigned char token;
+	short previousKey = -1;
+	
+	while (c < codedLength) {
+		token = coded[c++];
+		if (token == TOKEN_LITERAL) {
+			if (!getVarint(coded, codedLength, &c, &n) || c + n > codedLength || i + n > length) {
+				return false;
+			}
+			memcpy(&events[i], &coded[c], n);
+			c += n;
+			i += n;
+		} else if (token == TOKEN_TURN || token == TOKEN_REPEATED_TURNS) {
+			n = 1;
+			if (token == TOKEN_TURN) {
+				if (c >= codedLength) {
+					return false;
+				}
+				previousKey = coded[c++];
+			} else if (!getVarint(coded, codedLength, &c, &n) || previousKey < 0) {
+				return false;
+			}
+			if (c + n > codedLength || i + n * TURN_LENGTH > length) {
+				return false;
+			}
+			for (j = 0; j < n; j++) {
+				events[i++] = RNG_CHECK;
+				events[i++] = coded[c++];
+				events[i++] = KEYSTROKE;
+				events[i++] = (unsigned char) previousKey;
+				events[i++] = 0;
+			}
+		} else if (token == TOKEN_RNG_CHECK || token == TOKEN_RNG_CHECKS) {
+			n = 1;
+			if (token == TOKEN_RNG_CHECKS && !getVarint(coded, codedLength, &c, &n)) {
+				return false;
+			}
+			if (c + n > codedLength || i + 2 * n > length) {
+				return false;
+			}
+			for (j = 0; j < n; j++) {
+				events[i++] = RNG_CHECK;
+				events[i++] = coded[c++];
+			}
+		} else if (token == TOKEN_KEYSTROKE || token == TOKEN_KEYSTROKE_WITH_MODIFIERS) {
+			n = (token == TOKEN_KEYSTROKE ? 1 : 2);
+			if (c + n > codedLength || i + 3 > length) {
+				return false;
+			}
+			events[i++] = KEYSTROKE;
+			events[i++] = coded[c];
+			events[i++] = (token == TOKEN_KEYSTROKE ? 0 : coded[c + 1]);
+			previousKey = coded[c];
+			c += n;
+		} else if (token >= TOKEN_MOUSE && token < TOKEN_MOUSE + 4 * (MOUSE_ENTERED_CELL - MOUSE_UP + 1)) {
+			if (c + 2 > codedLength || i + 4 > length) {
+				return false;
+			}
+			events[i++] = MOUSE_UP + (token - TOKEN_MOUSE) / 4;
+			events[i++] = coded[c++];
+			events[i++] = coded[c++];
+			events[i++] = (token - TOKEN_MOUSE) % 4 * 2;
+		} else {
+			return false;
+		}
+	}
+	return (i == length);
+}
+
+// Returns where the events of the recording whose header has just been read from file end in the file,
+// which is where anything appended to the recording (its index, a saved game's snapshot) begins.
+// If noteBlocks, indexes the blocks of a compact recording along the way.
+static unsigned long findRecordingEnd(FILE *file, const unsigned char *header, boolean noteBlocks) {
+	unsigned long location, recordingLength, length, codedLength, fileLocation, fileLength, end;
+	short i;
+	
+	for (recordingLength = 0, i = RECORDING_HEADER_LENGTH - 4; i < RECORDING_HEADER_LENGTH; i++) {
+		recordingLength = recordingLength * 256 + header[i];
+	}
+	fseek(file, 0, SEEK_END);
+	fileLength = ftell(file);
+	if (header[RECORDING_FORMAT_BYTE] != RECORDING_FORMAT_COMPACT) {
+		return max(RECORDING_HEADER_LENGTH, min(recordingLength, fileLength)); // the events are the file's bytes
+	}
+	
+	end = RECORDING_HEADER_LENGTH;
+	fseek(file, end, SEEK_SET);
+	for (location = RECORDING_HEADER_LENGTH; location < recordingLength; location += length) {
+		fileLocation = ftell(file);
+		if (!readVarint(file, &length) || !readVarint(file, &codedLength)
+			|| length == 0 || length > INPUT_RECORD_BUFFER || codedLength > MAXIMUM_CODED_BLOCK_LENGTH
+			|| ftell(file) + codedLength > fileLength) {
+			break;
+		}
+		if (noteBlocks) {
+			if (recordingBlockCount == recordingBlockCapacity) {
+				recordingBlockCapacity = max(64, recordingBlockCapacity * 2);
+				recordingBlocks = realloc(recordingBlocks, recordingBlockCapacity * sizeof(recordingBlock));
+			}
+			recordingBlocks[recordingBlockCount].recordingLocation = location;
+			recordingBlocks[recordingBlockCount].length = length;
+			recordingBlocks[recordingBlockCount].fileLocation = fileLocation;
+			recordingBlocks[recordingBlockCount].codedLocation = ftell(file);
+			recordingBlocks[recordingBlockCount].codedLength = codedLength;
+			recordingBlockCount++;
+		}
+		fseek(file, codedLength, SEEK_CUR);
+		end = ftell(file);
+	}
+	return end;
+}
+
+// Reads the format from the header of the file just opened and, if it's compact, finds its blocks.
+static void indexRecordingBlocks() {
+	unsigned char header[RECORDING_HEADER_LENGTH];
+	
+	recordingBlockCount = 0;
+	decodedBlockNumber = -1;
+	rewind(recordingFile);
+	if (fread(header, 1, RECORDING_HEADER_LENGTH, recordingFile) != RECORDING_HEADER_LENGTH) {
+		recordingFormat = RECORDING_FORMAT_COMPACT; // a new recording
+		recordingFileEnd = RECORDING_HEADER_LENGTH;
+		return;
+	}
+	recordingFormat = header[RECORDING_FORMAT_BYTE];
+	recordingFileEnd = findRecordingEnd(recordingFile, header, true);
+}
+
+static FILE *openRecordingFile(char *path, boolean writable) {
+	if (recordingFile
+		&& (recordingFileWritable != writable || strcmp(recordingFilePath, path))) {
+		closeRecordingFile();
+	}
+	if (!recordingFile) {
+		if (writable) {
+			recordingFile = fopen(path, "r+b");
+			if (!recordingFile) {
+				recordingFile = fopen(path, "w+b");
+			}
+		} else {
+			recordingFile = fopen(path, "rb");
+		}
+		if (recordingFile) {
+			strcpy(recordingFilePath, path);
+			recordingFileWritable = writable;
+			indexRecordingBlocks();
+		}
+	}
+	return recordingFile;
+}
+
+void closeRecordingFile() {
+	if (recordingFile) {
+		fclose(recordingFile);
+		recordingFile = NULL;
+	}
+	recordingBlockCount = 0;
+	decodedBlockNumber = -1;
+}
+
+// Returns the block of the open compact recording that holds the byte at location, or recordingBlockCount if none does.
+static long recordingBlockAt(unsigned long location) {
+	long low = 0, high = recordingBlockCount - 1, middle;
+	
+	while (low <= high) {
+		middle = (low + high) / 2;
+		if (location < recordingBlocks[middle].recordingLocation) {
+			high = middle - 1;
+		} else if (location >= recordingBlocks[middle].recordingLocation + recordingBlocks[middle].length) {
+			low = middle + 1;
+		} else {
+			return middle;
+		}
+	}
+	return recordingBlockCount;
+}
+
+static boolean decodeRecordingBlockNumber(long blockNumber) {
+	unsigned char coded[MAXIMUM_CODED_BLOCK_LENGTH];
+	recordingBlock *theBlock = &recordingBlocks[blockNumber];
+	
+	if (decodedBlockNumber != blockNumber) {
+		decodedBlockNumber = -1;
+		if (fseek(recordingFile, theBlock->codedLocation, SEEK_SET)
+			|| fread(coded, 1, theBlock->codedLength, recordingFile) != theBlock->codedLength
+			|| !decodeRecordingBlock(coded, theBlock->codedLength, decodedBlock, theBlock->length)) {
+			return false;
+		}
+		decodedBlockNumber = blockNumber;
+	}
+	return true;
+}
+
+// The version string that a recording is stamped with: the game's version, plus a mark for each extension that an
+// older build couldn't read. Those builds compare the whole string, so they turn such files down instead of misreading them.
+static void recordingVersionString(char *buf, enum recordingFormats format, short generatorVersion) {
+	strcpy(buf, BROGUE_VERSION_STRING);
+	if (format == RECORDING_FORMAT_COMPACT) {
+		strcat(buf, "+c");
+	}
+	if (generatorVersion != GENERATOR_CLASSIC) {
+		sprintf(buf + strlen(buf), "+g%i", generatorVersion);
+	}
+}
+
 void writeHeaderInfo(char *path) {
 	unsigned char c[RECORDING_HEADER_LENGTH];
 	short i;
 	FILE *recordFile;
 	
+	recordFile = openRecordingFile(path, true);
+	
 	// Zero out the entire header to start.
 	for (i=0; i<RECORDING_HEADER_LENGTH; i++) {
 		c[i] = 0;
 	}
 	
 	// Note the version string to gracefully deny compatibility when necessary.
-	for (i = 0; BROGUE_VERSION_STRING[i] != '\0'; i++) {
-		c[i] = BROGUE_VERSION_STRING[i];
-	}
+	recordingVersionString((char *) c, recordingFormat, rogue.generatorVersion);
+	// The last byte of the version field is always null in classic recordings; it notes the generator version,
+	// and the one before it notes the recording format.
+	c[RECORDING_FORMAT_BYTE] = recordingFormat;
+	c[15] = rogue.generatorVersion;
 	i = 16;
 	numberToString(rogue.seed, 4, &c[i]);
 	i += 4;
@@ -183,20 +566,10 @@ void writeHeaderInfo(char *path) {
 	numberToString(lengthOfPlaybackFile, 4, &c[i]);
 	i += 4;
 	
-	if (!fileExists(path)) {
-		recordFile = fopen(path, "wb");
-		if (recordFile) {
-			fclose(recordFile);
-		}
-	}
-	
-	recordFile = fopen(path, "r+b");
-	rewind(recordFile);
-	for (i=0; i<RECORDING_HEADER_LENGTH; i++) {
-		putc(c[i], recordFile);
-	}
 	if (recordFile) {
-		fclose(recordFile);
+		fseek(recordFile, 0, SEEK_SET);
+		fwrite(c, 1, RECORDING_HEADER_LENGTH, recordFile);
+		fflush(recordFile);
 	}
 	
 	if (lengthOfPlaybackFile < RECORDING_HEADER_LENGTH) {
@@ -204,46 +577,370 @@ void writeHeaderInfo(char *path) {
 	}
 }
 
+// Appends the buffer in one block, then patches the header, so the header never counts bytes
+// that aren't in the file yet.
 void flushBufferToFile() {
-	short i;
+	unsigned char coded[MAXIMUM_CODED_BLOCK_LENGTH], blockLengths[10];
+	unsigned long codedLength;
+	short n;
 	FILE *recordFile;
 	
 	if (rogue.playbackMode) {
 		return;
 	}
 	
+	if (locationInRecordingBuffer != 0
+		&& (recordFile = openRecordingFile(currentFilePath, true))) {
+		
+		fseek(recordFile, recordingFileEnd, SEEK_SET); // over the index, if the recording was finished before
+		if (recordingFormat == RECORDING_FORMAT_COMPACT) {
+			codedLength = encodeRecordingBlock(inputRecordBuffer, locationInRecordingBuffer, coded);
+			n = putVarint(locationInRecordingBuffer, blockLengths);
+			n += putVarint(codedLength, &blockLengths[n]);
+			fwrite(blockLengths, 1, n, recordFile);
+			fwrite(coded, 1, codedLength, recordFile);
+		} else {
+			fwrite((void *) inputRecordBuffer, 1, locationInRecordingBuffer, recordFile);
+		}
+		recordingFileEnd = ftell(recordFile);
+	}
+	
 	lengthOfPlaybackFile += locationInRecordingBuffer;
+	locationInRecordingBuffer = 0;
 	writeHeaderInfo(currentFilePath);
+}
+
+#pragma mark Recording index
+
+// A finished recording is followed by a sparse index of where each depth begins and where every
+// RECORDING_INDEX_INTERVAL turns fall, so that tools can find their way around it without replaying it.
+// It's "BRIX", the number of entries, and for each the turn number and recording location (4 bytes each)
+// and the depth (1 byte). The index is gathered at each RNG check, recording and playing back alike,
+// so a saved game that's loaded and continued keeps it.
+
+#define RECORDING_INDEX_INTERVAL		100
+#define RECORDING_INDEX_ENTRY_LENGTH	9
+
+static recordingIndexEntry *recordingIndex = NULL;
+static unsigned long recordingIndexCount = 0, recordingIndexCapacity = 0;
+
+// Every digestInterval turns, the game is also digested section by section (see digestGame()), and the
+// digests follow the index: "BRDG", the interval and the number of digests (4 bytes each), and for each
+// the turn number and recording location (4 bytes each) and the section digests (8 bytes each). Playing
+// back takes the same digests at the same points and compares them, so a replay that strays from the game
+// that was recorded is caught within digestInterval turns, and in which sections, though the RNG checks
+// may not notice it for much longer.
+
+#define RECORDING_DIGEST_LENGTH			(8 + 8 * NUMBER_GAME_DIGESTS)
+
+typedef struct recordingDigest {
+	unsigned long turnNumber;
+	unsigned long recordingLocation;
+	gameDigest digests[NUMBER_GAME_DIGESTS];
+} recordingDigest;
+
+static recordingDigest *recordingDigests = NULL;	// taken in this game
+static unsigned long recordingDigestCount = 0, recordingDigestCapacity = 0;
+static unsigned long recordingDigestInterval;		// digestInterval, or the interval of the recording played back
+static recordingDigest *expectedDigests = NULL;		// kept with the recording played back
+static unsigned long expectedDigestCount = 0;
+static long firstDivergentDigest;					// in recordingDigests, or -1 while the replay matches
+static unsigned long divergentDigestSections;		// a bit for each section that differed
+static recordingDigest lastMatchingDigest;			// turn 0 if none has matched yet
+static clock_t recordingDigestTime;					// spent taking digests in this game
+
+// Where the next event goes in the recording, counting the header, whether recording or playing back.
+static unsigned long currentRecordingLocation() {
+	return (rogue.playbackMode ? recordingLocation : lengthOfPlaybackFile + locationInRecordingBuffer);
+}
+
+static void noteRecordingIndexEntry() {
+	recordingIndexEntry *last = (recordingIndexCount ? &recordingIndex[recordingIndexCount - 1] : NULL);
+	unsigned long location = currentRecordingLocation();
 	
-	if (locationInRecordingBuffer != 0) {
-		
-		recordFile = fopen(currentFilePath, "ab");
+	if (!last
+		|| (location > last->recordingLocation
+			&& (rogue.depthLevel != last->depthLevel || rogue.playerTurnNumber >= last->turnNumber + RECORDING_INDEX_INTERVAL))) {
 		
-		for (i=0; i<locationInRecordingBuffer; i++) {
-			putc(inputRecordBuffer[i], recordFile);
+		if (recordingIndexCount == recordingIndexCapacity) {
+			recordingIndexCapacity = max(64, recordingIndexCapacity * 2);
+			recordingIndex = realloc(recordingIndex, recordingIndexCapacity * sizeof(recordingIndexEntry));
 		}
-		
-		if (recordFile) {
-			fclose(recordFile);
+		recordingIndex[recordingIndexCount].turnNumber = rogue.playerTurnNumber;
+		recordingIndex[recordingIndexCount].recordingLocation = location;
+		recordingIndex[recordingIndexCount].depthLevel = rogue.depthLevel;
+		recordingIndexCount++;
+	}
+}
+
+static void noteRecordingDigest() {
+	recordingDigest *digest, *expected;
+	unsigned long location = currentRecordingLocation(), low, high, middle;
+	clock_t startTime;
+	short i;
+	
+	if (!recordingDigestInterval
+		|| (recordingDigestCount
+			&& (location <= recordingDigests[recordingDigestCount - 1].recordingLocation
+				|| rogue.playerTurnNumber < recordingDigests[recordingDigestCount - 1].turnNumber + recordingDigestInterval))
+		|| (!recordingDigestCount && rogue.playerTurnNumber < recordingDigestInterval)) {
+		return;
+	}
+	
+	if (recordingDigestCount == recordingDigestCapacity) {
+		recordingDigestCapacity = max(64, recordingDigestCapacity * 2);
+		recordingDigests = realloc(recordingDigests, recordingDigestCapacity * sizeof(recordingDigest));
+	}
+	digest = &recordingDigests[recordingDigestCount++];
+	digest->turnNumber = rogue.playerTurnNumber;
+	digest->recordingLocation = location;
+	startTime = clock();
+	digestGame(digest->digests);
+	recordingDigestTime += clock() - startTime;
+	
+	if (rogue.playbackMode && firstDivergentDigest < 0) {
+		for (low = 0, high = expectedDigestCount; low < high;) {
+			middle = (low + high) / 2;
+			if (expectedDigests[middle].turnNumber < digest->turnNumber) {
+				low = middle + 1;
+			} else {
+				high = middle;
+			}
+		}
+		expected = &expectedDigests[low];
+		if (low < expectedDigestCount
+			&& expected->turnNumber == digest->turnNumber
+			&& expected->recordingLocation == digest->recordingLocation) {
+			
+			for (i = 0; i < NUMBER_GAME_DIGESTS; i++) {
+				if (expected->digests[i] != digest->digests[i]) {
+					divergentDigestSections |= Fl(i);
+				}
+			}
+			if (divergentDigestSections) {
+				firstDivergentDigest = recordingDigestCount - 1;
+			} else {
+				lastMatchingDigest = *digest;
+			}
 		}
-		
-		locationInRecordingBuffer = 0;
+	}
+}
+
+// Flushes the recording and appends its index and digests. If the game goes on after all, what it
+// records next goes over them, and they're appended again when the recording is finished again.
+void finishRecording() {
+	unsigned char entry[RECORDING_INDEX_ENTRY_LENGTH], digest[RECORDING_DIGEST_LENGTH];
+	unsigned long i;
+	short j;
+	FILE *recordFile;
+	
+	flushBufferToFile();
+	if (rogue.playbackMode || !(recordFile = openRecordingFile(currentFilePath, true))) {
+		return;
+	}
+	fseek(recordFile, recordingFileEnd, SEEK_SET);
+	fwrite("BRIX", 1, 4, recordFile);
+	numberToString(recordingIndexCount, 4, entry);
+	fwrite(entry, 1, 4, recordFile);
+	for (i = 0; i < recordingIndexCount; i++) {
+		numberToString(recordingIndex[i].turnNumber, 4, &entry[0]);
+		numberToString(recordingIndex[i].recordingLocation, 4, &entry[4]);
+		entry[8] = (unsigned char) recordingIndex[i].depthLevel;
+		fwrite(entry, 1, RECORDING_INDEX_ENTRY_LENGTH, recordFile);
+	}
+	if (recordingDigestInterval) {
+		fwrite("BRDG", 1, 4, recordFile);
+		numberToString(recordingDigestInterval, 4, &digest[0]);
+		numberToString(recordingDigestCount, 4, &digest[4]);
+		fwrite(digest, 1, 8, recordFile);
+		for (i = 0; i < recordingDigestCount; i++) {
+			numberToString(recordingDigests[i].turnNumber, 4, &digest[0]);
+			numberToString(recordingDigests[i].recordingLocation, 4, &digest[4]);
+			for (j = 0; j < NUMBER_GAME_DIGESTS; j++) {
+				numberToString((unsigned long) (recordingDigests[i].digests[j] >> 32), 4, &digest[8 + 8 * j]);
+				numberToString((unsigned long) (recordingDigests[i].digests[j] & 0xFFFFFFFFUL), 4, &digest[12 + 8 * j]);
+			}
+			fwrite(digest, 1, RECORDING_DIGEST_LENGTH, recordFile);
+		}
+	}
+	fflush(recordFile);
+}
+
+// Reads a number written by numberToString().
+static unsigned long bytesToNumber(const unsigned char *bytes, short numberOfBytes) {
+	unsigned long n = 0;
+	short i;
+	
+	for (i = 0; i < numberOfBytes; i++) {
+		n = n * 256 + bytes[i];
+	}
+	return n;
+}
+
+// Opens the recording at path at the start of whatever follows its events, and sets *turnCount to the
+// turns in the recording and *trailerLength to the bytes that follow. Returns NULL if it can't be read.
+static FILE *openRecordingTrailer(char *path, unsigned long *turnCount, unsigned long *trailerLength) {
+	unsigned char header[RECORDING_HEADER_LENGTH];
+	unsigned long end;
+	FILE *file;
+	
+	if (!(file = fopen(path, "rb"))) {
+		return NULL;
+	}
+	if (fread(header, 1, RECORDING_HEADER_LENGTH, file) != RECORDING_HEADER_LENGTH) {
+		fclose(file);
+		return NULL;
+	}
+	end = findRecordingEnd(file, header, false);
+	fseek(file, 0, SEEK_END);
+	*trailerLength = ftell(file) - end;
+	fseek(file, end, SEEK_SET);
+	*turnCount = bytesToNumber(&header[20], 4);
+	return file;
+}
+
+// Reads the index of the recording at path. Returns its entries, which the caller frees, and sets
+// *entryCount, and *turnCount to the turns in the recording; or returns NULL if there's no index,
+// and leaves *entryCount alone.
+recordingIndexEntry *readRecordingIndex(char *path, unsigned long *entryCount, unsigned long *turnCount) {
+	unsigned char entry[RECORDING_INDEX_ENTRY_LENGTH];
+	recordingIndexEntry *entries = NULL;
+	unsigned long trailerLength, count, i;
+	FILE *file;
+	
+	if (!(file = openRecordingTrailer(path, turnCount, &trailerLength))) {
+		return NULL;
+	}
+	if (trailerLength >= 8 && fread(entry, 1, 8, file) == 8 && !memcmp(entry, "BRIX", 4)) {
+		count = bytesToNumber(&entry[4], 4);
+		if (count <= (trailerLength - 8) / RECORDING_INDEX_ENTRY_LENGTH) {
+			entries = malloc(max(1, count) * sizeof(recordingIndexEntry));
+			for (i = 0; i < count && fread(entry, 1, RECORDING_INDEX_ENTRY_LENGTH, file) == RECORDING_INDEX_ENTRY_LENGTH; i++) {
+				entries[i].turnNumber = bytesToNumber(&entry[0], 4);
+				entries[i].recordingLocation = bytesToNumber(&entry[4], 4);
+				entries[i].depthLevel = entry[8];
+			}
+			*entryCount = i;
+		}
+	}
+	fclose(file);
+	return entries;
+}
+
+// Reads the digests kept with the recording at path, or returns NULL if it has none and leaves the
+// rest alone. Sets *digestCount, and *interval to the turns between them.
+static recordingDigest *readRecordingDigests(char *path, unsigned long *digestCount, unsigned long *interval) {
+	unsigned char bytes[RECORDING_DIGEST_LENGTH];
+	recordingDigest *digests = NULL;
+	unsigned long turnCount, trailerLength, entryCount, count, i;
+	short j;
+	FILE *file;
+	
+	if (!(file = openRecordingTrailer(path, &turnCount, &trailerLength))) {
+		return NULL;
+	}
+	if (trailerLength >= 8 && fread(bytes, 1, 8, file) == 8 && !memcmp(bytes, "BRIX", 4)) {
+		entryCount = bytesToNumber(&bytes[4], 4);
+		if (entryCount <= (trailerLength - 8) / RECORDING_INDEX_ENTRY_LENGTH) {
+			trailerLength -= 8 + entryCount * RECORDING_INDEX_ENTRY_LENGTH;
+			fseek(file, entryCount * RECORDING_INDEX_ENTRY_LENGTH, SEEK_CUR);
+			if (trailerLength >= 12 && fread(bytes, 1, 12, file) == 12 && !memcmp(bytes, "BRDG", 4)) {
+				count = bytesToNumber(&bytes[8], 4);
+				if (count <= (trailerLength - 12) / RECORDING_DIGEST_LENGTH) {
+					*interval = bytesToNumber(&bytes[4], 4);
+					digests = malloc(max(1, count) * sizeof(recordingDigest));
+					for (i = 0; i < count && fread(bytes, 1, RECORDING_DIGEST_LENGTH, file) == RECORDING_DIGEST_LENGTH; i++) {
+						digests[i].turnNumber = bytesToNumber(&bytes[0], 4);
+						digests[i].recordingLocation = bytesToNumber(&bytes[4], 4);
+						for (j = 0; j < NUMBER_GAME_DIGESTS; j++) {
+							digests[i].digests[j] = ((gameDigest) bytesToNumber(&bytes[8 + 8 * j], 4) << 32)
+								| bytesToNumber(&bytes[12 + 8 * j], 4);
+						}
+					}
+					*digestCount = i;
+				}
+			}
+		}
+	}
+	fclose(file);
+	return digests;
+}
+
+// Gets ready to take digests in a new game, or, playing back, to compare them with the recording's.
+static void initRecordingDigests() {
+	unsigned long interval;
+	
+	recordingDigestCount = 0;
+	recordingDigestInterval = digestInterval;
+	recordingDigestTime = 0;
+	firstDivergentDigest = -1;
+	divergentDigestSections = 0;
+	lastMatchingDigest.turnNumber = 0;
+	lastMatchingDigest.recordingLocation = RECORDING_HEADER_LENGTH;
+	free(expectedDigests);
+	expectedDigests = NULL;
+	expectedDigestCount = 0;
+	if (rogue.playbackMode
+		&& (expectedDigests = readRecordingDigests(currentFilePath, &expectedDigestCount, &interval))) {
+		recordingDigestInterval = interval;
+	} else {
+		expectedDigestCount = 0;
+	}
+}
+
+// Takes up the index and digests of the recording at path, for a game that goes on from a snapshot;
+// replaying it would have gathered them.
+static void restoreRecordingIndex(char *path) {
+	recordingIndexEntry *entries;
+	unsigned long entryCount, turnCount;
+	
+	if ((entries = readRecordingIndex(path, &entryCount, &turnCount))) {
+		free(recordingIndex);
+		recordingIndex = entries;
+		recordingIndexCount = entryCount;
+		recordingIndexCapacity = max(1, entryCount);
+	}
+	if (expectedDigestCount) {
+		free(recordingDigests);
+		recordingDigests = malloc(expectedDigestCount * sizeof(recordingDigest));
+		memcpy(recordingDigests, expectedDigests, expectedDigestCount * sizeof(recordingDigest));
+		recordingDigestCount = recordingDigestCapacity = expectedDigestCount;
 	}
 }
 
 #pragma mark Playback functions
 
+static boolean verifyingPlayback = false; // replaying with nobody watching, so going out of sync just stops
+
+// positionInPlaybackFile counts bytes of the recording, which are bytes of the file only in the classic format.
 void fillBufferFromFile() {
-//	short i;
+	unsigned long filled = 0, n;
+	long blockNumber;
 	FILE *recordFile;
 	
-	recordFile = fopen(currentFilePath, "rb");
-	fseek(recordFile, positionInPlaybackFile, SEEK_SET);
-	
-	fread((void *) inputRecordBuffer, 1, INPUT_RECORD_BUFFER, recordFile);
-	
-	positionInPlaybackFile = ftell(recordFile);
-	fclose(recordFile);
+	if ((recordFile = openRecordingFile(currentFilePath, false))) {
+		if (recordingFormat != RECORDING_FORMAT_COMPACT) {
+			fseek(recordFile, positionInPlaybackFile, SEEK_SET);
+			fread((void *) inputRecordBuffer, 1, INPUT_RECORD_BUFFER, recordFile);
+			positionInPlaybackFile = ftell(recordFile);
+		} else {
+			if (positionInPlaybackFile < RECORDING_HEADER_LENGTH) { // the header isn't coded
+				fseek(recordFile, positionInPlaybackFile, SEEK_SET);
+				filled = fread((void *) inputRecordBuffer, 1, RECORDING_HEADER_LENGTH - positionInPlaybackFile, recordFile);
+				positionInPlaybackFile += filled;
+			}
+			while (filled < INPUT_RECORD_BUFFER
+				   && (blockNumber = recordingBlockAt(positionInPlaybackFile)) < recordingBlockCount
+				   && decodeRecordingBlockNumber(blockNumber)) {
+				
+				n = positionInPlaybackFile - recordingBlocks[blockNumber].recordingLocation;
+				n = min(recordingBlocks[blockNumber].length - n, INPUT_RECORD_BUFFER - filled);
+				memcpy(&inputRecordBuffer[filled], &decodedBlock[positionInPlaybackFile - recordingBlocks[blockNumber].recordingLocation], n);
+				filled += n;
+				positionInPlaybackFile += n;
+			}
+		}
+	}
 	
 	locationInRecordingBuffer = 0;
 }
@@ -294,6 +991,12 @@ might succeed on the original computer."
 void playbackPanic() {
 	cellDisplayBuffer rbuf[COLS][ROWS];
 	
+	if (verifyingPlayback) {
+		rogue.playbackOOS = true;
+		rogue.gameHasEnded = true; // as if the player had taken over and finished the game
+		return;
+	}
+	
 	if (!rogue.playbackOOS) {
 		rogue.playbackFastForward = false;
 		rogue.playbackPaused = true;
@@ -421,6 +1124,7 @@ void displayAnnotation() {
 	if (rogue.playbackMode
 		&& rogue.playerTurnNumber == rogue.nextAnnotationTurn) {
 		
+		stopSkippingPlaybackFrames(); // annotations are there to be read
 		if (!rogue.playbackFastForward) {
 			refreshSideBar(-1, -1, false);
 			
@@ -443,8 +1147,7 @@ void displayAnnotation() {
 // initializes based on and starts reading from the recording file
 void initRecording() {
 	short i;
-	char versionString[16], buf[100];
-	FILE *recordFile;
+	char versionString[16], expectedVersionString[16], buf[100];
 	
 	//initializeBrogueSaveLocation();
 	
@@ -455,6 +1158,9 @@ void initRecording() {
 	RNGLogFile = fopen(RNG_LOG, "a");
 #endif
 	
+	closeRecordingFile(); // currentFilePath may name a different file, or the same name recreated
+	recordingIndexCount = 0;
+	initRecordingDigests();
 	locationInRecordingBuffer	= 0;
 	positionInPlaybackFile		= 0;
 	recordingLocation			= 0;
@@ -469,6 +1175,7 @@ void initRecording() {
 		lengthOfPlaybackFile		= 100000; // so recall functions don't freak out
 		rogue.playbackDelayPerTurn	= DEFAULT_PLAYBACK_DELAY;
 		rogue.playbackDelayThisTurn	= rogue.playbackDelayPerTurn;
+		setPlaybackRate(0);
 		rogue.playbackPaused		= false;
 		
 		fillBufferFromFile();
@@ -476,8 +1183,16 @@ void initRecording() {
 		for (i=0; i<16; i++) {
 			versionString[i] = recallChar();
 		}
+		rogue.generatorVersion = (unsigned char) versionString[15];
+		versionString[15] = '\0';
+		if (rogue.generatorVersion < NUMBER_GENERATOR_VERSIONS
+			&& (unsigned char) versionString[RECORDING_FORMAT_BYTE] < NUMBER_RECORDING_FORMATS) {
+			recordingVersionString(expectedVersionString, (unsigned char) versionString[RECORDING_FORMAT_BYTE], rogue.generatorVersion);
+		}
 		
-		if (strcmp(versionString, BROGUE_VERSION_STRING)) {
+		if (rogue.generatorVersion >= NUMBER_GENERATOR_VERSIONS
+			|| (unsigned char) versionString[RECORDING_FORMAT_BYTE] >= NUMBER_RECORDING_FORMATS
+			|| strcmp(versionString, expectedVersionString)) {
 			rogue.playbackMode = false;
 			rogue.playbackFastForward = false;
 			sprintf(buf, "This file is from version %s and cannot be opened in version %s.", versionString, BROGUE_VERSION_STRING);
@@ -502,8 +1217,7 @@ void initRecording() {
 	} else {
 		lengthOfPlaybackFile = 1;
 		remove(currentFilePath);
-		recordFile = fopen(currentFilePath, "wb"); // create the file
-		fclose(recordFile);
+		openRecordingFile(currentFilePath, true); // create the file
 		
 		flushBufferToFile(); // header info never makes it into inputRecordBuffer when recording
 	}
@@ -534,6 +1248,9 @@ void RNGCheck() {
 	short oldRNG;
 	unsigned long randomNumber;
 	
+	noteRecordingIndexEntry();
+	noteRecordingDigest();
+	
 	oldRNG = rogue.RNG;
 	rogue.RNG = RNG_SUBSTANTIVE;
 	
@@ -612,18 +1329,156 @@ void printPlaybackHelpScreen() {
 	overlayDisplayBuffer(rbuf, NULL);
 }
 
+#pragma mark Keyframes
+
+// While a recording plays back, the game is snapshotted every keyframeInterval turns, so that a seek
+// can restore the nearest keyframe before its destination and replay only the rest of the way.
+// The keyframes are kept within keyframeMemoryLimit bytes: when they outgrow it, every other one
+// is dropped and the interval doubles.
+
+typedef struct playbackKeyframe {
+	unsigned long turnNumber;
+	unsigned long recordingLocation;	// where the next event starts in the recording
+	unsigned char *snapshot;
+	unsigned long length;
+} playbackKeyframe;
+
+static playbackKeyframe *keyframes = NULL;	// in order of turn number
+static long keyframeCount = 0, keyframeCapacity = 0;
+static unsigned long keyframeMemory = 0;
+static unsigned long keyframeSpacing = 0;	// keyframeInterval, doubled for every thinning
+
+// Returns the index of the last keyframe at or before the turn, or -1 if there isn't one.
+static long keyframeBefore(unsigned long turnNumber) {
+	long low = 0, high = keyframeCount - 1, middle, found = -1;
+	
+	while (low <= high) {
+		middle = (low + high) / 2;
+		if (keyframes[middle].turnNumber <= turnNumber) {
+			found = middle;
+			low = middle + 1;
+		} else {
+			high = middle - 1;
+		}
+	}
+	return found;
+}
+
+// Keeps only the first keyframe in each stretch of keyframeSpacing turns.
+static void thinKeyframes() {
+	long i, kept = 0;
+	
+	for (i = 0; i < keyframeCount; i++) {
+		if (kept > 0 && keyframes[kept - 1].turnNumber / keyframeSpacing == keyframes[i].turnNumber / keyframeSpacing) {
+			keyframeMemory -= keyframes[i].length;
+			free(keyframes[i].snapshot);
+		} else {
+			keyframes[kept++] = keyframes[i];
+		}
+	}
+	keyframeCount = kept;
+}
+
+void freePlaybackKeyframes() {
+	long i;
+	
+	for (i = 0; i < keyframeCount; i++) {
+		free(keyframes[i].snapshot);
+	}
+	free(keyframes);
+	keyframes = NULL;
+	keyframeCount = keyframeCapacity = 0;
+	keyframeMemory = 0;
+	keyframeSpacing = 0;
+}
+
+// Called during playback just before the next top-level event is read; snapshots the game
+// if there is no keyframe yet for this stretch of turns.
+void notePlaybackKeyframe() {
+	playbackKeyframe newKeyframe;
+	long i;
+	
+	if (!rogue.playbackMode || rogue.gameHasEnded || rogue.playbackOOS
+		|| !keyframeInterval || !keyframeMemoryLimit || !rogue.playerTurnNumber) {
+		return;
+	}
+	if (!keyframeSpacing) {
+		keyframeSpacing = keyframeInterval;
+	}
+	i = keyframeBefore(rogue.playerTurnNumber);
+	if (i >= 0 && keyframes[i].turnNumber / keyframeSpacing == rogue.playerTurnNumber / keyframeSpacing) {
+		return;
+	}
+	
+	newKeyframe.turnNumber = rogue.playerTurnNumber;
+	newKeyframe.recordingLocation = recordingLocation;
+	newKeyframe.snapshot = snapshotGame(&newKeyframe.length);
+	if (!newKeyframe.snapshot || newKeyframe.length > keyframeMemoryLimit) {
+		free(newKeyframe.snapshot);
+		return;
+	}
+	
+	if (keyframeCount >= keyframeCapacity) {
+		keyframeCapacity = max(16, keyframeCapacity * 2);
+		keyframes = realloc(keyframes, keyframeCapacity * sizeof(playbackKeyframe));
+	}
+	i++;
+	memmove(&keyframes[i + 1], &keyframes[i], (keyframeCount - i) * sizeof(playbackKeyframe));
+	keyframes[i] = newKeyframe;
+	keyframeCount++;
+	keyframeMemory += newKeyframe.length;
+	
+	while (keyframeMemory > keyframeMemoryLimit) {
+		keyframeSpacing *= 2;
+		thinKeyframes();
+	}
+}
+
+// Puts the game back the way it was at the keyframe, with the recording ready to read the events after it.
+static boolean restorePlaybackKeyframe(playbackKeyframe *theKeyframe) {
+	freeEverything();
+	if (!restoreGameSnapshot(theKeyframe->snapshot, theKeyframe->length)) {
+		freeEverything();
+		return false;
+	}
+	recordingLocation = theKeyframe->recordingLocation;
+	positionInPlaybackFile = recordingLocation;
+	fillBufferFromFile();
+	rogue.playbackOOS = false;
+	return true;
+}
+
 void advanceToLocation(unsigned long destinationFrame) {
-	unsigned long progressBarInterval, initialFrameNumber;
+	unsigned long progressBarInterval, initialFrameNumber, keyframeTurn;
 	rogueEvent theEvent;
-    boolean useProgressBar;
+    boolean useProgressBar, restart, restored;
+	long keyframeIndex;
+	clock_t startTime;
+	char buf[COLS];
 	
 	cellDisplayBuffer dbuf[COLS][ROWS];
     
-    if (destinationFrame < rogue.playerTurnNumber) {
+	startTime = clock();
+	restart = (destinationFrame < rogue.playerTurnNumber);
+	restored = false;
+	keyframeTurn = 0;
+	
+	// Restore the nearest keyframe before the destination if it saves replaying anything.
+	keyframeIndex = keyframeBefore(destinationFrame);
+	if (keyframeIndex >= 0
+		&& (restart || keyframes[keyframeIndex].turnNumber > rogue.playerTurnNumber)) {
+		
+		keyframeTurn = keyframes[keyframeIndex].turnNumber;
+		restored = restorePlaybackKeyframe(&keyframes[keyframeIndex]);
+		restart = !restored; // everything has been freed if the keyframe wouldn't restore
+	} else if (restart) {
+		freeEverything();
+	}
+	
+    if (restart) {
         useProgressBar = (destinationFrame > 100 ? true : false);
         
         // Start the recording over, and fast-forward to chosen frame.
-        freeEverything();
         randomNumbersGenerated = 0;
         rogue.playbackMode = true;
         initializeRogue(0); // Seed argument is ignored because we're in playback.
@@ -633,6 +1488,9 @@ void advanceToLocation(unsigned long destinationFrame) {
         }
     } else {
         useProgressBar = (destinationFrame - rogue.playerTurnNumber > 100 ? true : false);
+		if (useProgressBar && restored) {
+			blackOutScreen();
+		}
     }
     
     clearDisplayBuffer(dbuf);
@@ -655,6 +1513,7 @@ void advanceToLocation(unsigned long destinationFrame) {
             pauseBrogue(1);
         }
         
+        notePlaybackKeyframe();
         rogue.RNG = RNG_COSMETIC; // dancing terrain colors can't influence recordings
         rogue.playbackDelayThisTurn = 0;
         nextBrogueEvent(&theEvent, false, true, false);
@@ -664,6 +1523,14 @@ void advanceToLocation(unsigned long destinationFrame) {
     rogue.playbackPaused = true;
     rogue.playbackFastForward = false;
     confirmMessages();
+	if (restored) {
+		sprintf(buf, "Reached turn %lu in %li ms from the keyframe at turn %lu.", rogue.playerTurnNumber,
+				(long) ((clock() - startTime) * 1000 / CLOCKS_PER_SEC), keyframeTurn);
+	} else {
+		sprintf(buf, "Reached turn %lu in %li ms%s.", rogue.playerTurnNumber,
+				(long) ((clock() - startTime) * 1000 / CLOCKS_PER_SEC), (restart ? " from the start" : ""));
+	}
+	messageWithColor(buf, &teal, false);
     updateMessageDisplay();
     refreshSideBar(-1, -1, false);
     displayLevel();
@@ -713,11 +1580,22 @@ void pausePlayback() {
 	}
 }
 
+static void flashPlaybackSpeed() {
+	char buf[30];
+	
+	if (playbackRate()) {
+		sprintf(buf, " %lu turns/sec ", playbackRate());
+	} else {
+		sprintf(buf, " %.3g turns/sec ", 1000.0 / rogue.playbackDelayPerTurn);
+	}
+	flashTemporaryAlert(buf, 300);
+}
+
 // Used to interact with playback -- e.g. changing speed, pausing.
 void executePlaybackInput(rogueEvent *recordingInput) {
 	uchar key;
 	short newDelay, frameCount, x, y, previousDeepestLevel;
-	unsigned long destinationFrame;
+	unsigned long destinationFrame, newRate;
 	boolean pauseState, proceed;
 	rogueEvent theEvent;
 	char path[BROGUE_FILENAME_MAX];
@@ -732,19 +1610,40 @@ void executePlaybackInput(rogueEvent *recordingInput) {
 		switch (key) {
 			case UP_ARROW:
 			case UP_KEY:
-				newDelay = max(1, min(rogue.playbackDelayPerTurn / 1.5, rogue.playbackDelayPerTurn - 1));
-				if (newDelay != rogue.playbackDelayPerTurn) {
-					flashTemporaryAlert(" Faster ", 300);
+				if (playbackRate()) {
+					newRate = min(MAXIMUM_PLAYBACK_RATE, playbackRate() * 3 / 2);
+					if (newRate != playbackRate()) {
+						setPlaybackRate(newRate);
+						flashPlaybackSpeed();
+					}
+				} else {
+					newDelay = max(1, min(rogue.playbackDelayPerTurn / 1.5, rogue.playbackDelayPerTurn - 1));
+					if (newDelay < PLAYBACK_FRAME_LENGTH) {
+						setPlaybackRate(1000 / newDelay); // faster than a turn a frame, so skip frames
+					} else {
+						rogue.playbackDelayPerTurn = newDelay;
+					}
+					flashPlaybackSpeed();
 				}
-				rogue.playbackDelayPerTurn = newDelay;
 				break;
 			case DOWN_ARROW:
 			case DOWN_KEY:
-				newDelay = min(3000, max(rogue.playbackDelayPerTurn * 1.5, rogue.playbackDelayPerTurn + 1));
-				if (newDelay != rogue.playbackDelayPerTurn) {
-					flashTemporaryAlert(" Slower ", 300);
+				if (playbackRate()) {
+					newRate = playbackRate() * 2 / 3;
+					if (newRate * PLAYBACK_FRAME_LENGTH < 1000) {
+						setPlaybackRate(0); // a turn a frame or slower, so draw every turn
+						rogue.playbackDelayPerTurn = PLAYBACK_FRAME_LENGTH;
+					} else {
+						setPlaybackRate(newRate);
+					}
+					flashPlaybackSpeed();
+				} else {
+					newDelay = min(3000, max(rogue.playbackDelayPerTurn * 1.5, rogue.playbackDelayPerTurn + 1));
+					if (newDelay != rogue.playbackDelayPerTurn) {
+						rogue.playbackDelayPerTurn = newDelay;
+						flashPlaybackSpeed();
+					}
 				}
-				rogue.playbackDelayPerTurn = newDelay;
 				break;
 			case ACKNOWLEDGE_KEY:
 				if (rogue.playbackOOS && rogue.playbackPaused) {
@@ -773,6 +1672,7 @@ void executePlaybackInput(rogueEvent *recordingInput) {
 						rogue.playbackFastForward = true;
 						while ((rogue.deepestLevel <= previousDeepestLevel || !rogue.playbackBetweenTurns)
 							   && !rogue.gameHasEnded) {
+							notePlaybackKeyframe();
 							rogue.RNG = RNG_COSMETIC; // dancing terrain colors can't influence recordings
 							nextBrogueEvent(&theEvent, false, true, false);
 							rogue.RNG = RNG_SUBSTANTIVE;
@@ -833,6 +1733,7 @@ void executePlaybackInput(rogueEvent *recordingInput) {
                     // advance by the right number of turns
                     if (!rogue.playbackPaused || unpause()) {
                         while (rogue.playerTurnNumber < destinationFrame && !rogue.gameHasEnded && !rogue.playbackOOS) {
+                            notePlaybackKeyframe();
                             rogue.RNG = RNG_COSMETIC; // dancing terrain colors can't influence recordings
                             rogue.playbackDelayThisTurn = 0;
                             nextBrogueEvent(&theEvent, false, true, false);
@@ -959,6 +1860,69 @@ void getAvailableFilePath(char *returnPath, const char *defaultPath, const char
 	}
 }
 
+// A saved game carries a snapshot of the game after its recording, so that it can be loaded without
+// replaying the recording. The snapshot follows the last recorded event, and a footer at the very end
+// of the file gives its length and the length of the recording in front of it. Anything that reads
+// the file as a recording stops at the end of the recording and never sees the snapshot.
+
+#define SAVED_SNAPSHOT_FOOTER_LENGTH	12
+
+static void appendGameSnapshot(char *path) {
+	unsigned char *snapshot, footer[SAVED_SNAPSHOT_FOOTER_LENGTH];
+	unsigned long length;
+	FILE *saveFile;
+	
+	if (!(snapshot = snapshotGame(&length))) {
+		return;
+	}
+	memcpy(footer, "BRSS", 4);
+	numberToString(length, 4, &footer[4]);
+	numberToString(lengthOfPlaybackFile, 4, &footer[8]);
+	if ((saveFile = fopen(path, "ab"))) {
+		fwrite(snapshot, 1, length, saveFile);
+		fwrite(footer, 1, SAVED_SNAPSHOT_FOOTER_LENGTH, saveFile);
+		fclose(saveFile);
+	}
+	free(snapshot);
+}
+
+// Returns the snapshot saved after a recording of recordingLength bytes, which the caller frees,
+// or NULL if the file doesn't end in one.
+static unsigned char *readSavedGameSnapshot(char *path, unsigned long recordingLength, unsigned long *length) {
+	unsigned char *snapshot = NULL, footer[SAVED_SNAPSHOT_FOOTER_LENGTH];
+	unsigned long fileLength, savedRecordingLength;
+	short i;
+	FILE *saveFile;
+	
+	if (!(saveFile = fopen(path, "rb"))) {
+		return NULL;
+	}
+	fseek(saveFile, 0, SEEK_END);
+	fileLength = ftell(saveFile);
+	if (fileLength >= RECORDING_HEADER_LENGTH + SAVED_SNAPSHOT_FOOTER_LENGTH
+		&& !fseek(saveFile, fileLength - SAVED_SNAPSHOT_FOOTER_LENGTH, SEEK_SET)
+		&& fread(footer, 1, SAVED_SNAPSHOT_FOOTER_LENGTH, saveFile) == SAVED_SNAPSHOT_FOOTER_LENGTH
+		&& !memcmp(footer, "BRSS", 4)) {
+		
+		for (*length = 0, savedRecordingLength = 0, i = 0; i < 4; i++) {
+			*length = *length * 256 + footer[4 + i];
+			savedRecordingLength = savedRecordingLength * 256 + footer[8 + i];
+		}
+		if (savedRecordingLength == recordingLength
+			&& RECORDING_HEADER_LENGTH + *length + SAVED_SNAPSHOT_FOOTER_LENGTH <= fileLength) {
+			
+			snapshot = malloc(max(1, *length));
+			fseek(saveFile, fileLength - SAVED_SNAPSHOT_FOOTER_LENGTH - *length, SEEK_SET);
+			if (fread(snapshot, 1, *length, saveFile) != *length) {
+				free(snapshot);
+				snapshot = NULL;
+			}
+		}
+	}
+	fclose(saveFile);
+	return snapshot;
+}
+
 void saveGame() {
 	char filePath[BROGUE_FILENAME_MAX], defaultPath[BROGUE_FILENAME_MAX];
 	boolean askAgain;
@@ -978,7 +1942,9 @@ void saveGame() {
 			strcat(filePath, GAME_SUFFIX);
 			if (!fileExists(filePath) || confirm("File of that name already exists. Overwrite?", true)) {
 				remove(filePath);
-				flushBufferToFile();
+				finishRecording();
+				closeRecordingFile();
+				appendGameSnapshot(currentFilePath);
 				rename(currentFilePath, filePath);
 				strcpy(currentFilePath, filePath);
 				message("Saved.", true);
@@ -1010,11 +1976,13 @@ void saveRecording() {
 			strcat(filePath, RECORDING_SUFFIX);
 			if (!fileExists(filePath) || confirm("File of that name already exists. Overwrite?", true)) {
 				remove(filePath);
+				closeRecordingFile();
 				rename(currentFilePath, filePath);
 			} else {
 				askAgain = true;
 			}
 		} else { // declined to save
+			closeRecordingFile();
 			remove(currentFilePath);
 		}
 	} while (askAgain);
@@ -1044,6 +2012,9 @@ void copyFile(char *fromFilePath, char *toFilePath, unsigned long fromFileLength
 // at the end of loading a saved game, this function transitions into active play mode.
 void switchToPlaying() {
     char lastGamePath[BROGUE_FILENAME_MAX];
+	unsigned long copyLength = recordingLocation;
+	long blockNumber;
+	recordingBlock *lastBlock;
     
     getAvailableFilePath(lastGamePath, LAST_GAME_NAME, GAME_SUFFIX);
     strcat(lastGamePath, GAME_SUFFIX);
@@ -1052,7 +2023,27 @@ void switchToPlaying() {
 	rogue.playbackFastForward	= false;
 	rogue.playbackOmniscience	= false;
 	locationInRecordingBuffer	= 0;
-	copyFile(currentFilePath, lastGamePath, recordingLocation);
+	freePlaybackKeyframes();
+	
+	// A compact recording is carried over block by block; the block that the game stopped partway through
+	// goes back into the buffer to be coded again with what follows it.
+	if (openRecordingFile(currentFilePath, false) && recordingFormat == RECORDING_FORMAT_COMPACT) {
+		blockNumber = recordingBlockAt(recordingLocation);
+		if (blockNumber < recordingBlockCount && decodeRecordingBlockNumber(blockNumber)) {
+			copyLength = recordingBlocks[blockNumber].fileLocation;
+			lengthOfPlaybackFile = recordingBlocks[blockNumber].recordingLocation;
+			locationInRecordingBuffer = recordingLocation - lengthOfPlaybackFile;
+			memcpy(inputRecordBuffer, decodedBlock, locationInRecordingBuffer);
+		} else if (recordingBlockCount > 0) {
+			lastBlock = &recordingBlocks[recordingBlockCount - 1];
+			copyLength = lastBlock->codedLocation + lastBlock->codedLength;
+			lengthOfPlaybackFile = lastBlock->recordingLocation + lastBlock->length;
+		} else {
+			copyLength = lengthOfPlaybackFile = RECORDING_HEADER_LENGTH;
+		}
+	}
+	closeRecordingFile();
+	copyFile(currentFilePath, lastGamePath, copyLength);
 	
 #ifdef DELETE_SAVE_FILE_AFTER_LOADING
 	remove(currentFilePath);
@@ -1067,8 +2058,10 @@ void switchToPlaying() {
 }
 
 void loadSavedGame() {
-	unsigned long progressBarInterval;
+	unsigned long progressBarInterval, snapshotLength;
+	unsigned char *snapshot;
 	rogueEvent theEvent;
+	boolean restored = false;
 	
 	cellDisplayBuffer dbuf[COLS][ROWS];
 	
@@ -1076,12 +2069,29 @@ void loadSavedGame() {
 	rogue.playbackMode = true;
 	rogue.playbackFastForward = true;
 	initializeRogue(0); // Calls initRecording(). Seed argument is ignored because we're initially in playback mode.
-	if (!rogue.gameHasEnded) {
+	
+	// Restore the snapshot saved with the game if there is one; otherwise, replay the recording.
+	if (!rogue.gameHasEnded
+		&& (snapshot = readSavedGameSnapshot(currentFilePath, lengthOfPlaybackFile, &snapshotLength))) {
+		
+		freeEverything();
+		restored = restoreGameSnapshot(snapshot, snapshotLength);
+		free(snapshot);
+		if (restored) {
+			recordingLocation = lengthOfPlaybackFile;
+			restoreRecordingIndex(currentFilePath);
+		} else {
+			freeEverything();
+			randomNumbersGenerated = 0;
+			initializeRogue(0);
+		}
+	}
+	if (!rogue.gameHasEnded && !restored) {
 		blackOutScreen();
 		startLevel(rogue.depthLevel, 1);
 	}
 	
-	if (rogue.howManyTurns > 0) {
+	if (rogue.howManyTurns > 0 && !restored) {
 		
 		progressBarInterval = max(1, lengthOfPlaybackFile / 100);
 		
@@ -1117,6 +2127,204 @@ void loadSavedGame() {
 	}
 }
 
+// Replays the recording of a saved game to its end and compares the result, digest by digest, with
+// the snapshot saved beside it, listing each section in report. Returns how many sections differ,
+// -1 if the file has no snapshot or can't be played, or -2 if its snapshot was made by a build
+// that lays the game out differently.
+short verifySavedGame(char *path, FILE *report) {
+	gameDigest replayed[NUMBER_GAME_DIGESTS], saved[NUMBER_GAME_DIGESTS];
+	unsigned long snapshotLength;
+	unsigned char *snapshot;
+	rogueEvent theEvent;
+	short i, differences = 0;
+	boolean outOfSync;
+	
+	if (!fileExists(path)) {
+		return -1;
+	}
+	strcpy(currentFilePath, path);
+	randomNumbersGenerated = 0;
+	rogue.playbackMode = true;
+	rogue.playbackFastForward = true;
+	verifyingPlayback = true; // from the start, as the first RNG check comes while the first level is built
+	initializeRogue(0);
+	if (rogue.gameHasEnded
+		|| !(snapshot = readSavedGameSnapshot(currentFilePath, lengthOfPlaybackFile, &snapshotLength))) {
+		
+		verifyingPlayback = false;
+		freeEverything();
+		rogue.playbackMode = rogue.playbackFastForward = rogue.playbackOOS = false;
+		return -1;
+	}
+	if (!snapshotMatchesBuild(snapshot, snapshotLength)) {
+		verifyingPlayback = false;
+		free(snapshot);
+		freeEverything();
+		rogue.playbackMode = rogue.playbackFastForward = rogue.playbackOOS = false;
+		return -2;
+	}
+	
+	startLevel(rogue.depthLevel, 1);
+	while (recordingLocation < lengthOfPlaybackFile && !rogue.gameHasEnded && !rogue.playbackOOS) {
+		rogue.RNG = RNG_COSMETIC;
+		nextBrogueEvent(&theEvent, false, true, false);
+		rogue.RNG = RNG_SUBSTANTIVE;
+		executeEvent(&theEvent);
+	}
+	verifyingPlayback = false;
+	outOfSync = rogue.playbackOOS;
+	digestGame(replayed);
+	freeEverything();
+	
+	if (!restoreGameSnapshot(snapshot, snapshotLength)) {
+		free(snapshot);
+		freeEverything();
+		rogue.playbackMode = rogue.playbackFastForward = false;
+		return -1;
+	}
+	free(snapshot);
+	digestGame(saved);
+	freeEverything();
+	rogue.playbackMode = rogue.playbackFastForward = rogue.playbackOOS = false;
+	
+	if (outOfSync) {
+		fprintf(report, "The recording went out of sync at byte %lu.\n", recordingLocation);
+	}
+	fprintf(report, "%-16s%-18s%-18s\n", "section", "replayed", "saved");
+	for (i = 0; i < NUMBER_GAME_DIGESTS; i++) {
+		fprintf(report, "%-16s%016llx  %016llx  %s\n", gameDigestName(i), replayed[i], saved[i],
+				(replayed[i] == saved[i] ? "" : "differs"));
+		differences += (replayed[i] != saved[i]);
+	}
+	return differences;
+}
+
+static void finishVerifyingRecording() {
+	verifyingPlayback = false;
+	freeEverything();
+	rogue.playbackMode = rogue.playbackFastForward = rogue.playbackOOS = false;
+}
+
+// Starts replaying the recording at path with nothing drawn. Returns false if it isn't a recording
+// this version can play.
+static boolean startVerifyingRecording(char *path) {
+	if (!fileExists(path)) {
+		return false;
+	}
+	strcpy(currentFilePath, path);
+	annotationPathname[0] = '\0';
+	randomNumbersGenerated = 0;
+	rogue.playbackMode = true;
+	rogue.playbackFastForward = true;
+	verifyingPlayback = true; // from the start, as the first RNG check comes while the first level is built
+	initializeRogue(0);
+	if (rogue.gameHasEnded) {
+		finishVerifyingRecording();
+		return false;
+	}
+	startLevel(rogue.depthLevel, 1);
+	return true;
+}
+
+// Replays the rest of the recording, until it ends or goes out of sync, or strays from the digests kept
+// with it if stopAtDivergence.
+static void continueVerifyingRecording(boolean stopAtDivergence) {
+	rogueEvent theEvent;
+	
+	while (recordingLocation < lengthOfPlaybackFile && !rogue.gameHasEnded && !rogue.playbackOOS
+		   && !(stopAtDivergence && firstDivergentDigest >= 0)) {
+		rogue.RNG = RNG_COSMETIC;
+		nextBrogueEvent(&theEvent, false, true, false);
+		rogue.RNG = RNG_SUBSTANTIVE;
+		executeEvent(&theEvent);
+	}
+}
+
+// Replays a recording to its end with nothing drawn, for checking a corpus of recordings for determinism.
+// Returns -1 if the file isn't a recording this version can play, 1 if it went out of sync (described on report)
+// and 0 if it played through in sync. *turns is set to the number of player turns replayed, and *digestSeconds
+// to the processor time spent taking digests along the way.
+short verifyRecording(char *path, unsigned long *turns, double *digestSeconds, FILE *report) {
+	short result;
+	
+	*turns = 0;
+	*digestSeconds = 0;
+	if (!startVerifyingRecording(path)) {
+		return -1;
+	}
+	continueVerifyingRecording(true);
+	*turns = rogue.playerTurnNumber;
+	*digestSeconds = (double) recordingDigestTime / CLOCKS_PER_SEC;
+	
+	if (firstDivergentDigest >= 0) {
+		fprintf(report, "%s: strayed from the recorded game between turns %lu and %lu (see --bisect).\n",
+				path, lastMatchingDigest.turnNumber, recordingDigests[firstDivergentDigest].turnNumber);
+		result = 1;
+	} else if (rogue.playbackOOS) {
+		fprintf(report, "%s: out of sync at byte %lu of %lu, on turn %lu of depth %i.\n",
+				path, recordingLocation, lengthOfPlaybackFile, rogue.playerTurnNumber, rogue.depthLevel);
+		result = 1;
+	} else if (rogue.playerTurnNumber != rogue.howManyTurns) {
+		fprintf(report, "%s: played through in %lu turns, but the recording says %lu.\n",
+				path, rogue.playerTurnNumber, rogue.howManyTurns);
+		result = 1;
+	} else {
+		result = 0;
+	}
+	finishVerifyingRecording();
+	return result;
+}
+
+// Replays a recording against the digests kept with it, to narrow down where a replay that goes out of
+// sync first strayed from the recorded game: between which two digests, and in which sections of the
+// game. Replaying only goes forward, so one pass that compares each digest as it comes finds the first
+// that differs, as a bisection would; recording with a digest interval of 1 pins down the very turn.
+// Returns -1 if the file isn't a recording this version can play or has no digests, 1 if the replay
+// strayed or went out of sync and 0 if it matched throughout. The findings go to report.
+short bisectRecording(char *path, FILE *report) {
+	recordingDigest *divergent;
+	unsigned long digestCount;
+	short i, sections, result;
+	
+	if (!startVerifyingRecording(path)) {
+		return -1;
+	}
+	if (!expectedDigests) {
+		finishVerifyingRecording();
+		return -1;
+	}
+	digestCount = expectedDigestCount;
+	continueVerifyingRecording(false); // on to the RNG check that notices, to see how late it is
+	
+	if (firstDivergentDigest >= 0) {
+		divergent = &recordingDigests[firstDivergentDigest];
+		fprintf(report, "%s: the replay first strays from the recorded game between turn %lu (byte %lu) and turn %lu (byte %lu), in:",
+				path, lastMatchingDigest.turnNumber, lastMatchingDigest.recordingLocation,
+				divergent->turnNumber, divergent->recordingLocation);
+		for (i = sections = 0; i < NUMBER_GAME_DIGESTS; i++) {
+			if (divergentDigestSections & Fl(i)) {
+				fprintf(report, "%s %s", (sections++ ? "," : ""), gameDigestName(i));
+			}
+		}
+		fprintf(report, ".\n");
+		if (rogue.playbackOOS) {
+			fprintf(report, "%s: the RNG checks noticed on turn %lu (byte %lu).\n", path, rogue.playerTurnNumber, recordingLocation);
+		} else {
+			fprintf(report, "%s: the RNG checks never noticed.\n", path);
+		}
+		result = 1;
+	} else if (rogue.playbackOOS) {
+		fprintf(report, "%s: out of sync on turn %lu (byte %lu), but the last digest, on turn %lu, matched.\n",
+				path, rogue.playerTurnNumber, recordingLocation, lastMatchingDigest.turnNumber);
+		result = 1;
+	} else {
+		fprintf(report, "%s: all %lu digests, every %lu turns, match.\n", path, digestCount, recordingDigestInterval);
+		result = 0;
+	}
+	finishVerifyingRecording();
+	return result;
+}
+
 #pragma mark Debug functions
 
 // the following functions are used to create human-readable descriptions of playback files for debugging purposes
@@ -1188,7 +2396,7 @@ void parseFile() {
 	unsigned long oldFileLoc, oldRecLoc, oldLength, oldBufLoc, i, seed, numTurns, numDepths, fileLength, startLoc;
 	unsigned char c;
 	char description[1000], versionString[500];
-	short x, y;
+	short x, y, generatorVersion;
 	
 	if (selectFile("Parse recording: ", "Recording.broguerec", "")) {
 		
@@ -1208,15 +2416,18 @@ void parseFile() {
 		for (i=0; i<16; i++) {
 			versionString[i] = recallChar();
 		}
+		generatorVersion = (unsigned char) versionString[15];
+		versionString[15] = '\0';
 		
 		seed		= recallNumber(4);
 		numTurns	= recallNumber(4);
 		numDepths	= recallNumber(4);
 		fileLength	= recallNumber(4);
 		
-		fprintf(descriptionFile, "Parsed file \"%s\":\n\tVersion: %s\n\tSeed: %li\n\tNumber of turns: %li\n\tNumber of depth changes: %li\n\tFile length: %li\n",
+		fprintf(descriptionFile, "Parsed file \"%s\":\n\tVersion: %s\n\tGenerator version: %i\n\tSeed: %li\n\tNumber of turns: %li\n\tNumber of depth changes: %li\n\tFile length: %li\n",
 				currentFilePath,
 				versionString,
+				generatorVersion,
 				seed,
 				numTurns,
 				numDepths,
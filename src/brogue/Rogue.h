@@ -49,6 +49,7 @@
 #define D_IMMORTAL						(DEBUGGING && 1)
 #define D_INSPECT_LEVELGEN				(DEBUGGING && 0)
 #define D_INSPECT_MACHINES				(DEBUGGING && 0)
+#define D_VERIFY_CHOKE_MAP				(DEBUGGING && 0)
 
 // set to false to allow multiple loads from the same saved file:
 #define DELETE_SAVE_FILE_AFTER_LOADING	true
@@ -77,6 +78,8 @@
 #define RECORDING_SUFFIX		".broguerec"
 #define GAME_SUFFIX				".broguesave"
 #define ANNOTATION_SUFFIX		".txt"
+#define LEVEL_CATALOG_SUFFIX	".broguelevels"
+#define SEED_CATALOG_SUFFIX		".brogueseeds"
 #define RNG_LOG					"RNGLog.txt"
 
 #define BROGUE_FILENAME_MAX		(min(1024*4, FILENAME_MAX))
@@ -132,6 +135,8 @@
 
 #define INPUT_RECORD_BUFFER		1000		// how many bytes of input data to keep in memory before saving it to disk
 #define DEFAULT_PLAYBACK_DELAY	50
+#define PLAYBACK_FRAME_LENGTH	33			// milliseconds; playback faster than a turn a frame skips frames
+#define MAXIMUM_PLAYBACK_RATE	20000		// turns per second
 
 #define HIGH_SCORES_COUNT		30
 
@@ -309,6 +314,13 @@ typedef struct rogueEvent {
 	boolean shiftKey;
 } rogueEvent;
 
+// An entry in the index appended to a finished recording: where in the recording a turn begins.
+typedef struct recordingIndexEntry {
+	unsigned long turnNumber;
+	unsigned long recordingLocation;	// in the recording's events, counting the header
+	short depthLevel;
+} recordingIndexEntry;
+
 typedef struct rogueHighScoresEntry {
 	signed long score;
 	char date[100];
@@ -1633,6 +1645,7 @@ enum terrainFlagCatalog {
 	T_OBSTRUCTS_EVERYTHING			= (T_OBSTRUCTS_PASSABILITY | T_OBSTRUCTS_VISION | T_OBSTRUCTS_ITEMS | T_OBSTRUCTS_GAS | T_OBSTRUCTS_SURFACE_EFFECTS | T_OBSTRUCTS_DIAGONAL_MOVEMENT),
 	T_HARMFUL_TERRAIN				= (T_CAUSES_POISON | T_IS_FIRE | T_CAUSES_DAMAGE | T_CAUSES_PARALYSIS | T_CAUSES_CONFUSION | T_CAUSES_EXPLOSIVE_DAMAGE),
     T_RESPIRATION_IMMUNITIES        = (T_CAUSES_DAMAGE | T_CAUSES_CONFUSION | T_CAUSES_PARALYSIS | T_CAUSES_NAUSEA),
+	T_DERIVED_MAP_INPUTS			= (T_PATHING_BLOCKER | T_OBSTRUCTS_DIAGONAL_MOVEMENT | T_HARMFUL_TERRAIN | T_SPONTANEOUSLY_IGNITES), // see noteTerrainChange()
 };
 
 enum terrainMechanicalFlagCatalog {
@@ -1954,6 +1967,73 @@ enum NGCommands {
 	NG_QUIT,
 };
 
+// A seed search predicate: every clause must hold. A clause asks for an item of the given category (and kind, and
+// at least the given enchantment) on or above maximumDepth, or, with a category of 0, for a reward room by then.
+#define MAX_SEED_PREDICATE_CLAUSES	16
+
+typedef struct seedPredicateClause {
+	unsigned long category;
+	short kind;							// -1 for any kind
+	boolean checkEnchant;
+	short minimumEnchant;
+	short maximumDepth;
+} seedPredicateClause;
+
+typedef struct seedPredicate {
+	short clauseCount;
+	seedPredicateClause clauses[MAX_SEED_PREDICATE_CLAUSES];
+	short maximumDepth;					// the deepest level any clause looks at
+} seedPredicate;
+
+// The sections of a game digest (see digestGame()).
+enum gameDigests {
+	GAME_DIGEST_RANDOM,
+	GAME_DIGEST_PLAYER,
+	GAME_DIGEST_PACK,
+	GAME_DIGEST_MAP,
+	GAME_DIGEST_MONSTERS,
+	GAME_DIGEST_FLOOR_ITEMS,
+	GAME_DIGEST_LEVELS,
+	GAME_DIGEST_IDENTIFICATION,
+	NUMBER_GAME_DIGESTS
+};
+
+typedef unsigned long long gameDigest; // 64 bits wide
+
+// Callbacks for floodFillRegion(). A step goes from a filled cell to an orthogonal neighbor, both on the map.
+typedef boolean (*floodStepPredicate)(short fromX, short fromY, short toX, short toY, void *context);
+typedef void (*floodCellAction)(short x, short y, void *context);
+
+// Level generation algorithms that consume the RNG differently. Every recording notes the one it was generated with,
+// so that a seed reproduces the same dungeon as long as the same generator version is selected.
+enum generatorVersions {
+	GENERATOR_CLASSIC = 0,				// rejection sampling in randomMatchingLocation
+	GENERATOR_INDEXED_LOCATIONS,		// randomMatchingLocation falls back on one draw from the list of all matching cells
+	NUMBER_GENERATOR_VERSIONS
+};
+
+// maps that are derived from the level and recalculated on demand:
+enum derivedMapTypes {
+	DM_SAFETY = 0,						// safetyMap -- where monsters flee from the player
+	DM_ALLY_SAFETY,						// allySafetyMap -- where allies flee from enemies
+	DM_SAFE_TERRAIN,					// rogue.mapToSafeTerrain -- how monsters escape harmful terrain
+	DM_SHORE,							// rogue.mapToShore -- how far to the nearest land
+	NUMBER_DERIVED_MAPS
+};
+
+// Remembers what a derived map was last calculated from, so that it is recalculated only when one of those things changes:
+typedef struct derivedMapState {
+	boolean updatedThisTurn;			// so it's updated no more than once per turn
+	boolean valid;						// whether the inputs below describe the current contents of the map
+	unsigned long terrainEpoch;			// rogue.terrainEpoch (or rogue.deepTerrainEpoch for the shore map) at calculation
+	short depthLevel;
+	short playerLoc[2];
+	unsigned long playerStatus;			// bits for the player status effects that the map reads
+	char occupancy[DCOLS][DROWS];		// per cell, how the map classified the creature standing there
+	unsigned long hits;					// requests that reused the map because nothing had changed
+	unsigned long recalculations;		// requests that had to recalculate the map
+} derivedMapState;
+
 // these are basically global variables pertaining to the game state and player's unique variables:
 typedef struct playerCharacter {
 	short depthLevel;					// which dungeon level are we on
@@ -1967,10 +2047,6 @@ typedef struct playerCharacter {
 	boolean justRested;					// previous turn was a rest -- used in stealth
 	boolean cautiousMode;				// used to prevent careless deaths caused by holding down a key
 	boolean receivedLevitationWarning;	// only warn you once when you're hovering dangerously over liquid
-	boolean updatedSafetyMapThisTurn;	// so it's updated no more than once per turn
-	boolean updatedAllySafetyMapThisTurn;	// so it's updated no more than once per turn
-	boolean updatedMapToSafeTerrainThisTurn;// so it's updated no more than once per turn
-	boolean updatedMapToShoreThisTurn;		// so it's updated no more than once per turn
 	boolean easyMode;					// enables easy mode
 	boolean inWater;					// helps with the blue water filter effect
 	boolean heardCombatThisTurn;		// so you get only one "you hear combat in the distance" per turn
@@ -1982,6 +2058,7 @@ typedef struct playerCharacter {
 	boolean quit;						// to skip the typical end-game theatrics when the player quits
 	unsigned long seed;					// the master seed for generating the entire dungeon
 	short RNG;							// which RNG are we currently using?
+	short generatorVersion;				// which level generation algorithms the dungeon uses (enum generatorVersions)
 	unsigned long gold;					// how much gold we have
 	unsigned long goldGenerated;		// how much gold has been generated on the levels, not counting gold held by monsters
 	short strength;
@@ -2019,6 +2096,11 @@ typedef struct playerCharacter {
 	// maps
 	short **mapToShore;					// how many steps to get back to shore
 	short **mapToSafeTerrain;			// so monsters can get to safety
+	derivedMapState derivedMaps[NUMBER_DERIVED_MAPS]; // bookkeeping for the safety maps, map to safe terrain and map to shore
+	unsigned long terrainEpoch;			// incremented whenever terrain changes, so derived maps know when they're stale
+	unsigned long deepTerrainEpoch;		// incremented when deep water, lava or chasms may have appeared or vanished
+	unsigned long allyEnemyScans;		// how many times a blinking ally needed allyEnemyMap scanned...
+	unsigned long allyEnemyScansSkipped;// ...and how many times there was no enemy to scan from
 	
 	// recording info
 	boolean playbackMode;				// whether we're viewing a recording instead of playing
@@ -2166,6 +2248,17 @@ typedef struct blueprint {
 	machineFeature feature[20];			// the features themselves
 } blueprint;
 
+// How an attempt to build a machine from a blueprint ended, for the machine-building telemetry:
+enum machineBuildOutcomes {
+	MACHINE_BUILT = 0,
+	MACHINE_NO_BLUEPRINT,				// no blueprint qualified for the depth and required flags
+	MACHINE_NO_SITE,					// no gate site, location or vestibule room for the blueprint
+	MACHINE_BAD_INTERIOR,				// the interior overlapped another machine or failed the blocking checks
+	MACHINE_NO_ADOPTIVE,				// a feature needed an adoptive machine and none could be built
+	MACHINE_FEATURE_SHORTFALL,			// a feature could not place its minimum number of instances
+	NUMBER_MACHINE_OUTCOMES
+};
+
 enum machineTypes {
 	// Reward rooms:
 	MT_REWARD_MULTI_LIBRARY = 1,
@@ -2341,8 +2434,12 @@ extern "C" {
 	short randClump(randomRange theRange);
 	boolean rand_percent(short percent);
 	short poisson(short percent);
+	short pickCumulativeFrequency(const short *cumulativeFrequencies, short listLength);
 	void shuffleList(short *list, short listLength);
     void fillSequentialList(short *list, short listLength);
+	unsigned long randomGeneratorStateSize();
+	void getRandomGeneratorState(void *state);
+	void setRandomGeneratorState(const void *state);
 	short unflag(unsigned long flag);
 	void considerCautiousMode();
 	void refreshScreen();
@@ -2365,6 +2462,10 @@ extern "C" {
 						  item *adoptiveItem,
 						  item *parentSpawnedItems[50],
 						  creature *parentSpawnedMonsters[50]);
+	void resetMachineTelemetry();
+	boolean writeMachineTelemetry(FILE *stream);
+	boolean addMachineTelemetry(FILE *stream);
+	void dumpMachineTelemetry(FILE *stream);
 	void digDungeon();
 	void updateMapToShore();
 	short levelIsDisconnectedWithBlockingMap(char blockingMap[DCOLS][DROWS], boolean countRegionSize);
@@ -2389,6 +2490,7 @@ extern "C" {
 				  short foreRed, short foreGreen, short foreBlue);
 	void pausingTimerStartsNow();
 	boolean pauseForMilliseconds(short milliseconds);
+	unsigned long wallClockMilliseconds();
 	void nextKeyOrMouseEvent(rogueEvent *returnEvent, boolean textInput, boolean colorsDance);
 	boolean controlKeyIsDown();
 	boolean shiftKeyIsDown();
@@ -2425,6 +2527,9 @@ extern "C" {
 	void displayCenteredAlert(char *message);
 	void flashMessage(char *message, short x, short y, int time, color *fColor, color *bColor);
 	void flashTemporaryAlert(char *message, int time);
+	unsigned long playbackRate();
+	void setPlaybackRate(unsigned long turnsPerSecond);
+	void stopSkippingPlaybackFrames();
 	void waitForAcknowledgment();
 	void waitForKeystrokeOrMouseClick();
 	boolean confirm(char *prompt, boolean alsoDuringPlayback);
@@ -2523,6 +2628,9 @@ extern "C" {
 	boolean cellCanHoldGas(short x, short y);
 	void monstersFall();
 	void updateEnvironment();
+	void noteTerrainChange(enum tileType oldTile, enum tileType newTile);
+	boolean derivedMapIsCurrent(enum derivedMapTypes theMap);
+	void resetDerivedMaps();
 	void updateAllySafetyMap();
 	void updateSafetyMap();
 	void updateSafeTerrainMap();
@@ -2674,6 +2782,7 @@ extern "C" {
 									boolean displayErrors);
 	void clearInventory(char keystroke);
 	item *generateItem(unsigned short theCategory, short theKind);
+	void setKindFrequency(itemTable *theTable, short theKind, short frequency);
 	short chooseKind(itemTable *theTable, short numKinds);
 	item *makeItemInto(item *theItem, unsigned long itemCategory, short itemKind);
 	void updateEncumbrance();
@@ -2705,6 +2814,7 @@ extern "C" {
 	void freeGrid(short **array);
 	void copyGrid(short **to, short **from);
 	void fillGrid(short **grid, short fillValue);
+    short floodFillRegion(short x, short y, floodStepPredicate canFlood, floodCellAction fill, void *context);
     void hiliteGrid(short **grid, color *hiliteColor, short hiliteStrength);
     void findReplaceGrid(short **grid, short findValueMin, short findValueMax, short fillValue);
     void drawRectangleOnGrid(short **grid, short x, short y, short width, short height, short value);
@@ -2786,9 +2896,12 @@ extern "C" {
 	void autoPlayLevel(boolean fastForward);
 	void updateClairvoyance();
 	
+	void numberToString(unsigned long number, short numberOfBytes, unsigned char *recordTo);
 	void initRecording();
 	void flushBufferToFile();
+	void finishRecording();
 	void fillBufferFromFile();
+	void closeRecordingFile();
 	void recordEvent(rogueEvent *event);
 	void recallEvent(rogueEvent *event);
 	void pausePlayback();
@@ -2805,12 +2918,37 @@ extern "C" {
 	void saveRecording();
 	void parseFile();
 	void RNGLog(char *message);
+	void notePlaybackKeyframe();
+	void freePlaybackKeyframes();
+	unsigned char *snapshotGame(unsigned long *length);
+	boolean restoreGameSnapshot(const unsigned char *snapshot, unsigned long length);
+	boolean snapshotMatchesBuild(const unsigned char *snapshot, unsigned long length);
+	void digestGame(gameDigest digests[NUMBER_GAME_DIGESTS]);
+	void forgetLevelDigest(short level);
+	const char *gameDigestName(short section);
+	short verifySavedGame(char *path, FILE *report);
+	short verifyRecording(char *path, unsigned long *turns, double *digestSeconds, FILE *report);
+	short bisectRecording(char *path, FILE *report);
+	recordingIndexEntry *readRecordingIndex(char *path, unsigned long *entryCount, unsigned long *turnCount);
 	
 	void checkForDungeonErrors();
 	
 	boolean dialogChooseFile(char *path, const char *suffix, const char *prompt);
 	void dialogAlert(char *message);
 	void mainBrogueJunction();
+	void writeSeedCatalogHeader(FILE *stream, unsigned long firstSeed, unsigned long lastSeed, short scanThroughDepth);
+	void writeBinarySeedCatalogHeader(FILE *stream, unsigned long firstSeed, unsigned long lastSeed, short scanThroughDepth);
+	void catalogSeeds(unsigned long firstSeed, unsigned long lastSeed, short scanThroughDepth, boolean binary,
+					  char *scratchPath, FILE *stream);
+	boolean indexSeedCatalog(FILE *stream);
+	boolean writeSeedCatalogText(const unsigned char *catalog, unsigned long length, FILE *stream);
+	long querySeedCatalog(const unsigned char *catalog, unsigned long length, seedPredicate *predicate, FILE *stream);
+	boolean parseSeedPredicate(const char *text, seedPredicate *predicate);
+	boolean seedMatchesPredicate(unsigned long seed, seedPredicate *predicate, char *scratchPath);
+	void writeLevelCatalogHeader(FILE *stream);
+	unsigned long generateLevelCatalog(unsigned long firstSeed, unsigned long lastSeed,
+									   short firstDepth, short lastDepth,
+									   char *scratchPath, FILE *stream);
 	
 	void initializeButton(brogueButton *button);
 	void drawButtonsInState(buttonState *state);
@@ -263,6 +263,7 @@ void initializeRogue(unsigned long seed) {
 	if (!rogue.playbackMode) {
 		rogue.seed = seedRandomGenerator(seed);
 		previousGameSeed = rogue.seed;
+		rogue.generatorVersion = newGameGeneratorVersion;
 	}
     
     //benchmark();
@@ -281,6 +282,7 @@ void initializeRogue(unsigned long seed) {
 	resetDFMessageEligibility();
 	
 	// initialize the levels list
+	forgetLevelDigest(-1);
 	for (i=0; i<DEEPEST_LEVEL+1; i++) {
 		levels[i].levelSeed = (unsigned long) rand_range(0, 9999) + 10000 * rand_range(0, 9999);
 		levels[i].monsters = NULL;
@@ -371,6 +373,8 @@ void initializeRogue(unsigned long seed) {
 	scentMap			= NULL;
 	safetyMap			= allocGrid();
 	allySafetyMap		= allocGrid();
+	allyEnemyMap		= allocGrid();
+	allyEnemyCostMap	= allocGrid();
 	chokeMap			= allocGrid();
 	playerPathingMap	= allocGrid();
 	
@@ -379,6 +383,8 @@ void initializeRogue(unsigned long seed) {
 	// Zero out the dynamic grids, as an essential safeguard against OOSes:
 	fillGrid(safetyMap, 0);
 	fillGrid(allySafetyMap, 0);
+	fillGrid(allyEnemyMap, 0);
+	fillGrid(allyEnemyCostMap, 0);
 	fillGrid(chokeMap, 0);
 	fillGrid(playerPathingMap, 0);
 	fillGrid(rogue.mapToSafeTerrain, 0);
@@ -415,10 +421,7 @@ void initializeRogue(unsigned long seed) {
 	rogue.easyMode = false;
 	rogue.inWater = false;
 	rogue.creaturesWillFlashThisTurn = false;
-	rogue.updatedSafetyMapThisTurn = false;
-	rogue.updatedAllySafetyMapThisTurn = false;
-	rogue.updatedMapToSafeTerrainThisTurn = false;
-	rogue.updatedMapToShoreThisTurn = false;
+	resetDerivedMaps();
 	rogue.strength = 12;
 	rogue.weapon = NULL;
 	rogue.armor = NULL;
@@ -614,8 +617,59 @@ void updateColors() {
 	}
 }
 
-void startLevel(short oldLevelNumber, short stairDirection) {
+// Builds the current depth, whose storage is level, into pmap and the monster and item chains.
+// Everything that decides the layout comes in through level -- its seed and anything that has already
+// fallen into it from above -- or from the generation counters in rogue (reward rooms, gold,
+// item frequencies and so on), which only level generation changes. The main RNG stream is
+// consumed by exactly two draws, no matter how much work the level takes.
+// This is only the boundary that pregeneration would sit behind; the level is still built here,
+// synchronously, when the player first arrives. It is not safe to run on another thread: the
+// generator works directly on pmap, tmap, rogue, the monster and item chains and the one
+// substantive RNG, and a level built before arrival would miss anything that falls into it
+// in the meantime.
+static void generateNewLevel(levelData *level) {
 	unsigned long oldSeed;
+	item *theItem;
+	boolean isAlreadyAmulet = false;
+	
+	level->scentMap = allocGrid();
+	scentMap = level->scentMap;
+	fillGrid(level->scentMap, 0);
+	
+	oldSeed = (unsigned long) rand_range(0, 9999) + 10000 * rand_range(0, 9999);
+	seedRandomGenerator(level->levelSeed);
+	
+	// Load up next level's monsters and items, since one might have fallen from above.
+	monsters->nextCreature			= level->monsters;
+	dormantMonsters->nextCreature	= level->dormantMonsters;
+	floorItems->nextItem			= level->items;
+	
+	level->monsters = NULL;
+	level->dormantMonsters = NULL;
+	level->items = NULL;
+	
+	digDungeon();
+	initializeLevel();
+	setUpWaypoints();
+	
+	shuffleTerrainColors(100, false);
+	
+	if (rogue.depthLevel >= AMULET_LEVEL && !numberOfMatchingPackItems(AMULET, 0, 0, false)
+		&& level->visited == false) {
+		for (theItem = floorItems->nextItem; theItem != NULL; theItem = theItem->nextItem) {
+			if (theItem->category & AMULET) {
+				isAlreadyAmulet = true;
+				break;
+			}
+		}
+		if (!isAlreadyAmulet) {
+			placeItem(generateItem(AMULET, 0), 0, 0);
+		}
+	}
+	seedRandomGenerator(oldSeed);
+}
+
+void startLevel(short oldLevelNumber, short stairDirection) {
 	item *theItem;
 	short loc[2], i, j, x, y, px, py, flying, dir;
 	boolean isAlreadyAmulet = false, placedPlayer;
@@ -726,6 +780,7 @@ void startLevel(short oldLevelNumber, short stairDirection) {
 	}
 	
 	levels[oldLevelNumber - 1].awaySince = rogue.absoluteTurnNumber;
+	forgetLevelDigest(oldLevelNumber - 1);
 	
 	//	Prepare the new level
 	
@@ -734,41 +789,7 @@ void startLevel(short oldLevelNumber, short stairDirection) {
 	updateRingBonuses(); // also updates miner's light
 	
 	if (!levels[rogue.depthLevel - 1].visited) { // level has not already been visited
-        levels[rogue.depthLevel - 1].scentMap = allocGrid();
-        scentMap = levels[rogue.depthLevel - 1].scentMap;
-        fillGrid(levels[rogue.depthLevel - 1].scentMap, 0);
-		// generate new level
-		oldSeed = (unsigned long) rand_range(0, 9999) + 10000 * rand_range(0, 9999);
-		seedRandomGenerator(levels[rogue.depthLevel - 1].levelSeed);
-		
-		// Load up next level's monsters and items, since one might have fallen from above.
-		monsters->nextCreature			= levels[rogue.depthLevel-1].monsters;
-		dormantMonsters->nextCreature	= levels[rogue.depthLevel-1].dormantMonsters;
-		floorItems->nextItem			= levels[rogue.depthLevel-1].items;
-		
-		levels[rogue.depthLevel-1].monsters = NULL;
-		levels[rogue.depthLevel-1].dormantMonsters = NULL;
-		levels[rogue.depthLevel-1].items = NULL;
-		
-		digDungeon();
-		initializeLevel();
-		setUpWaypoints();
-		
-		shuffleTerrainColors(100, false);
-		
-		if (rogue.depthLevel >= AMULET_LEVEL && !numberOfMatchingPackItems(AMULET, 0, 0, false)
-			&& levels[rogue.depthLevel-1].visited == false) {
-			for (theItem = floorItems->nextItem; theItem != NULL; theItem = theItem->nextItem) {
-				if (theItem->category & AMULET) {
-					isAlreadyAmulet = true;
-					break;
-				}
-			}
-			if (!isAlreadyAmulet) {
-				placeItem(generateItem(AMULET, 0), 0, 0);
-			}
-		}
-		seedRandomGenerator(oldSeed);
+		generateNewLevel(&levels[rogue.depthLevel - 1]);
 		
 		//logLevel();
 		
@@ -844,6 +865,10 @@ void startLevel(short oldLevelNumber, short stairDirection) {
 		freeGrid(mapToPit);
 	}
 	
+	// The derived maps describe the level we just left.
+	rogue.terrainEpoch++;
+	rogue.deepTerrainEpoch++;
+	
 	// Simulate the environment!
 	// First bury the player in limbo while we run the simulation,
 	// so that any harmful terrain doesn't affect her during the process.
@@ -983,9 +1008,12 @@ void freeEverything() {
 #ifdef AUDIT_RNG
 	fclose(RNGLogFile);
 #endif
+	closeRecordingFile();
     
 	freeGlobalDynamicGrid(&safetyMap);
 	freeGlobalDynamicGrid(&allySafetyMap);
+	freeGlobalDynamicGrid(&allyEnemyMap);
+	freeGlobalDynamicGrid(&allyEnemyCostMap);
 	freeGlobalDynamicGrid(&chokeMap);
 	freeGlobalDynamicGrid(&playerPathingMap);
 	freeGlobalDynamicGrid(&rogue.mapToShore);
@@ -1044,7 +1072,10 @@ void freeEverything() {
     }
     monsterItemsHopper = NULL;
     for (i=0; i<MAX_WAYPOINT_COUNT; i++) {
-        freeGrid(rogue.wpDistance[i]);
+        if (rogue.wpDistance[i]) {
+            freeGrid(rogue.wpDistance[i]);
+            rogue.wpDistance[i] = NULL;
+        }
     }
     
     deleteAllFlares();
@@ -1064,7 +1095,8 @@ void gameOver(char *killedBy, boolean useCustomPhrasing) {
 	
 	rogue.autoPlayingLevel = false;
 	
-	flushBufferToFile();
+	finishRecording();
+	stopSkippingPlaybackFrames();
 	
 	if (rogue.quit) {
 		if (rogue.playbackMode) {
@@ -1170,7 +1202,8 @@ void victory(boolean superVictory) {
 	boolean qualified, isPlayback;
 	cellDisplayBuffer dbuf[COLS][ROWS];
 	
-	flushBufferToFile();
+	finishRecording();
+	stopSkippingPlaybackFrames();
 	
 	deleteMessages();
     if (superVictory) {
@@ -0,0 +1,907 @@
+/*
+ *  Snapshots.c
+ *  Brogue
+ *
+ *  This file is part of Brogue.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU Affero General Public License as
+ *  published by the Free Software Foundation, either version 3 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Affero General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Affero General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Rogue.h"
+#include "IncludeGlobals.h"
+#include <stddef.h>
+
+// A game snapshot is the whole state of a game in progress, serialized into one block of memory:
+// the levels, the creature and item chains, the player, the random number generators and the
+// per-game tables (flavors, identification, message eligibility and so on). It leaves out the
+// recording and the controls of a playback session.
+//
+// Structs are written in their native layout, so a snapshot is only good for the build that made it.
+// Pointers are never written as they are. Creatures are numbered in the order in which they are
+// written (the player first), and a pointer to a creature is written as its number; the equipped
+// items are written as their positions in the pack; owned grids, items and creatures follow their
+// owners; and pointers to static data (colors and light sources) are written as their positions in
+// the catalogs below, so they don't depend on where the build put its globals.
+
+#define SNAPSHOT_FORMAT_VERSION	3
+#define SNAPSHOT_LAYOUT_LENGTH	11
+
+typedef struct snapshotBuffer {
+	unsigned char *data;
+	unsigned long length;
+	unsigned long capacity;
+	boolean overrun;			// reading went past the end, or read a position that isn't in its catalog
+	boolean unwritable;			// writing came to a pointer that isn't in any catalog
+
+	// The creatures, in the order in which they are written:
+	creature **creatures;
+	long *leaders;				// when reading, the number of each creature's leader
+	long creatureCount;
+	long creatureCapacity;
+
+	// When writing, the creatures sorted by address, to number the pointers to them:
+	struct creatureNumber {
+		creature *monst;
+		long number;
+	} *numbers;
+} snapshotBuffer;
+
+static void putBytes(snapshotBuffer *buffer, const void *source, unsigned long count) {
+	if (buffer->length + count > buffer->capacity) {
+		buffer->capacity = max(buffer->capacity * 2, buffer->length + count);
+		buffer->data = realloc(buffer->data, buffer->capacity);
+	}
+	memcpy(buffer->data + buffer->length, source, count);
+	buffer->length += count;
+}
+
+static void getBytes(snapshotBuffer *buffer, void *destination, unsigned long count) {
+	if (buffer->overrun || buffer->length + count > buffer->capacity) {
+		buffer->overrun = true;
+		memset(destination, 0, count);
+	} else {
+		memcpy(destination, buffer->data + buffer->length, count);
+		buffer->length += count;
+	}
+}
+
+static void putLong(snapshotBuffer *buffer, long n) {
+	putBytes(buffer, &n, sizeof(long));
+}
+
+static long getLong(snapshotBuffer *buffer) {
+	long n;
+	getBytes(buffer, &n, sizeof(long));
+	return n;
+}
+
+// The colors that creatures, items and the miner's light point to, other than those of the monster catalog.
+static color *snapshotStaticColors[] = {&white, &gray, &itemColor, &spectralImageColor, &playerInvisibleColor,
+	&playerInDarknessColor, &playerInShadowColor, &playerInLightColor, &torchLightColor, &fireForeColor,
+	&minersLightColor};
+
+#define SNAPSHOT_STATIC_COLOR_COUNT	((long) (sizeof(snapshotStaticColors) / sizeof(color *)))
+
+// A color is written as 0 for none, n for the nth of snapshotStaticColors, or -n for the color
+// of the nth monster in the catalog.
+static void putColorPointer(snapshotBuffer *buffer, const color *theColor) {
+	long i;
+
+	if (theColor == NULL) {
+		putLong(buffer, 0);
+		return;
+	}
+	for (i = 0; i < SNAPSHOT_STATIC_COLOR_COUNT; i++) {
+		if (snapshotStaticColors[i] == theColor) {
+			putLong(buffer, i + 1);
+			return;
+		}
+	}
+	for (i = 0; i < NUMBER_MONSTER_KINDS; i++) {
+		if (monsterCatalog[i].foreColor == theColor) {
+			putLong(buffer, -(i + 1));
+			return;
+		}
+	}
+	buffer->unwritable = true;
+	putLong(buffer, 0);
+}
+
+static color *getColorPointer(snapshotBuffer *buffer) {
+	long n = getLong(buffer);
+
+	if (n > 0 && n <= SNAPSHOT_STATIC_COLOR_COUNT) {
+		return snapshotStaticColors[n - 1];
+	} else if (n < 0 && n >= -NUMBER_MONSTER_KINDS) {
+		return (color *) monsterCatalog[-n - 1].foreColor;
+	} else if (n != 0) {
+		buffer->overrun = true;
+	}
+	return NULL;
+}
+
+// A light source is written as 0 for none, or n for the nth of the light catalog.
+static void putLightPointer(snapshotBuffer *buffer, const lightSource *light) {
+	long i;
+
+	if (light == NULL) {
+		putLong(buffer, 0);
+		return;
+	}
+	for (i = 0; i < NUMBER_LIGHT_KINDS; i++) {
+		if (&lightCatalog[i] == light) {
+			putLong(buffer, i + 1);
+			return;
+		}
+	}
+	buffer->unwritable = true;
+	putLong(buffer, 0);
+}
+
+static lightSource *getLightPointer(snapshotBuffer *buffer) {
+	long n = getLong(buffer);
+
+	if (n > 0 && n <= NUMBER_LIGHT_KINDS) {
+		return &lightCatalog[n - 1];
+	} else if (n != 0) {
+		buffer->overrun = true;
+	}
+	return NULL;
+}
+
+static void putGrid(snapshotBuffer *buffer, short **grid) {
+	putLong(buffer, grid != NULL);
+	if (grid) {
+		putBytes(buffer, grid[0], DCOLS * DROWS * sizeof(short));
+	}
+}
+
+static short **getGrid(snapshotBuffer *buffer) {
+	short **grid = NULL;
+
+	if (getLong(buffer)) {
+		grid = allocGrid();
+		getBytes(buffer, grid[0], DCOLS * DROWS * sizeof(short));
+	}
+	return grid;
+}
+
+#pragma mark Numbering creatures
+
+static void addCreature(snapshotBuffer *buffer, creature *monst) {
+	if (buffer->creatureCount >= buffer->creatureCapacity) {
+		buffer->creatureCapacity = max(64, buffer->creatureCapacity * 2);
+		buffer->creatures = realloc(buffer->creatures, buffer->creatureCapacity * sizeof(creature *));
+		buffer->leaders = realloc(buffer->leaders, buffer->creatureCapacity * sizeof(long));
+	}
+	buffer->creatures[buffer->creatureCount++] = monst;
+}
+
+// Numbers a creature and the creatures it carries, in the order writeCreature() writes them.
+static void numberCreature(snapshotBuffer *buffer, creature *monst) {
+	for (; monst != NULL; monst = monst->carriedMonster) {
+		addCreature(buffer, monst);
+	}
+}
+
+static void numberCreatureChain(snapshotBuffer *buffer, creature *chain) {
+	for (; chain != NULL; chain = chain->nextCreature) {
+		numberCreature(buffer, chain);
+	}
+}
+
+static int compareCreatureNumbers(const void *a, const void *b) {
+	const struct creatureNumber *first = a, *second = b;
+
+	return (first->monst < second->monst ? -1 : first->monst > second->monst ? 1 : 0);
+}
+
+// Numbers every creature in the game, in the order in which snapshotGame() writes them.
+static void numberAllCreatures(snapshotBuffer *buffer) {
+	long i;
+
+	numberCreature(buffer, &player);
+	for (i = 0; i < DEEPEST_LEVEL + 1; i++) {
+		numberCreatureChain(buffer, levels[i].monsters);
+		numberCreatureChain(buffer, levels[i].dormantMonsters);
+	}
+	numberCreatureChain(buffer, monsters->nextCreature);
+	numberCreatureChain(buffer, dormantMonsters->nextCreature);
+	numberCreatureChain(buffer, graveyard->nextCreature);
+
+	buffer->numbers = malloc(max(1, buffer->creatureCount) * sizeof(struct creatureNumber));
+	for (i = 0; i < buffer->creatureCount; i++) {
+		buffer->numbers[i].monst = buffer->creatures[i];
+		buffer->numbers[i].number = i;
+	}
+	qsort(buffer->numbers, buffer->creatureCount, sizeof(struct creatureNumber), compareCreatureNumbers);
+}
+
+// Returns the number of a creature, or -1 for NULL or for a creature that isn't in the game.
+static long creatureNumber(snapshotBuffer *buffer, creature *monst) {
+	struct creatureNumber key, *found;
+
+	if (!monst) {
+		return -1;
+	}
+	key.monst = monst;
+	found = bsearch(&key, buffer->numbers, buffer->creatureCount, sizeof(struct creatureNumber), compareCreatureNumbers);
+	return (found ? found->number : -1);
+}
+
+static creature *numberedCreature(snapshotBuffer *buffer, long number) {
+	return (number >= 0 && number < buffer->creatureCount ? buffer->creatures[number] : NULL);
+}
+
+#pragma mark Items and creatures
+
+static void writeItem(snapshotBuffer *buffer, item *theItem) {
+	item copy = *theItem;
+
+	copy.nextItem = NULL;
+	copy.foreColor = copy.inventoryColor = NULL;
+	putBytes(buffer, &copy, sizeof(item));
+	putColorPointer(buffer, theItem->foreColor);
+	putColorPointer(buffer, theItem->inventoryColor);
+}
+
+static item *readItem(snapshotBuffer *buffer) {
+	item *theItem = malloc(sizeof(item));
+
+	getBytes(buffer, theItem, sizeof(item));
+	theItem->foreColor = getColorPointer(buffer);
+	theItem->inventoryColor = getColorPointer(buffer);
+	theItem->nextItem = NULL;
+	return theItem;
+}
+
+static void writeItemChain(snapshotBuffer *buffer, item *chain) {
+	item *theItem;
+	long count = 0;
+
+	for (theItem = chain; theItem != NULL; theItem = theItem->nextItem) {
+		count++;
+	}
+	putLong(buffer, count);
+	for (theItem = chain; theItem != NULL; theItem = theItem->nextItem) {
+		writeItem(buffer, theItem);
+	}
+}
+
+static item *readItemChain(snapshotBuffer *buffer) {
+	item *chain = NULL, **link = &chain;
+	long count;
+
+	for (count = getLong(buffer); count > 0 && !buffer->overrun; count--) {
+		*link = readItem(buffer);
+		link = &((*link)->nextItem);
+	}
+	return chain;
+}
+
+// Writes a creature and everything it owns: its carried item, its maps and the creature it carries.
+static void writeCreature(snapshotBuffer *buffer, creature *monst) {
+	creature copy = *monst;
+
+	copy.info.foreColor = NULL;
+	copy.mapToMe = copy.safetyMap = NULL;
+	copy.leader = copy.carriedMonster = copy.nextCreature = NULL;
+	copy.carriedItem = NULL;
+	putBytes(buffer, &copy, sizeof(creature));
+	putColorPointer(buffer, monst->info.foreColor);
+	putLong(buffer, creatureNumber(buffer, monst->leader));
+	putGrid(buffer, monst->mapToMe);
+	putGrid(buffer, monst->safetyMap);
+	putLong(buffer, monst->carriedItem != NULL);
+	if (monst->carriedItem) {
+		writeItem(buffer, monst->carriedItem);
+	}
+	putLong(buffer, monst->carriedMonster != NULL);
+	if (monst->carriedMonster) {
+		writeCreature(buffer, monst->carriedMonster);
+	}
+}
+
+// Reads a creature into monst, which is allocated if it is NULL. Leaders are filled in
+// once every creature has been read.
+static creature *readCreature(snapshotBuffer *buffer, creature *monst) {
+	if (!monst) {
+		monst = malloc(sizeof(creature));
+	}
+	getBytes(buffer, monst, sizeof(creature));
+	addCreature(buffer, monst);
+	monst->info.foreColor = getColorPointer(buffer);
+	buffer->leaders[buffer->creatureCount - 1] = getLong(buffer);
+	monst->leader = monst->nextCreature = NULL;
+	monst->mapToMe = getGrid(buffer);
+	monst->safetyMap = getGrid(buffer);
+	monst->carriedItem = (getLong(buffer) ? readItem(buffer) : NULL);
+	monst->carriedMonster = (getLong(buffer) ? readCreature(buffer, NULL) : NULL);
+	return monst;
+}
+
+static void writeCreatureChain(snapshotBuffer *buffer, creature *chain) {
+	creature *monst;
+	long count = 0;
+
+	for (monst = chain; monst != NULL; monst = monst->nextCreature) {
+		count++;
+	}
+	putLong(buffer, count);
+	for (monst = chain; monst != NULL; monst = monst->nextCreature) {
+		writeCreature(buffer, monst);
+	}
+}
+
+static creature *readCreatureChain(snapshotBuffer *buffer) {
+	creature *chain = NULL, **link = &chain;
+	long count;
+
+	for (count = getLong(buffer); count > 0 && !buffer->overrun; count--) {
+		*link = readCreature(buffer, NULL);
+		link = &((*link)->nextCreature);
+	}
+	return chain;
+}
+
+static long packPosition(item *theItem) {
+	item *packItem;
+	long position = 0;
+
+	for (packItem = packItems->nextItem; packItem != NULL; packItem = packItem->nextItem, position++) {
+		if (packItem == theItem) {
+			return position;
+		}
+	}
+	return -1;
+}
+
+static item *packItemAt(long position) {
+	item *theItem;
+
+	if (position < 0) {
+		return NULL;
+	}
+	for (theItem = packItems->nextItem; theItem != NULL && position > 0; theItem = theItem->nextItem, position--);
+	return theItem;
+}
+
+static item *allocateChainHead() {
+	item *head = malloc(sizeof(item));
+
+	memset(head, '\0', sizeof(item));
+	return head;
+}
+
+static creature *allocateCreatureChainHead() {
+	creature *head = malloc(sizeof(creature));
+
+	memset(head, '\0', sizeof(creature));
+	return head;
+}
+
+#pragma mark The game
+
+static itemTable *snapshotTables[] = {scrollTable, potionTable, wandTable, staffTable, ringTable, charmTable};
+static const short snapshotTableSizes[] = {NUMBER_SCROLL_KINDS, NUMBER_POTION_KINDS, NUMBER_WAND_KINDS,
+	NUMBER_STAFF_KINDS, NUMBER_RING_KINDS, NUMBER_CHARM_KINDS};
+static color *snapshotColors[] = {&wallBackColor, &floorBackColor, &deepWaterBackColor, &shallowWaterBackColor,
+	&chasmEdgeBackColor, &minersLightColor};
+
+// The sizes of the structs that are written whole, and of the catalogs that pointers are written as
+// positions in; a snapshot made by a build of the game that lays these out differently can't be read.
+static void snapshotLayout(long layout[SNAPSHOT_LAYOUT_LENGTH]) {
+	layout[0] = sizeof(playerCharacter);
+	layout[1] = sizeof(creature);
+	layout[2] = sizeof(item);
+	layout[3] = sizeof(levelData);
+	layout[4] = sizeof(pcell);
+	layout[5] = sizeof(tcell);
+	layout[6] = sizeof(flare);
+	layout[7] = randomGeneratorStateSize();
+	layout[8] = SNAPSHOT_STATIC_COLOR_COUNT;
+	layout[9] = NUMBER_MONSTER_KINDS;
+	layout[10] = NUMBER_LIGHT_KINDS;
+}
+
+// Serializes the game in progress. Returns a block of memory that the caller frees, and its length;
+// or NULL if the game points to static data that no catalog here covers, and can't be snapshotted.
+unsigned char *snapshotGame(unsigned long *length) {
+	snapshotBuffer buffer;
+	playerCharacter rogueCopy;
+	levelData levelCopy;
+	unsigned char RNGState[64];
+	long layout[SNAPSHOT_LAYOUT_LENGTH];
+	short i, j;
+
+	memset(&buffer, 0, sizeof(buffer));
+	numberAllCreatures(&buffer);
+
+	putBytes(&buffer, "BRSN", 4);
+	putLong(&buffer, SNAPSHOT_FORMAT_VERSION);
+	snapshotLayout(layout);
+	putBytes(&buffer, layout, sizeof(layout));
+
+	getRandomGeneratorState(RNGState);
+	putBytes(&buffer, RNGState, randomGeneratorStateSize());
+	putLong(&buffer, randomNumbersGenerated);
+
+	// The game's bookkeeping, with its pointers written separately.
+	rogueCopy = rogue;
+	rogueCopy.weapon = rogueCopy.armor = rogueCopy.ringLeft = rogueCopy.ringRight = NULL;
+	rogueCopy.flares = NULL;
+	rogueCopy.minersLight.lightColor = NULL;
+	rogueCopy.lastTarget = NULL;
+	rogueCopy.mapToShore = rogueCopy.mapToSafeTerrain = NULL;
+	for (i = 0; i < MAX_WAYPOINT_COUNT; i++) {
+		rogueCopy.wpDistance[i] = NULL;
+	}
+	putBytes(&buffer, &rogueCopy, sizeof(playerCharacter));
+	putLong(&buffer, packPosition(rogue.weapon));
+	putLong(&buffer, packPosition(rogue.armor));
+	putLong(&buffer, packPosition(rogue.ringLeft));
+	putLong(&buffer, packPosition(rogue.ringRight));
+	putColorPointer(&buffer, rogue.minersLight.lightColor);
+	putLong(&buffer, creatureNumber(&buffer, rogue.lastTarget));
+	putLong(&buffer, rogue.flareCount);
+	for (i = 0; i < rogue.flareCount; i++) {
+		putBytes(&buffer, rogue.flares[i], sizeof(flare));
+		putLightPointer(&buffer, rogue.flares[i]->light);
+	}
+	putGrid(&buffer, rogue.mapToShore);
+	putGrid(&buffer, rogue.mapToSafeTerrain);
+	for (i = 0; i < rogue.wpCount; i++) {
+		putGrid(&buffer, rogue.wpDistance[i]);
+	}
+
+	writeCreature(&buffer, &player);
+	putBytes(&buffer, pmap, sizeof(pmap));
+	putBytes(&buffer, tmap, sizeof(tmap));
+	putBytes(&buffer, terrainRandomValues, sizeof(terrainRandomValues));
+
+	// The levels. The map of the current level is in pmap, so its stored map is stale and left out.
+	for (i = 0; i < DEEPEST_LEVEL + 1; i++) {
+		levelCopy = levels[i];
+		levelCopy.items = NULL;
+		levelCopy.monsters = levelCopy.dormantMonsters = NULL;
+		levelCopy.scentMap = NULL;
+		putBytes(&buffer, &levelCopy, offsetof(levelData, mapStorage));
+		putBytes(&buffer, (char *) &levelCopy + offsetof(levelData, mapStorage) + sizeof(levelCopy.mapStorage),
+				 sizeof(levelData) - offsetof(levelData, mapStorage) - sizeof(levelCopy.mapStorage));
+		if (levels[i].visited && i != rogue.depthLevel - 1) {
+			putBytes(&buffer, levels[i].mapStorage, sizeof(levels[i].mapStorage));
+		}
+		putGrid(&buffer, levels[i].scentMap);
+		writeCreatureChain(&buffer, levels[i].monsters);
+		writeCreatureChain(&buffer, levels[i].dormantMonsters);
+		writeItemChain(&buffer, levels[i].items);
+	}
+
+	writeCreatureChain(&buffer, monsters->nextCreature);
+	writeCreatureChain(&buffer, dormantMonsters->nextCreature);
+	writeCreatureChain(&buffer, graveyard->nextCreature);
+	writeItemChain(&buffer, floorItems->nextItem);
+	writeItemChain(&buffer, packItems->nextItem);
+	writeItemChain(&buffer, monsterItemsHopper->nextItem);
+
+	putGrid(&buffer, safetyMap);
+	putGrid(&buffer, allySafetyMap);
+	putGrid(&buffer, allyEnemyMap);
+	putGrid(&buffer, allyEnemyCostMap);
+	putGrid(&buffer, chokeMap);
+	putGrid(&buffer, playerPathingMap);
+	putLong(&buffer, numberOfWaypoints);
+
+	putBytes(&buffer, displayedMessage, sizeof(displayedMessage));
+	putBytes(&buffer, messageConfirmed, sizeof(messageConfirmed));
+	putBytes(&buffer, combatText, sizeof(combatText));
+	putLong(&buffer, messageArchivePosition);
+	putBytes(&buffer, messageArchive, sizeof(messageArchive));
+
+	// The per-game tables.
+	for (i = 0; i < (short) (sizeof(snapshotTables) / sizeof(itemTable *)); i++) {
+		for (j = 0; j < snapshotTableSizes[i]; j++) {
+			putBytes(&buffer, snapshotTables[i][j].callTitle, sizeof(snapshotTables[i][j].callTitle));
+			putLong(&buffer, snapshotTables[i][j].frequency);
+			putLong(&buffer, snapshotTables[i][j].identified);
+			putLong(&buffer, snapshotTables[i][j].called);
+		}
+	}
+	putBytes(&buffer, itemTitles, sizeof(itemTitles));
+	putBytes(&buffer, itemColors, sizeof(itemColors));
+	putBytes(&buffer, itemWoods, sizeof(itemWoods));
+	putBytes(&buffer, itemMetals, sizeof(itemMetals));
+	putBytes(&buffer, itemGems, sizeof(itemGems));
+	for (i = 0; i < NUMBER_DUNGEON_FEATURES; i++) {
+		putLong(&buffer, dungeonFeatureCatalog[i].messageDisplayed);
+	}
+	for (i = 0; i < (short) (sizeof(snapshotColors) / sizeof(color *)); i++) {
+		putBytes(&buffer, snapshotColors[i], sizeof(color));
+	}
+
+	free(buffer.creatures);
+	free(buffer.leaders);
+	free(buffer.numbers);
+	if (buffer.unwritable) {
+		free(buffer.data);
+		*length = 0;
+		return NULL;
+	}
+	*length = buffer.length;
+	return buffer.data;
+}
+
+// Reads the header of a snapshot, and returns whether this build can read the rest.
+static boolean readSnapshotHeader(snapshotBuffer *buffer) {
+	long layout[SNAPSHOT_LAYOUT_LENGTH], expectedLayout[SNAPSHOT_LAYOUT_LENGTH];
+	char format[4];
+
+	getBytes(buffer, format, 4);
+	if (memcmp(format, "BRSN", 4) || getLong(buffer) != SNAPSHOT_FORMAT_VERSION) {
+		return false;
+	}
+	getBytes(buffer, layout, sizeof(layout));
+	snapshotLayout(expectedLayout);
+	return (!buffer->overrun && !memcmp(layout, expectedLayout, sizeof(layout)));
+}
+
+// Returns whether a snapshot was made by a build that this one can restore it for: the same
+// snapshot format, struct sizes and catalogs.
+boolean snapshotMatchesBuild(const unsigned char *snapshot, unsigned long length) {
+	snapshotBuffer buffer;
+
+	memset(&buffer, 0, sizeof(buffer));
+	buffer.data = (unsigned char *) snapshot;
+	buffer.capacity = length;
+	return readSnapshotHeader(&buffer);
+}
+
+// Restores a game from a snapshot. Everything must have been freed with freeEverything() first;
+// afterward, freeEverything() frees the restored game as usual, even if the snapshot didn't read.
+// The playback controls of the session are left as they are. Returns false if the snapshot is
+// truncated or was made by a different build.
+boolean restoreGameSnapshot(const unsigned char *snapshot, unsigned long length) {
+	snapshotBuffer buffer;
+	playerCharacter rogueCopy;
+	unsigned char RNGState[64];
+	long equipment[4], lastTarget;
+	short i, j;
+
+	memset(&buffer, 0, sizeof(buffer));
+	buffer.data = (unsigned char *) snapshot;
+	buffer.capacity = length;
+
+	if (!readSnapshotHeader(&buffer)) {
+		return false;
+	}
+
+	getBytes(&buffer, RNGState, randomGeneratorStateSize());
+	setRandomGeneratorState(RNGState);
+	randomNumbersGenerated = getLong(&buffer);
+
+	getBytes(&buffer, &rogueCopy, sizeof(playerCharacter));
+	rogueCopy.playbackMode = rogue.playbackMode; // the playback controls stay as they are
+	rogueCopy.playbackDelayPerTurn = rogue.playbackDelayPerTurn;
+	rogueCopy.playbackDelayThisTurn = rogue.playbackDelayThisTurn;
+	rogueCopy.playbackPaused = rogue.playbackPaused;
+	rogueCopy.playbackFastForward = rogue.playbackFastForward;
+	rogueCopy.playbackOOS = rogue.playbackOOS;
+	rogueCopy.playbackOmniscience = rogue.playbackOmniscience;
+	rogueCopy.nextGame = rogue.nextGame;
+	strcpy(rogueCopy.nextGamePath, rogue.nextGamePath);
+	rogueCopy.nextGameSeed = rogue.nextGameSeed;
+	rogueCopy.milliseconds = rogue.milliseconds;
+	rogue = rogueCopy;
+	for (i = 0; i < 4; i++) {
+		equipment[i] = getLong(&buffer);
+	}
+	rogue.minersLight.lightColor = getColorPointer(&buffer);
+	lastTarget = getLong(&buffer);
+	rogue.flareCount = rogue.flareCapacity = getLong(&buffer);
+	rogue.flares = (rogue.flareCapacity > 0 ? malloc(rogue.flareCapacity * sizeof(flare *)) : NULL);
+	for (i = 0; i < rogue.flareCount; i++) {
+		rogue.flares[i] = malloc(sizeof(flare));
+		getBytes(&buffer, rogue.flares[i], sizeof(flare));
+		rogue.flares[i]->light = getLightPointer(&buffer);
+	}
+	rogue.mapToShore = getGrid(&buffer);
+	rogue.mapToSafeTerrain = getGrid(&buffer);
+	for (i = 0; i < MAX_WAYPOINT_COUNT; i++) {
+		if (i < rogue.wpCount) {
+			rogue.wpDistance[i] = getGrid(&buffer);
+		}
+		if (!rogue.wpDistance[i]) {
+			rogue.wpDistance[i] = allocGrid();
+			fillGrid(rogue.wpDistance[i], 0);
+		}
+	}
+
+	if (player.mapToMe) { // the player isn't freed with everything else
+		freeGrid(player.mapToMe);
+	}
+	if (player.safetyMap) {
+		freeGrid(player.safetyMap);
+	}
+	readCreature(&buffer, &player);
+	getBytes(&buffer, pmap, sizeof(pmap));
+	getBytes(&buffer, tmap, sizeof(tmap));
+	getBytes(&buffer, terrainRandomValues, sizeof(terrainRandomValues));
+
+	forgetLevelDigest(-1);
+	for (i = 0; i < DEEPEST_LEVEL + 1; i++) {
+		getBytes(&buffer, &levels[i], offsetof(levelData, mapStorage));
+		getBytes(&buffer, (char *) &levels[i] + offsetof(levelData, mapStorage) + sizeof(levels[i].mapStorage),
+				 sizeof(levelData) - offsetof(levelData, mapStorage) - sizeof(levels[i].mapStorage));
+		if (levels[i].visited && i != rogue.depthLevel - 1) {
+			getBytes(&buffer, levels[i].mapStorage, sizeof(levels[i].mapStorage));
+		}
+		levels[i].scentMap = getGrid(&buffer);
+		levels[i].monsters = readCreatureChain(&buffer);
+		levels[i].dormantMonsters = readCreatureChain(&buffer);
+		levels[i].items = readItemChain(&buffer);
+	}
+	scentMap = (rogue.depthLevel >= 1 && rogue.depthLevel <= DEEPEST_LEVEL + 1 ? levels[rogue.depthLevel - 1].scentMap : NULL);
+
+	monsters = allocateCreatureChainHead();
+	monsters->nextCreature = readCreatureChain(&buffer);
+	dormantMonsters = allocateCreatureChainHead();
+	dormantMonsters->nextCreature = readCreatureChain(&buffer);
+	graveyard = allocateCreatureChainHead();
+	graveyard->nextCreature = readCreatureChain(&buffer);
+	floorItems = allocateChainHead();
+	floorItems->nextItem = readItemChain(&buffer);
+	packItems = allocateChainHead();
+	packItems->nextItem = readItemChain(&buffer);
+	monsterItemsHopper = allocateChainHead();
+	monsterItemsHopper->nextItem = readItemChain(&buffer);
+
+	rogue.weapon = packItemAt(equipment[0]);
+	rogue.armor = packItemAt(equipment[1]);
+	rogue.ringLeft = packItemAt(equipment[2]);
+	rogue.ringRight = packItemAt(equipment[3]);
+	for (i = 0; i < buffer.creatureCount; i++) {
+		buffer.creatures[i]->leader = numberedCreature(&buffer, buffer.leaders[i]);
+	}
+	rogue.lastTarget = numberedCreature(&buffer, lastTarget);
+
+	safetyMap = getGrid(&buffer);
+	allySafetyMap = getGrid(&buffer);
+	allyEnemyMap = getGrid(&buffer);
+	allyEnemyCostMap = getGrid(&buffer);
+	chokeMap = getGrid(&buffer);
+	playerPathingMap = getGrid(&buffer);
+	numberOfWaypoints = getLong(&buffer);
+
+	getBytes(&buffer, displayedMessage, sizeof(displayedMessage));
+	getBytes(&buffer, messageConfirmed, sizeof(messageConfirmed));
+	getBytes(&buffer, combatText, sizeof(combatText));
+	messageArchivePosition = getLong(&buffer);
+	getBytes(&buffer, messageArchive, sizeof(messageArchive));
+
+	for (i = 0; i < (short) (sizeof(snapshotTables) / sizeof(itemTable *)); i++) {
+		for (j = 0; j < snapshotTableSizes[i]; j++) {
+			getBytes(&buffer, snapshotTables[i][j].callTitle, sizeof(snapshotTables[i][j].callTitle));
+			setKindFrequency(snapshotTables[i], j, getLong(&buffer));
+			snapshotTables[i][j].identified = getLong(&buffer);
+			snapshotTables[i][j].called = getLong(&buffer);
+		}
+	}
+	getBytes(&buffer, itemTitles, sizeof(itemTitles));
+	getBytes(&buffer, itemColors, sizeof(itemColors));
+	getBytes(&buffer, itemWoods, sizeof(itemWoods));
+	getBytes(&buffer, itemMetals, sizeof(itemMetals));
+	getBytes(&buffer, itemGems, sizeof(itemGems));
+	for (i = 0; i < NUMBER_DUNGEON_FEATURES; i++) {
+		dungeonFeatureCatalog[i].messageDisplayed = getLong(&buffer);
+	}
+	for (i = 0; i < (short) (sizeof(snapshotColors) / sizeof(color *)); i++) {
+		getBytes(&buffer, snapshotColors[i], sizeof(color));
+	}
+
+#ifdef AUDIT_RNG
+	RNGLogFile = fopen(RNG_LOG, "a"); // freeEverything() closed it
+#endif
+
+	free(buffer.creatures);
+	free(buffer.leaders);
+	return (!buffer.overrun && buffer.length == length);
+}
+
+#pragma mark Digests
+
+// A digest summarizes the state of the game that the game actually plays on, leaving out what is only
+// displayed (remembered appearances, messages, the cosmetic RNG), so that two ways of arriving at the
+// same point in a game can be compared section by section.
+
+static const char gameDigestNames[NUMBER_GAME_DIGESTS][16] = {
+	"random",
+	"player",
+	"pack",
+	"map",
+	"monsters",
+	"floor items",
+	"other levels",
+	"identification",
+};
+
+const char *gameDigestName(short section) {
+	return gameDigestNames[section];
+}
+
+#define DIGEST_OFFSET_BASIS	14695981039346656037ULL
+
+// FNV-1a, 64 bits wide.
+static void digestBytes(gameDigest *digest, const void *bytes, unsigned long count) {
+	const unsigned char *c = bytes;
+	gameDigest hash = *digest;
+	
+	for (; count > 0; count--) {
+		hash = (hash ^ *c++) * 1099511628211ULL;
+	}
+	*digest = hash;
+}
+
+static void digestNumber(gameDigest *digest, long n) {
+	unsigned char c[4];
+	
+	numberToString((unsigned long) n & 0xFFFFFFFFUL, 4, c);
+	digestBytes(digest, c, 4);
+}
+
+static void digestCreature(gameDigest *digest, creature *monst) {
+	short i;
+	
+	digestNumber(digest, monst->info.monsterID);
+	digestNumber(digest, monst->xLoc);
+	digestNumber(digest, monst->yLoc);
+	digestNumber(digest, monst->depth);
+	digestNumber(digest, monst->currentHP);
+	digestNumber(digest, monst->info.maxHP);
+	digestNumber(digest, monst->turnsUntilRegen);
+	digestNumber(digest, monst->creatureState);
+	digestNumber(digest, monst->creatureMode);
+	digestNumber(digest, monst->ticksUntilTurn);
+	digestNumber(digest, monst->bookkeepingFlags & ~MONST_WILL_FLASH); // flashing is for the display
+	digestNumber(digest, monst->info.flags);
+	digestNumber(digest, monst->info.abilityFlags);
+	for (i = 0; i < NUMBER_OF_STATUS_EFFECTS; i++) {
+		digestNumber(digest, monst->status[i]);
+	}
+	digestNumber(digest, monst->carriedItem != NULL);
+	digestNumber(digest, monst->carriedMonster != NULL);
+}
+
+static void digestCreatureChain(gameDigest *digest, creature *chain) {
+	for (; chain != NULL; chain = chain->nextCreature) {
+		digestCreature(digest, chain);
+	}
+}
+
+static void digestItemChain(gameDigest *digest, item *chain) {
+	for (; chain != NULL; chain = chain->nextItem) {
+		digestNumber(digest, chain->category);
+		digestNumber(digest, chain->kind);
+		digestNumber(digest, chain->flags);
+		digestNumber(digest, chain->enchant1);
+		digestNumber(digest, chain->enchant2);
+		digestNumber(digest, chain->charges);
+		digestNumber(digest, chain->quantity);
+		digestNumber(digest, chain->xLoc);
+		digestNumber(digest, chain->yLoc);
+		digestNumber(digest, chain->inventoryLetter);
+	}
+}
+
+static void digestCell(gameDigest *digest, pcell *cell) {
+	short layer;
+	
+	for (layer = 0; layer < NUMBER_TERRAIN_LAYERS; layer++) {
+		digestNumber(digest, cell->layers[layer]);
+	}
+	digestNumber(digest, cell->flags & ~(IS_IN_PATH | STABLE_MEMORY)); // those two are for the display
+	digestNumber(digest, cell->volume);
+	digestNumber(digest, cell->machineNumber);
+}
+
+// The maps of the levels the player isn't on change only when the player leaves them, so each is digested
+// once and kept until startLevel() stores it again; that keeps the cost of a digest down to that of the
+// current level and the chains, however many levels have been visited.
+static gameDigest levelMapDigests[DEEPEST_LEVEL + 1];
+static boolean levelMapDigested[DEEPEST_LEVEL + 1];
+
+// Forgets the digest of the stored map of a level (0 for the first), or of every level if it's -1.
+void forgetLevelDigest(short level) {
+	short i;
+	
+	for (i = 0; i < DEEPEST_LEVEL + 1; i++) {
+		if (level < 0 || i == level) {
+			levelMapDigested[i] = false;
+		}
+	}
+}
+
+static gameDigest levelMapDigest(short level) {
+	short i, j;
+	
+	if (!levelMapDigested[level]) {
+		levelMapDigests[level] = DIGEST_OFFSET_BASIS;
+		for (i = 0; i < DCOLS; i++) {
+			for (j = 0; j < DROWS; j++) {
+				digestCell(&levelMapDigests[level], &levels[level].mapStorage[i][j]);
+			}
+		}
+		levelMapDigested[level] = true;
+	}
+	return levelMapDigests[level];
+}
+
+// Fills in one digest for each section of the game in progress.
+void digestGame(gameDigest digests[NUMBER_GAME_DIGESTS]) {
+	unsigned char RNGState[64];
+	gameDigest mapDigest;
+	short i, j, k;
+	
+	for (i = 0; i < NUMBER_GAME_DIGESTS; i++) {
+		digests[i] = DIGEST_OFFSET_BASIS;
+	}
+	
+	getRandomGeneratorState(RNGState);
+	digestBytes(&digests[GAME_DIGEST_RANDOM],
+				RNGState + RNG_SUBSTANTIVE * randomGeneratorStateSize() / NUMBER_OF_RNGS,
+				randomGeneratorStateSize() / NUMBER_OF_RNGS);
+	
+	digestCreature(&digests[GAME_DIGEST_PLAYER], &player);
+	digestNumber(&digests[GAME_DIGEST_PLAYER], rogue.depthLevel);
+	digestNumber(&digests[GAME_DIGEST_PLAYER], rogue.deepestLevel);
+	digestNumber(&digests[GAME_DIGEST_PLAYER], rogue.gold);
+	digestNumber(&digests[GAME_DIGEST_PLAYER], rogue.strength);
+	digestNumber(&digests[GAME_DIGEST_PLAYER], rogue.playerTurnNumber);
+	digestNumber(&digests[GAME_DIGEST_PLAYER], rogue.absoluteTurnNumber);
+	
+	digestItemChain(&digests[GAME_DIGEST_PACK], packItems->nextItem);
+	digestNumber(&digests[GAME_DIGEST_PACK], packPosition(rogue.weapon));
+	digestNumber(&digests[GAME_DIGEST_PACK], packPosition(rogue.armor));
+	digestNumber(&digests[GAME_DIGEST_PACK], packPosition(rogue.ringLeft));
+	digestNumber(&digests[GAME_DIGEST_PACK], packPosition(rogue.ringRight));
+	
+	for (i = 0; i < DCOLS; i++) {
+		for (j = 0; j < DROWS; j++) {
+			digestCell(&digests[GAME_DIGEST_MAP], &pmap[i][j]);
+		}
+	}
+	
+	digestCreatureChain(&digests[GAME_DIGEST_MONSTERS], monsters->nextCreature);
+	digestCreatureChain(&digests[GAME_DIGEST_MONSTERS], dormantMonsters->nextCreature);
+	digestItemChain(&digests[GAME_DIGEST_FLOOR_ITEMS], floorItems->nextItem);
+	
+	for (k = 0; k < DEEPEST_LEVEL + 1; k++) {
+		if (levels[k].visited && k != rogue.depthLevel - 1) {
+			mapDigest = levelMapDigest(k);
+			digestNumber(&digests[GAME_DIGEST_LEVELS], (long) (mapDigest >> 32));
+			digestNumber(&digests[GAME_DIGEST_LEVELS], (long) (mapDigest & 0xFFFFFFFFUL));
+			digestCreatureChain(&digests[GAME_DIGEST_LEVELS], levels[k].monsters);
+			digestCreatureChain(&digests[GAME_DIGEST_LEVELS], levels[k].dormantMonsters);
+			digestItemChain(&digests[GAME_DIGEST_LEVELS], levels[k].items);
+			digestNumber(&digests[GAME_DIGEST_LEVELS], levels[k].awaySince);
+		}
+	}
+	
+	for (i = 0; i < (short) (sizeof(snapshotTables) / sizeof(itemTable *)); i++) {
+		for (j = 0; j < snapshotTableSizes[i]; j++) {
+			digestNumber(&digests[GAME_DIGEST_IDENTIFICATION], snapshotTables[i][j].frequency);
+			digestNumber(&digests[GAME_DIGEST_IDENTIFICATION], snapshotTables[i][j].identified);
+			digestNumber(&digests[GAME_DIGEST_IDENTIFICATION], snapshotTables[i][j].called);
+		}
+	}
+}
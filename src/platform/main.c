@@ -1,3 +1,15 @@
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#define ftruncate _chsize
+#else
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define O_BINARY 0 // only Windows tells binary files from text ones
+#endif
 #include "platform.h"
 
 #ifdef BROGUE_TCOD
@@ -17,6 +29,10 @@ short brogueFontSize = -1;
 #endif
 
 extern playerCharacter rogue;
+extern short newGameGeneratorVersion;
+extern unsigned long keyframeInterval;
+extern unsigned long keyframeMemoryLimit;
+extern unsigned long digestInterval;
 struct brogueConsole currentConsole;
 
 boolean serverMode = false;
@@ -25,6 +41,44 @@ unsigned long int firstSeed = 0;
 
 void dumpScores();
 
+// The batch modes: --generate writes a binary level catalog, --scum a seed catalog (binary if its name ends
+// in SEED_CATALOG_SUFFIX) and --find-seeds
+// a list of the seeds that match a predicate. All of them split their seeds across worker processes
+// and can be resumed if interrupted.
+enum batchModes {
+	BATCH_NONE,
+	BATCH_GENERATE,
+	BATCH_SCUM,
+	BATCH_FIND_SEEDS,
+};
+
+static enum batchModes batchMode = BATCH_NONE;
+static unsigned long batchSeeds[2];
+static short batchDepths[2] = {1, AMULET_LEVEL};
+static int batchWorkers = 1;
+static char batchPath[4096] = "";
+static char batchPredicateText[200];
+static seedPredicate batchPredicate;
+static boolean batchBinary = false;
+static boolean batchMachineStats = false; // --machine-stats
+
+// The commands on an existing binary seed catalog: --query lists the seeds that match a predicate,
+// and --catalog-text converts the catalog back to text.
+enum catalogCommands {
+	CATALOG_NONE,
+	CATALOG_QUERY,
+	CATALOG_TEXT,
+};
+
+static enum catalogCommands catalogCommand = CATALOG_NONE;
+static char catalogPath[4096];
+
+static char verifySavePath[4096] = ""; // --verify-save
+static char **verifyPaths = NULL; // --verify
+static int verifyPathCount = 0;
+static char recordingIndexPath[4096] = ""; // --recording-index
+static char bisectPath[4096] = ""; // --bisect
+
 static boolean endswith(const char *str, const char *ending)
 {
 	int str_len = strlen(str), ending_len = strlen(ending);
@@ -38,6 +92,384 @@ static void append(char *str, char *ending, int bufsize) {
 	strcpy(str + str_len, ending);
 }
 
+// Reads "a-b" (or just "a") into range; returns false if it doesn't parse.
+static boolean parseRange(const char *str, unsigned long range[2]) {
+	char *end;
+	
+	range[0] = range[1] = strtoul(str, &end, 10);
+	if (end == str) {
+		return false;
+	}
+	if (*end == '-') {
+		str = end + 1;
+		range[1] = strtoul(str, &end, 10);
+		if (end == str) {
+			return false;
+		}
+	}
+	return (*end == '\0' && range[0] <= range[1]);
+}
+
+// A console with nothing attached, so that the game can run without a terminal or window.
+static void headlessGameLoop() {}
+static boolean headlessPause(short milliseconds) { return false; }
+static void headlessNextEvent(rogueEvent *returnEvent, boolean textInput, boolean colorsDance) {
+	returnEvent->eventType = KEYSTROKE;
+	returnEvent->param1 = ESCAPE_KEY;
+	returnEvent->param2 = 0;
+	returnEvent->controlKey = returnEvent->shiftKey = false;
+}
+static void headlessPlotChar(uchar c, short x, short y, short fr, short fg, short fb, short br, short bg, short bb) {}
+static void headlessRemap(const char *from, const char *to) {}
+static boolean headlessModifierHeld(int modifier) { return false; }
+
+static struct brogueConsole headlessConsole = {
+	headlessGameLoop,
+	headlessPause,
+	headlessNextEvent,
+	headlessPlotChar,
+	headlessRemap,
+	headlessModifierHeld
+};
+
+// Runs the batch job on the seeds from firstSeed to lastSeed, writing stream.
+static void runBatchSeeds(unsigned long firstSeed, unsigned long lastSeed, char *scratchPath, FILE *stream) {
+	unsigned long seed;
+	
+	if (batchMode == BATCH_GENERATE) {
+		generateLevelCatalog(firstSeed, lastSeed, batchDepths[0], batchDepths[1], scratchPath, stream);
+	} else if (batchMode == BATCH_SCUM) {
+		catalogSeeds(firstSeed, lastSeed, batchDepths[1], batchBinary, scratchPath, stream);
+	} else {
+		for (seed = firstSeed; seed <= lastSeed; seed++) {
+			if (seedMatchesPredicate(seed, &batchPredicate, scratchPath)) {
+				fprintf(stream, "%lu\n", seed);
+				printf("Seed %lu matches.\n", seed);
+				fflush(stdout);
+			}
+		}
+	}
+}
+
+// The first line of a shard's checkpoint file, which says what job the shard is part of.
+static void describeShardJob(char *job, size_t size, unsigned long firstSeed, unsigned long lastSeed) {
+	snprintf(job, size, "%i %lu %lu %i %i %i %s", (int) batchMode, firstSeed, lastSeed,
+			 batchDepths[0], batchDepths[1], newGameGeneratorVersion, batchPredicateText);
+}
+
+// If the shard has a checkpoint from the same job, returns true with the seed to pick up from
+// and how long the shard file was when that seed was reached.
+static boolean readShardCheckpoint(const char *shardPath, unsigned long firstSeed, unsigned long lastSeed,
+								   unsigned long *seed, unsigned long *length) {
+	char checkpointPath[4096 + 40], job[300], savedJob[300];
+	boolean resumable = false;
+	FILE *checkpoint;
+	
+	sprintf(checkpointPath, "%s.checkpoint", shardPath);
+	describeShardJob(job, sizeof(job), firstSeed, lastSeed);
+	if ((checkpoint = fopen(checkpointPath, "r"))) {
+		if (!fgets(savedJob, sizeof(savedJob), checkpoint)) {
+			savedJob[0] = '\0';
+		}
+		savedJob[strcspn(savedJob, "\n")] = '\0'; // the whole line has to match, not just its start
+		resumable = (!strcmp(savedJob, job)
+					 && fscanf(checkpoint, "%lu %lu", seed, length) == 2
+					 && *seed >= firstSeed && *seed <= lastSeed + 1);
+		fclose(checkpoint);
+	}
+	return resumable;
+}
+
+// Works through one worker's shard of seeds, a seed at a time. After each seed, the shard's checkpoint file
+// records the next seed and how long the shard file was at that point, so that a rerun of the same
+// command truncates away any partial seed and picks up from there. The checkpoint is written beside
+// the old one and renamed over it, so that an interruption never leaves half of one.
+static boolean runBatchShard(unsigned long firstSeed, unsigned long lastSeed, const char *shardPath) {
+	char scratchPath[4096 + 40], checkpointPath[4096 + 40], newCheckpointPath[4096 + 50], job[300];
+	unsigned long seed = firstSeed, savedSeed, savedLength;
+	FILE *stream = NULL, *checkpoint;
+	
+	sprintf(checkpointPath, "%s.checkpoint", shardPath);
+	sprintf(newCheckpointPath, "%s.new", checkpointPath);
+	describeShardJob(job, sizeof(job), firstSeed, lastSeed);
+	
+	if (readShardCheckpoint(shardPath, firstSeed, lastSeed, &savedSeed, &savedLength)
+		&& (stream = fopen(shardPath, "r+b"))) {
+		
+		if (ftruncate(fileno(stream), savedLength) == 0) {
+			fseek(stream, 0, SEEK_END);
+			seed = savedSeed;
+		} else {
+			fclose(stream);
+			stream = NULL;
+		}
+	}
+	if (!stream && !(stream = fopen(shardPath, "wb"))) {
+		fprintf(stderr, "Could not open %s for writing.\n", shardPath);
+		return false;
+	}
+	
+	sprintf(scratchPath, "%s%s", shardPath, GAME_SUFFIX); // reused on resume, and removed once the shard is done
+	resetMachineTelemetry();
+	for (; seed <= lastSeed; seed++) {
+		runBatchSeeds(seed, seed, scratchPath, stream);
+		fflush(stream);
+		if ((checkpoint = fopen(newCheckpointPath, "w"))) {
+			fprintf(checkpoint, "%s\n%lu %li\n", job, seed + 1, ftell(stream));
+			fclose(checkpoint);
+#ifdef _WIN32
+			remove(checkpointPath); // rename() won't replace a file here
+#endif
+			rename(newCheckpointPath, checkpointPath);
+		}
+	}
+	fclose(stream);
+	remove(scratchPath);
+	
+	if (batchMachineStats) {
+		sprintf(scratchPath, "%s.machines", shardPath);
+		if (!(stream = fopen(scratchPath, "wb")) || !writeMachineTelemetry(stream)) {
+			fprintf(stderr, "Could not write %s.\n", scratchPath);
+		}
+		if (stream) {
+			fclose(stream);
+		}
+	}
+	return true;
+}
+
+static void writeBatchHeader(FILE *stream) {
+	if (batchMode == BATCH_GENERATE) {
+		writeLevelCatalogHeader(stream);
+	} else if (batchMode == BATCH_SCUM && batchBinary) {
+		writeBinarySeedCatalogHeader(stream, batchSeeds[0], batchSeeds[1], batchDepths[1]);
+	} else if (batchMode == BATCH_SCUM) {
+		writeSeedCatalogHeader(stream, batchSeeds[0], batchSeeds[1], batchDepths[1]);
+	} else {
+		fprintf(stream, "# Seeds %lu to %lu matching %s\n", batchSeeds[0], batchSeeds[1], batchPredicateText);
+	}
+}
+
+// Runs a batch mode: splits the seeds into one contiguous shard per worker process, then joins
+// the workers' shards behind the header in seed order. Where there is no fork(), the shards
+// are the same but run one after another in this process.
+static int runBatch() {
+	unsigned long seedCount, seedsThisRun, levelsPerSeed, matchCount = 0, shardSize, first, resumeSeed, shardLength;
+	char shardPath[4096 + 20];
+	char buf[4096];
+	size_t n;
+	int worker, workerCount;
+	boolean succeeded = true;
+#ifndef _WIN32
+	int status;
+	pid_t *pids;
+#endif
+	FILE *output, *shard;
+	struct timeval startTime, endTime;
+	double seconds;
+	
+	currentConsole = headlessConsole;
+	gettimeofday(&startTime, NULL);
+	if (!batchPath[0]) {
+		strcpy(batchPath, (batchMode == BATCH_GENERATE ? "levels" LEVEL_CATALOG_SUFFIX
+						   : batchMode == BATCH_SCUM ? "seed catalog.txt" : "matching seeds.txt"));
+	}
+	batchBinary = (batchMode == BATCH_SCUM && endswith(batchPath, SEED_CATALOG_SUFFIX));
+	
+	seedCount = batchSeeds[1] - batchSeeds[0] + 1;
+	workerCount = (seedCount < (unsigned long) batchWorkers ? (int) seedCount : batchWorkers);
+	shardSize = (seedCount + workerCount - 1) / workerCount;
+	
+	// The seeds that earlier runs got through don't count toward this run's speed.
+	seedsThisRun = seedCount;
+	for (worker = 0; worker < workerCount; worker++) {
+		first = batchSeeds[0] + worker * shardSize;
+		sprintf(shardPath, "%s.%i", batchPath, worker);
+		if (readShardCheckpoint(shardPath, first, min(first + shardSize - 1, batchSeeds[1]), &resumeSeed, &shardLength)) {
+			seedsThisRun -= resumeSeed - first;
+		}
+	}
+	
+#ifdef _WIN32
+	for (worker = 0; worker < workerCount; worker++) {
+		first = batchSeeds[0] + worker * shardSize;
+		sprintf(shardPath, "%s.%i", batchPath, worker);
+		if (!runBatchShard(first, min(first + shardSize - 1, batchSeeds[1]), shardPath)) {
+			fprintf(stderr, "Worker %i failed.\n", worker);
+			succeeded = false;
+		}
+	}
+#else
+	pids = malloc(workerCount * sizeof(pid_t));
+	for (worker = 0; worker < workerCount; worker++) {
+		first = batchSeeds[0] + worker * shardSize;
+		sprintf(shardPath, "%s.%i", batchPath, worker);
+		pids[worker] = fork();
+		if (pids[worker] == 0) {
+			exit(runBatchShard(first, min(first + shardSize - 1, batchSeeds[1]), shardPath) ? 0 : 1);
+		} else if (pids[worker] < 0) {
+			fprintf(stderr, "Could not start worker %i.\n", worker);
+			succeeded = false;
+		}
+	}
+	for (worker = 0; worker < workerCount; worker++) {
+		if (pids[worker] > 0
+			&& (waitpid(pids[worker], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+			fprintf(stderr, "Worker %i failed.\n", worker);
+			succeeded = false;
+		}
+	}
+	free(pids);
+#endif
+	if (!succeeded) {
+		fprintf(stderr, "Run the same command again to resume.\n");
+		return 1;
+	}
+	
+	if (!(output = fopen(batchPath, "wb"))) {
+		fprintf(stderr, "Could not open %s for writing.\n", batchPath);
+		return 1;
+	}
+	writeBatchHeader(output);
+	resetMachineTelemetry();
+	for (worker = 0; worker < workerCount; worker++) {
+		sprintf(shardPath, "%s.%i.machines", batchPath, worker);
+		if (batchMachineStats && (shard = fopen(shardPath, "rb"))) {
+			addMachineTelemetry(shard);
+			fclose(shard);
+			remove(shardPath);
+		}
+		sprintf(shardPath, "%s.%i", batchPath, worker);
+		if ((shard = fopen(shardPath, "rb"))) {
+			while ((n = fread(buf, 1, sizeof(buf), shard)) > 0) {
+				fwrite(buf, 1, n, output);
+				if (batchMode == BATCH_FIND_SEEDS) {
+					for (; n > 0; n--) {
+						matchCount += (buf[n - 1] == '\n');
+					}
+				}
+			}
+			fclose(shard);
+		}
+		remove(shardPath);
+		strcat(shardPath, ".checkpoint");
+		remove(shardPath);
+	}
+	fclose(output);
+	
+	if (batchBinary && (!(output = fopen(batchPath, "r+b")) || !indexSeedCatalog(output))) {
+		fprintf(stderr, "Could not index %s.\n", batchPath);
+		succeeded = false;
+	}
+	if (batchBinary && output) {
+		fclose(output);
+	}
+	if (!succeeded) {
+		return 1;
+	}
+	
+	gettimeofday(&endTime, NULL);
+	seconds = (endTime.tv_sec - startTime.tv_sec) + (endTime.tv_usec - startTime.tv_usec) / 1000000.0;
+	if (seedsThisRun < seedCount) {
+		printf("Resumed after %lu of the seeds; %lu were left for this run.\n", seedCount - seedsThisRun, seedsThisRun);
+	}
+	if (batchMode == BATCH_GENERATE) {
+		levelsPerSeed = batchDepths[1] - batchDepths[0] + 1;
+		printf("Generated %lu levels from %lu seeds in %.2f seconds (%.1f levels/sec) into %s.\n",
+			   levelsPerSeed * seedCount, seedCount, seconds, levelsPerSeed * seedsThisRun / max(seconds, 0.001), batchPath);
+	} else if (batchMode == BATCH_SCUM) {
+		printf("Cataloged %lu seeds through depth %i in %.2f seconds (%.1f seeds/sec) into %s.\n",
+			   seedCount, batchDepths[1], seconds, seedsThisRun / max(seconds, 0.001), batchPath);
+	} else {
+		printf("Searched %lu seeds in %.2f seconds (%.1f seeds/sec); %lu matched, listed in %s.\n",
+			   seedCount, seconds, seedsThisRun / max(seconds, 0.001), matchCount, batchPath);
+	}
+	if (batchMachineStats) {
+		dumpMachineTelemetry(stdout);
+	}
+	return 0;
+}
+
+// Maps the file at path into memory, or, where there is no mmap(), reads it in.
+// Returns NULL if it can't, having said why.
+static unsigned char *mapCatalog(const char *path, struct stat *status) {
+	unsigned char *catalog;
+	int file;
+	
+	if ((file = open(path, O_RDONLY | O_BINARY)) < 0 || fstat(file, status) < 0) {
+		fprintf(stderr, "Could not open %s.\n", path);
+		return NULL;
+	}
+#ifdef _WIN32
+	catalog = malloc(max(status->st_size, 1));
+	if (read(file, catalog, status->st_size) != status->st_size) {
+		free(catalog);
+		catalog = NULL;
+	}
+#else
+	catalog = mmap(NULL, max(status->st_size, 1), PROT_READ, MAP_SHARED, file, 0);
+	if (catalog == MAP_FAILED) {
+		catalog = NULL;
+	}
+#endif
+	close(file);
+	if (!catalog) {
+		fprintf(stderr, "Could not map %s.\n", path);
+	}
+	return catalog;
+}
+
+static void unmapCatalog(unsigned char *catalog, struct stat *status) {
+#ifdef _WIN32
+	free(catalog);
+#else
+	munmap(catalog, max(status->st_size, 1));
+#endif
+}
+
+// Runs a command on a binary seed catalog, which is mapped into memory rather than read.
+static int runCatalogCommand() {
+	struct stat status;
+	struct timeval startTime, endTime;
+	unsigned char *catalog;
+	FILE *output = stdout;
+	long matchCount = 0;
+	boolean succeeded;
+	
+	currentConsole = headlessConsole;
+	if (!(catalog = mapCatalog(catalogPath, &status))) {
+		return 1;
+	}
+	if (batchPath[0] && !(output = fopen(batchPath, "w"))) {
+		fprintf(stderr, "Could not open %s for writing.\n", batchPath);
+		unmapCatalog(catalog, &status);
+		return 1;
+	}
+	
+	gettimeofday(&startTime, NULL);
+	if (catalogCommand == CATALOG_QUERY) {
+		matchCount = querySeedCatalog(catalog, status.st_size, &batchPredicate, output);
+		succeeded = (matchCount >= 0);
+	} else {
+		succeeded = writeSeedCatalogText(catalog, status.st_size, output);
+	}
+	gettimeofday(&endTime, NULL);
+	
+	if (output != stdout) {
+		fclose(output);
+	}
+	unmapCatalog(catalog, &status);
+	if (!succeeded) {
+		fprintf(stderr, "%s is not an indexed seed catalog.\n", catalogPath);
+		return 1;
+	}
+	if (catalogCommand == CATALOG_QUERY) {
+		fprintf(stderr, "%li seeds matched in %.3f ms.\n", matchCount,
+				(endTime.tv_sec - startTime.tv_sec) * 1000.0 + (endTime.tv_usec - startTime.tv_usec) / 1000.0);
+	}
+	return 0;
+}
+
 static void printCommandlineHelp() {
 	printf("%s", 
 	"--help         -h          print this help message\n"
@@ -46,13 +478,30 @@ static void printCommandlineHelp() {
 	"--scores                   dump scores to output and exit immediately\n"
 	"-n                         start a new game, skipping the menu\n"
 	"-s seed                    start a new game with the specified numerical seed\n"
+	"--generator N              generate new dungeons with generator version N (0 is classic)\n"
 	"-o filename[.broguesave]   open a save file (extension optional)\n"
 	"-v recording[.broguerec]   view a recording (extension optional)\n"
+	"--verify-save filename     replay a saved game and check it against the snapshot saved with it\n"
+	"--verify recording...      replay recordings with nothing drawn; fails if any goes out of sync (see --workers)\n"
+	"--bisect recording         replay a recording against the digests kept with it to find where it first strays\n"
+	"--digest-interval N        keep a digest of the game with recordings every N turns (default 100; 0 for none)\n"
+	"--recording-index recording  summarize each depth of a finished recording from the index saved with it\n"
+	"--keyframe-interval N      while viewing a recording, keep a keyframe for seeking every N turns (default 500)\n"
+	"--keyframe-memory MB       keep at most MB megabytes of keyframes (default 100; 0 for none)\n"
 #ifdef BROGUE_TCOD
 	"--size N                   starts the game at font size N (1 to 13)\n"
 	"--noteye-hack              ignore SDL-specific application state checks\n"
 #endif
 	"--no-menu      -M          never display the menu (automatically pick new game)\n"
+	"--generate S[-S] [D[-D]]   write seeds S-S, depths D-D (default 1-26) to a level catalog and exit\n"
+	"--scum S[-S] [D]           write the items of seeds S-S through depth D (default 5) to a seed catalog and exit\n"
+	"                           (an indexed binary one if the output name ends in " SEED_CATALOG_SUFFIX ")\n"
+	"--find-seeds S[-S] P       list the seeds in S-S that match P, such as wand:domination@3 or armor+3@4,vault@4\n"
+	"--workers N                split a batch mode (rerun to resume) or --verify across N processes\n"
+	"--query catalog P          list the seeds in a binary seed catalog that match P, as for --find-seeds\n"
+	"--catalog-text catalog     convert a binary seed catalog to a text one\n"
+	"--output filename          where a batch mode, --query or --catalog-text writes\n"
+	"--machine-stats            after a batch mode, print how each blueprint's machines fared at each depth\n"
 #ifdef BROGUE_CURSES
 	"--term         -t          run in ncurses-based terminal mode\n"
 #endif
@@ -69,6 +518,168 @@ static void badArgument(const char *arg) {
 	printCommandlineHelp();
 }
 
+// Replays a saved game's recording and checks that it arrives at the snapshot saved with it.
+static int runVerifySave() {
+	struct timeval startTime, endTime;
+	short differences;
+	
+	currentConsole = headlessConsole;
+	gettimeofday(&startTime, NULL);
+	differences = verifySavedGame(verifySavePath, stdout);
+	gettimeofday(&endTime, NULL);
+	
+	if (differences == -2) {
+		fprintf(stderr, "%s has a snapshot made by a build that lays the game out differently; it can't be checked.\n",
+				verifySavePath);
+		return 1;
+	} else if (differences < 0) {
+		fprintf(stderr, "%s is not a saved game with a snapshot.\n", verifySavePath);
+		return 1;
+	}
+	printf("%s: %s (%.2f seconds).\n", verifySavePath,
+		   (differences ? "the replayed game differs from the snapshot" : "the replayed game matches the snapshot"),
+		   (endTime.tv_sec - startTime.tv_sec) + (endTime.tv_usec - startTime.tv_usec) / 1000000.0);
+	return (differences ? 1 : 0);
+}
+
+// Summarizes each depth of the recording at recordingIndexPath from its index, without replaying it:
+// when the player first got there, how many turns they spent there and over how many visits.
+static int runRecordingIndex() {
+	recordingIndexEntry *entries;
+	unsigned long entryCount, turnCount, i, nextTurn;
+	unsigned long firstTurn[DEEPEST_LEVEL + 2], firstLocation[DEEPEST_LEVEL + 2], turnsSpent[DEEPEST_LEVEL + 2];
+	short visits[DEEPEST_LEVEL + 2], depth;
+	
+	if (!(entries = readRecordingIndex(recordingIndexPath, &entryCount, &turnCount))) {
+		fprintf(stderr, "%s is not a finished recording with an index.\n", recordingIndexPath);
+		return 1;
+	}
+	memset(visits, 0, sizeof(visits));
+	memset(turnsSpent, 0, sizeof(turnsSpent));
+	for (i = 0; i < entryCount; i++) {
+		depth = max(0, min(DEEPEST_LEVEL + 1, entries[i].depthLevel));
+		if (!visits[depth]) {
+			firstTurn[depth] = entries[i].turnNumber;
+			firstLocation[depth] = entries[i].recordingLocation;
+		}
+		if (i == 0 || entries[i - 1].depthLevel != entries[i].depthLevel) {
+			visits[depth]++;
+		}
+		nextTurn = (i + 1 < entryCount ? entries[i + 1].turnNumber : max(turnCount, entries[i].turnNumber));
+		turnsSpent[depth] += nextTurn - entries[i].turnNumber;
+	}
+	
+	printf("%s: %lu turns, %lu index entries.\n", recordingIndexPath, turnCount, entryCount);
+	printf("depth  first turn  first byte  turns spent  visits\n");
+	for (depth = 0; depth <= DEEPEST_LEVEL + 1; depth++) {
+		if (visits[depth]) {
+			printf("%5i  %10lu  %10lu  %11lu  %6i\n",
+				   depth, firstTurn[depth], firstLocation[depth], turnsSpent[depth], visits[depth]);
+		}
+	}
+	free(entries);
+	return 0;
+}
+
+// Replays the recording at bisectPath against its digests and reports where it first strays.
+static int runBisect() {
+	short result;
+	
+	currentConsole = headlessConsole;
+	result = bisectRecording(bisectPath, stdout);
+	if (result < 0) {
+		fprintf(stderr, "%s is not a recording with digests that this version can play.\n", bisectPath);
+		return 1;
+	}
+	return result;
+}
+
+// Replays one recording with nothing drawn and reports how it went and how fast; returns whether it stayed in sync.
+static boolean verifyAndReport(char *path) {
+	struct timeval startTime, endTime;
+	unsigned long turns;
+	short result;
+	double seconds, digestSeconds;
+	
+	gettimeofday(&startTime, NULL);
+	result = verifyRecording(path, &turns, &digestSeconds, stdout);
+	gettimeofday(&endTime, NULL);
+	seconds = (endTime.tv_sec - startTime.tv_sec) + (endTime.tv_usec - startTime.tv_usec) / 1000000.0;
+	if (result < 0) {
+		printf("%s: not a recording this version can play.\n", path);
+	} else {
+		printf("%s: %s, %lu turns in %.2f seconds (%.0f turns/sec, %.1f%% of it taking digests).\n", path,
+			   (result ? "FAILED" : "ok"), turns, seconds, turns / max(seconds, 0.001),
+			   100 * digestSeconds / max(seconds, 0.001));
+	}
+	fflush(stdout);
+	return (result == 0);
+}
+
+// Replays each recording in verifyPaths with nothing drawn and reports its speed. The workers take
+// the next unclaimed file from a counter they share, so that long recordings don't hold up a whole shard.
+// Where there is no fork(), this process replays them all itself.
+static int runVerify() {
+	struct timeval startTime, endTime;
+	int failures = 0, file;
+#ifndef _WIN32
+	int worker, workerCount, status;
+	pid_t *pids;
+	int *nextFile;
+#endif
+	
+	currentConsole = headlessConsole;
+	gettimeofday(&startTime, NULL);
+#ifdef _WIN32
+	for (file = 0; file < verifyPathCount; file++) {
+		failures += !verifyAndReport(verifyPaths[file]);
+	}
+#else
+	workerCount = min(batchWorkers, verifyPathCount);
+	nextFile = mmap(NULL, sizeof(int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (nextFile == MAP_FAILED) {
+		fprintf(stderr, "Could not share the list of recordings between workers.\n");
+		return 1;
+	}
+	*nextFile = 0;
+	pids = malloc(workerCount * sizeof(pid_t));
+	
+	for (worker = 0; worker < workerCount; worker++) {
+		pids[worker] = fork();
+		if (pids[worker] == 0) {
+			while ((file = __sync_fetch_and_add(nextFile, 1)) < verifyPathCount) {
+				failures += !verifyAndReport(verifyPaths[file]);
+			}
+			exit(min(failures, 100));
+		} else if (pids[worker] < 0) {
+			fprintf(stderr, "Could not start worker %i.\n", worker);
+			failures++;
+		}
+	}
+	for (worker = 0; worker < workerCount; worker++) {
+		if (pids[worker] > 0) {
+			if (waitpid(pids[worker], &status, 0) < 0 || !WIFEXITED(status)) {
+				fprintf(stderr, "Worker %i failed.\n", worker);
+				failures++;
+			} else {
+				failures += WEXITSTATUS(status);
+			}
+		}
+	}
+	free(pids);
+	if (*nextFile < verifyPathCount) {
+		failures++; // no worker got to some of the files
+	}
+	munmap(nextFile, sizeof(int));
+#endif
+	
+	gettimeofday(&endTime, NULL);
+	printf("Verified %i recordings in %.2f seconds; %s.\n", verifyPathCount,
+		   (endTime.tv_sec - startTime.tv_sec) + (endTime.tv_usec - startTime.tv_usec) / 1000000.0,
+		   (failures ? "some FAILED" : "all in sync"));
+	return (failures ? 1 : 0);
+}
+
 int main(int argc, char *argv[])
 {
 #ifdef BROGUE_TCOD
@@ -102,6 +713,161 @@ int main(int argc, char *argv[])
 			}
 		}
 
+		if (strcmp(argv[i], "--generator") == 0) {
+			if (i + 1 < argc) {
+				int version = atoi(argv[i + 1]);
+				if (version >= 0 && version < NUMBER_GENERATOR_VERSIONS) {
+					i++;
+					newGameGeneratorVersion = version;
+					continue;
+				}
+			}
+		}
+
+		if (strcmp(argv[i], "--generate") == 0 || strcmp(argv[i], "--scum") == 0) {
+			unsigned long depths[2];
+			
+			if (i + 1 < argc && parseRange(argv[i + 1], batchSeeds) && batchSeeds[0] > 0) {
+				batchMode = (strcmp(argv[i], "--generate") == 0 ? BATCH_GENERATE : BATCH_SCUM);
+				if (batchMode == BATCH_SCUM) {
+					batchDepths[1] = 5;
+				}
+				i++;
+				if (i + 1 < argc && parseRange(argv[i + 1], depths)) {
+					if (depths[0] < 1 || depths[1] > DEEPEST_LEVEL
+						|| (batchMode == BATCH_SCUM && depths[0] != depths[1])) {
+						badArgument(argv[i + 1]);
+						return 1;
+					}
+					i++;
+					batchDepths[0] = (batchMode == BATCH_SCUM ? 1 : depths[0]);
+					batchDepths[1] = depths[1];
+				}
+				continue;
+			}
+		}
+		
+		if (strcmp(argv[i], "--find-seeds") == 0) {
+			if (i + 2 < argc && parseRange(argv[i + 1], batchSeeds) && batchSeeds[0] > 0) {
+				if (strlen(argv[i + 2]) >= sizeof(batchPredicateText)
+					|| !parseSeedPredicate(argv[i + 2], &batchPredicate)) {
+					badArgument(argv[i + 2]);
+					return 1;
+				}
+				strcpy(batchPredicateText, argv[i + 2]);
+				batchMode = BATCH_FIND_SEEDS;
+				i += 2;
+				continue;
+			}
+		}
+		
+		if (strcmp(argv[i], "--query") == 0 && i + 2 < argc) {
+			if (strlen(argv[i + 2]) >= sizeof(batchPredicateText)
+				|| !parseSeedPredicate(argv[i + 2], &batchPredicate)) {
+				badArgument(argv[i + 2]);
+				return 1;
+			}
+			strncpy(catalogPath, argv[i + 1], 4096);
+			catalogPath[4095] = '\0';
+			catalogCommand = CATALOG_QUERY;
+			i += 2;
+			continue;
+		}
+		
+		if (strcmp(argv[i], "--catalog-text") == 0 && i + 1 < argc) {
+			strncpy(catalogPath, argv[i + 1], 4096);
+			catalogPath[4095] = '\0';
+			catalogCommand = CATALOG_TEXT;
+			i++;
+			continue;
+		}
+		
+		if (strcmp(argv[i], "--workers") == 0) {
+			if (i + 1 < argc && atoi(argv[i + 1]) > 0) {
+				i++;
+				batchWorkers = atoi(argv[i]);
+				continue;
+			}
+		}
+		
+		if (strcmp(argv[i], "--machine-stats") == 0) {
+			batchMachineStats = true;
+			continue;
+		}
+		
+		if (strcmp(argv[i], "--output") == 0) {
+			if (i + 1 < argc) {
+				i++;
+				strncpy(batchPath, argv[i], 4096);
+				batchPath[4095] = '\0';
+				continue;
+			}
+		}
+
+		if (strcmp(argv[i], "--verify-save") == 0 && i + 1 < argc) {
+			i++;
+			strncpy(verifySavePath, argv[i], 4096);
+			verifySavePath[4095] = '\0';
+			if (!endswith(verifySavePath, GAME_SUFFIX)) {
+				append(verifySavePath, GAME_SUFFIX, 4096);
+			}
+			continue;
+		}
+		
+		if (strcmp(argv[i], "--recording-index") == 0 && i + 1 < argc) {
+			i++;
+			strncpy(recordingIndexPath, argv[i], 4096);
+			recordingIndexPath[4095] = '\0';
+			if (!endswith(recordingIndexPath, RECORDING_SUFFIX)) {
+				append(recordingIndexPath, RECORDING_SUFFIX, 4096);
+			}
+			continue;
+		}
+		
+		if (strcmp(argv[i], "--bisect") == 0 && i + 1 < argc) {
+			i++;
+			strncpy(bisectPath, argv[i], 4096);
+			bisectPath[4095] = '\0';
+			if (!endswith(bisectPath, RECORDING_SUFFIX)) {
+				append(bisectPath, RECORDING_SUFFIX, 4096);
+			}
+			continue;
+		}
+		
+		if (strcmp(argv[i], "--verify") == 0 && i + 1 < argc) {
+			verifyPaths = &argv[i + 1];
+			for (verifyPathCount = 0; i + 1 < argc && argv[i + 1][0] != '-'; i++) {
+				verifyPathCount++;
+			}
+			if (verifyPathCount > 0) {
+				continue;
+			}
+		}
+		
+		if (strcmp(argv[i], "--keyframe-interval") == 0) {
+			if (i + 1 < argc && atol(argv[i + 1]) > 0) {
+				i++;
+				keyframeInterval = atol(argv[i]);
+				continue;
+			}
+		}
+		
+		if (strcmp(argv[i], "--digest-interval") == 0) {
+			if (i + 1 < argc && atol(argv[i + 1]) >= 0) {
+				i++;
+				digestInterval = atol(argv[i]);
+				continue;
+			}
+		}
+		
+		if (strcmp(argv[i], "--keyframe-memory") == 0) {
+			if (i + 1 < argc && atol(argv[i + 1]) >= 0) {
+				i++;
+				keyframeMemoryLimit = atol(argv[i]) * 1000000;
+				continue;
+			}
+		}
+
 		if(strcmp(argv[i], "-n") == 0) {
 			if (rogue.nextGameSeed == 0) {
 				rogue.nextGame = NG_NEW_GAME;
@@ -214,6 +980,25 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 	
+	if (batchMode != BATCH_NONE) {
+		return runBatch();
+	}
+	if (catalogCommand != CATALOG_NONE) {
+		return runCatalogCommand();
+	}
+	if (verifySavePath[0]) {
+		return runVerifySave();
+	}
+	if (verifyPathCount > 0) {
+		return runVerify();
+	}
+	if (recordingIndexPath[0]) {
+		return runRecordingIndex();
+	}
+	if (bisectPath[0]) {
+		return runBisect();
+	}
+	
 	loadKeymap();
 	currentConsole.gameLoop();
 	
@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
@@ -55,6 +56,14 @@ void pausingTimerStartsNow() {
 	
 }
 
+// Milliseconds of real time, as opposed to the processor time that clock() measures.
+unsigned long wallClockMilliseconds() {
+	struct timeval now;
+	
+	gettimeofday(&now, NULL);
+	return now.tv_sec * 1000UL + now.tv_usec / 1000;
+}
+
 boolean shiftKeyIsDown() {
 	return currentConsole.modifierHeld(0);
 }